@@ -1 +1,2 @@
-clang -O3 -I include main.c include/lexer.c include/error.c include/token.c include/utils.c include/ast.c include/parser.c include/analyzer.c include/bytecode.c include/bytecode_compiler.c include/vm.c -o ./bin/cimpl
+clang -O3 -I include main.c include/lexer.c include/error.c include/token.c include/utils.c include/ast.c include/parser.c include/analyzer.c include/bytecode.c include/bytecode_compiler.c include/peephole.c include/vm.c include/jit.c include/trace.c include/aot.c include/object.c include/image.c include/source.c include/arena.c include/scope.c -o ./bin/cimpl
+clang -O3 -c include/object_runtime.c -o ./bin/cimpl_runtime.o
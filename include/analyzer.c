@@ -7,159 +7,125 @@
 #include <stdlib.h>
 #include <string.h>
 
-static int hash(char *key) {
-    size_t length = strlen(key);
-    size_t sum = 0;
-    for (int i = 0; i < length; i++) {
-        sum += (i + 1) * key[i];
-    }
-    return sum % 512;
-}
-
-HashTable *hashtable_create() {
-    HashTable *ht = malloc(sizeof(HashTable));
-    ht->size = 0;
-    ht->keys = NULL;
-    ht->datatypes = NULL;
-    return ht;
-}
-
-void hashtable_destroy(HashTable *ht) {
-    for (int i = 0; i < ht->size; i++) {
-        for (int j = 0; j < 512; j++) {
-            free(ht->keys[i][j]);
-        }
-        free(ht->keys[i]);
-        free(ht->datatypes[i]);
-    }
-    free(ht);
-}
-
-void hashtable_set(HashTable *ht, char *key, GenericDT *value) {
-    int index = hash(key);
-    for (int i = 0; i < ht->size; i++) {
-        if (ht->keys[i][index] != NULL && strcmp(ht->keys[i][index], key)) {
-            continue;
-        }
-        ht->keys[i][index] = key;
-        ht->datatypes[i][index] = value;
-        return;
-    }
-    ht->size++;
-    char *(*new_keys)[512] = realloc(ht->keys, ht->size * sizeof(char *[512]));
-    GenericDT *(*new_datatypes)[512] = realloc(ht->datatypes, ht->size * sizeof(GenericDT *[512]));
-    for (int i = 0; i < 512; i++) {
-        new_datatypes[ht->size - 1][i] = NULL;
-        new_keys[ht->size - 1][i] = NULL;
-    }
-    ht->keys = new_keys;
-    ht->datatypes = new_datatypes;
-    ht->keys[ht->size - 1][index] = key;
-    ht->datatypes[ht->size - 1][index] = value;
-}
-
-void hashtable_get(HashTable *ht, char *key, GenericDT **datatype) {
-    *datatype = NULL;
-    int index = hash(key);
-    for (int i = 0; i < ht->size; i++) {
-        if (ht->keys[i][index] == NULL) {
-            return;
-        }
-        if (strcmp(ht->keys[i][index], key)) {
-            continue;
-        }
-        *datatype = ht->datatypes[i][index];
-        return;
-    }
-}
-
-AnalysisCache *analysis_cache_create(char *source) {
-    AnalysisCache *cache = malloc(sizeof(AnalysisCache));
+AnalysisCache *analysis_cache_create(Ast *ast, char *source, Arena *arena) {
+    AnalysisCache *cache = arena_alloc(arena, sizeof(AnalysisCache));
+    cache->ast = ast;
     cache->source = source;
-    cache->defs = NULL;
+    cache->arena = arena;
+    scope_table_init(&cache->scopes, arena);
     cache->current_function = NULL;
     cache->errors = NULL;
     cache->errors_size = 0;
-    cache->cache_size = 0;
     cache->in_loop = 0;
-    cache->current_scope = 0;
+    cache->fn_depth = 0;
+    cache->stack_index = -1;
+    cache->scope_slots = NULL;
+    cache->scope_slots_capacity = 0;
     analysis_cache_extend(cache);
     return cache;
 }
 
-static void analysis_cache_get(AnalysisCache *cache, Token *var_token, GenericDT **datatype, int *scope) {
-    char *var_name = substring(cache->source, var_token->start, var_token->end);
-    *datatype = NULL;
-    for (int i = cache->cache_size - 1; i >= 0; i--) {
-        hashtable_get(cache->defs[i], var_name, datatype);
-        if (*datatype != NULL) {
-            *scope = i;
-            return;
-        }
+// a declaration whose type couldn't be worked out is skipped, uses of the name see what it shadows
+static ScopeEntry *analysis_cache_lookup(AnalysisCache *cache, uint32_t symbol) {
+    ScopeEntry *entry = scope_table_lookup(&cache->scopes, symbol);
+    while (entry != NULL && entry->datatype == NULL) {
+        entry = entry->shadowed < 0 ? NULL : &cache->scopes.entries[entry->shadowed];
     }
+    return entry;
 }
 
-static void analysis_cache_set(AnalysisCache *cache, Token *var_token, GenericDT *datatype, int scope) {
-    if (scope == -1) {
-        scope = cache->cache_size - 1;
+static void analysis_cache_get(AnalysisCache *cache, Token *var_token, GenericDT **datatype, AstIndex *decl) {
+    ScopeEntry *entry = analysis_cache_lookup(cache, var_token->symbol);
+    *datatype = NULL;
+    *decl = AST_NONE;
+    if (entry != NULL) {
+        *datatype = entry->datatype;
+        *decl = entry->decl;
     }
-    char *var_name = substring(cache->source, var_token->start, var_token->end);
-    HashTable *current_scope = cache->defs[scope];
-    hashtable_set(current_scope, var_name, datatype);
+}
+
+// declares the name in the innermost scope, a variable takes the next slot of the current frame
+static AstIndex analysis_cache_set(AnalysisCache *cache, Token *var_token, GenericDT *datatype, int is_function) {
+    int slot = is_function ? -1 : ++cache->stack_index;
+    ScopeEntry *entry = scope_table_declare(&cache->scopes, var_token->symbol);
+    entry->datatype = datatype;
+    entry->decl = ast_add_declaration(cache->ast, slot, cache->fn_depth);
+    return entry->decl;
 }
 
 static void analysis_cache_extend(AnalysisCache *cache) {
-    cache->cache_size++;
-    HashTable **new_defs = realloc(cache->defs, cache->cache_size * sizeof(HashTable *));
-    HashTable *new_ht = hashtable_create();
-    new_defs[cache->cache_size - 1] = new_ht;
-    cache->defs = new_defs;
+    if (cache->scope_slots_capacity <= cache->scopes.depth) {
+        int capacity = cache->scope_slots_capacity + 32;
+        cache->scope_slots = arena_grow(cache->arena, cache->scope_slots, cache->scope_slots_capacity * sizeof(int), capacity * sizeof(int));
+        cache->scope_slots_capacity = capacity;
+    }
+    cache->scope_slots[cache->scopes.depth] = cache->stack_index;
+    scope_table_push(&cache->scopes);
 }
 
+// the slots of the scope's variables are free again
 static void analysis_cache_shrink(AnalysisCache *cache) {
-    cache->cache_size--;
-    hashtable_destroy(cache->defs[cache->cache_size]);
-    HashTable **new_defs = realloc(cache->defs, cache->cache_size * sizeof(HashTable *));
-    cache->defs = new_defs;
+    scope_table_pop(&cache->scopes);
+    cache->stack_index = cache->scope_slots[cache->scopes.depth];
 }
 
-static int analysis_cache_defined(AnalysisCache *cache, Token *var_token) {
-    char *var_name = substring(cache->source, var_token->start, var_token->end);
-    for (int i = cache->cache_size - 1; i >= 0; i--) {
-        HashTable *current_scope = cache->defs[i];
-        GenericDT *dt;
-        hashtable_get(current_scope, var_name, &dt);
-        if (dt != NULL) {
-            return 1;
-        }
-    }
-    return 0;
-}
+static int analysis_cache_defined(AnalysisCache *cache, Token *var_token) { return analysis_cache_lookup(cache, var_token->symbol) != NULL; }
 
 static int analysis_cache_defined_in_current_scope(AnalysisCache *cache, Token *var_token) {
-    char *var_name = substring(cache->source, var_token->start, var_token->end);
-    HashTable *current_scope = cache->defs[cache->cache_size - 1];
-    GenericDT *dt;
-    hashtable_get(current_scope, var_name, &dt);
-    return dt != NULL;
+    ScopeEntry *entry = analysis_cache_lookup(cache, var_token->symbol);
+    return entry != NULL && entry->depth == cache->scopes.depth - 1;
 }
 
 static void analysis_cache_add_error(AnalysisCache *cache, char *message, ErrorType type, Token *token) {
     cache->errors_size++;
-    Error **new_errors = realloc(cache->errors, sizeof(Error *) * cache->errors_size);
+    Error **new_errors = arena_grow(cache->arena, cache->errors, sizeof(Error *) * (cache->errors_size - 1), sizeof(Error *) * cache->errors_size);
     cache->errors = new_errors;
-    Error *err = error_create();
+    Error *err = error_create(cache->arena);
     err->message = message;
     err->type = type;
     err->token = token;
     cache->errors[cache->errors_size - 1] = err;
 }
 
+static void analysis_cache_process_call(AnalysisCache *cache, Expression *call, GenericDT **datatype) {
+    Token *call_name = ast_token(cache->ast, call->token);
+    GenericDT *fn_datatype = NULL;
+    analysis_cache_get(cache, call_name, &fn_datatype, &call->decl);
+    int is_defined = 1;
+    if (fn_datatype == NULL) {
+        is_defined = 0;
+        analysis_cache_add_error(cache, "undefined function", ReferenceError, call_name);
+    } else if (fn_datatype->type != Complex) {
+        is_defined = 0;
+        analysis_cache_add_error(cache, "not a function", TypeError, call_name);
+    }
+    if (!is_defined) {
+        call->datatype = NULL;
+    } else {
+        call->datatype = fn_datatype->data.fn_datatype->return_type;
+    }
+    *datatype = call->datatype;
+
+    int has_validatable_params = is_defined && call->args.size == fn_datatype->data.fn_datatype->params_size;
+    if (!has_validatable_params) {
+        analysis_cache_add_error(cache, "wrong number of arguments", TypeError, call_name);
+    }
+    for (int i = 0; i < call->args.size; i++) {
+        GenericDT *arg_dt;
+        analysis_cache_process_expression(cache, ast_arg(cache->ast, call, i), &arg_dt);
+        if (has_validatable_params && arg_dt != NULL && !generic_datatype_compare(arg_dt, fn_datatype->data.fn_datatype->params[i].datatype)) {
+            analysis_cache_add_error(cache, "argument has wrong type", TypeError, call_name);
+        }
+    }
+}
+
 static void analysis_cache_process_expression(AnalysisCache *cache, Expression *exp, GenericDT **datatype) {
     switch (exp->type) {
     case ExpExp: {
-        OpExpression *op_exp = exp->data.exp;
-        switch (op_exp->token->ttype) {
+        Token *token = ast_token(cache->ast, exp->token);
+        Expression *left = ast_expression(cache->ast, exp->left);
+        Expression *right = ast_expression(cache->ast, exp->right);
+        switch (token->ttype) {
         case Lt:
         case Gt:
         case GtE:
@@ -169,52 +135,52 @@ static void analysis_cache_process_expression(AnalysisCache *cache, Expression *
         case Star:
         case Slash:
         case Mod: {
-            *datatype = op_exp->datatype;
+            *datatype = exp->datatype;
             GenericDT *left_exp_dt;
             GenericDT *right_exp_dt;
-            analysis_cache_process_expression(cache, op_exp->left, &left_exp_dt);
+            analysis_cache_process_expression(cache, left, &left_exp_dt);
             if (left_exp_dt->type != Simple || left_exp_dt->data.simple_datatype != Int) {
-                analysis_cache_add_error(cache, "invalid operation for given type", TypeError, op_exp->token);
+                analysis_cache_add_error(cache, "invalid operation for given type", TypeError, token);
             }
-            analysis_cache_process_expression(cache, op_exp->right, &right_exp_dt);
+            analysis_cache_process_expression(cache, right, &right_exp_dt);
             if (right_exp_dt->type != Simple || right_exp_dt->data.simple_datatype != Int) {
-                analysis_cache_add_error(cache, "expected int", TypeError, op_exp->token);
+                analysis_cache_add_error(cache, "expected int", TypeError, token);
             }
             break;
         }
         case Not: {
-            *datatype = op_exp->datatype;
+            *datatype = exp->datatype;
             GenericDT *sub_exp_dt;
-            analysis_cache_process_expression(cache, op_exp->left, &sub_exp_dt);
+            analysis_cache_process_expression(cache, left, &sub_exp_dt);
             if (sub_exp_dt->type != Simple || sub_exp_dt->data.simple_datatype != Bool) {
-                analysis_cache_add_error(cache, "expected bool", TypeError, op_exp->token);
+                analysis_cache_add_error(cache, "expected bool", TypeError, token);
             }
             break;
         }
         case Or:
         case And: {
-            *datatype = op_exp->datatype;
+            *datatype = exp->datatype;
             GenericDT *left_exp_dt;
             GenericDT *right_exp_dt;
-            analysis_cache_process_expression(cache, op_exp->left, &left_exp_dt);
+            analysis_cache_process_expression(cache, left, &left_exp_dt);
             if (left_exp_dt->type != Simple || left_exp_dt->data.simple_datatype != Bool) {
-                analysis_cache_add_error(cache, "invalid operation for given type", TypeError, op_exp->token);
+                analysis_cache_add_error(cache, "invalid operation for given type", TypeError, token);
             }
-            analysis_cache_process_expression(cache, op_exp->right, &right_exp_dt);
+            analysis_cache_process_expression(cache, right, &right_exp_dt);
             if (right_exp_dt->type != Simple || right_exp_dt->data.simple_datatype != Bool) {
-                analysis_cache_add_error(cache, "expected bool", TypeError, op_exp->token);
+                analysis_cache_add_error(cache, "expected bool", TypeError, token);
             }
             break;
         }
         case NotEq:
         case EqEq: {
-            *datatype = op_exp->datatype;
+            *datatype = exp->datatype;
             GenericDT *left_exp_dt;
             GenericDT *right_exp_dt;
-            analysis_cache_process_expression(cache, op_exp->left, &left_exp_dt);
-            analysis_cache_process_expression(cache, op_exp->right, &right_exp_dt);
+            analysis_cache_process_expression(cache, left, &left_exp_dt);
+            analysis_cache_process_expression(cache, right, &right_exp_dt);
             if (!generic_datatype_compare(left_exp_dt, right_exp_dt)) {
-                analysis_cache_add_error(cache, "cannot compare different types", TypeError, op_exp->token);
+                analysis_cache_add_error(cache, "cannot compare different types", TypeError, token);
             }
             break;
         }
@@ -222,126 +188,76 @@ static void analysis_cache_process_expression(AnalysisCache *cache, Expression *
         case False:
         case Number:
         case Text: {
-            *datatype = op_exp->datatype;
+            *datatype = exp->datatype;
             break;
         }
         default: {
             GenericDT *exp_dt = NULL;
-            int scope;
-            analysis_cache_get(cache, op_exp->token, &exp_dt, &scope);
+            analysis_cache_get(cache, token, &exp_dt, &exp->decl);
             if (exp_dt == NULL) {
-                analysis_cache_add_error(cache, "undefined variable", ReferenceError, op_exp->token);
+                analysis_cache_add_error(cache, "undefined variable", ReferenceError, token);
             }
             *datatype = exp_dt;
-            op_exp->datatype = exp_dt;
-            if (cache->current_function == NULL) {
-                op_exp->scope = scope;
-            } else {
-                op_exp->scope = -1;
-            }
-            char *var_name = substring(cache->source, op_exp->token->start, op_exp->token->end);
+            exp->datatype = exp_dt;
             break;
         }
         }
         break;
     }
-    case FnCallExp: {
-        Call *call = exp->data.fn_call;
-        GenericDT *fn_datatype = NULL;
-        int scope;
-        analysis_cache_get(cache, call->call_name, &fn_datatype, &scope);
-        int is_defined = 1;
-        if (fn_datatype == NULL) {
-            is_defined = 0;
-            analysis_cache_add_error(cache, "undefined function", ReferenceError, call->call_name);
-        } else if (fn_datatype->type != Complex) {
-            is_defined = 0;
-            analysis_cache_add_error(cache, "not a function", TypeError, call->call_name);
-        }
-        if (!is_defined) {
-            call->datatype = NULL;
-        } else {
-            call->datatype = fn_datatype->data.fn_datatype->return_type;
-        }
-        call->scope = scope;
-        *datatype = call->datatype;
-
-        int has_validatable_params = is_defined && call->args_size == fn_datatype->data.fn_datatype->params_size;
-        if (!has_validatable_params) {
-            analysis_cache_add_error(cache, "wrong number of arguments", TypeError, call->call_name);
-        }
-        for (int i = 0; i < call->args_size; i++) {
-            GenericDT *arg_dt;
-            analysis_cache_process_expression(cache, &call->args[i], &arg_dt);
-            if (has_validatable_params && arg_dt != NULL && !generic_datatype_compare(arg_dt, fn_datatype->data.fn_datatype->params[i].datatype)) {
-                analysis_cache_add_error(cache, "argument has wrong type", TypeError, call->call_name);
-            }
-        }
+    case FnCallExp:
+        analysis_cache_process_call(cache, exp, datatype);
         break;
     }
-    }
 }
 
 static void analysis_cache_process_oneliner(AnalysisCache *cache, Oneliner *oneliner) {
     switch (oneliner->type) {
     case PrintlnOL: {
         GenericDT *dt;
-        analysis_cache_process_expression(cache, oneliner->data.println->exp, &dt);
+        analysis_cache_process_expression(cache, ast_expression(cache->ast, oneliner->index), &dt);
         break;
     }
     case AssignmentOL: {
-        Assignment *ass = oneliner->data.assignment;
-        int is_defined_in_current_scope = analysis_cache_defined_in_current_scope(cache, ass->var);
-        GenericDT *defined_var_datatype;
-        int scope;
-        analysis_cache_get(cache, ass->var, &defined_var_datatype, &scope);
+        Assignment *ass = &cache->ast->assignments[oneliner->index];
+        Token *var = ast_token(cache->ast, ass->var);
+        Token *op = ast_token(cache->ast, ass->op);
+        int is_defined_in_current_scope = analysis_cache_defined_in_current_scope(cache, var);
         if (ass->new_var && is_defined_in_current_scope) {
-            analysis_cache_add_error(cache, "variable redefinition is not allowed", ReferenceError, ass->var);
+            analysis_cache_add_error(cache, "variable redefinition is not allowed", ReferenceError, var);
         }
-        switch (ass->op->ttype) {
+        switch (op->ttype) {
         case Inc:
         case Dec: {
             GenericDT *datatype;
-            int scope;
-            analysis_cache_get(cache, ass->var, &datatype, &scope);
+            analysis_cache_get(cache, var, &datatype, &ass->decl);
             if (datatype == NULL) {
-                analysis_cache_add_error(cache, "undefined variable", ReferenceError, ass->var);
+                analysis_cache_add_error(cache, "undefined variable", ReferenceError, var);
             } else if (datatype->type != Simple || datatype->data.simple_datatype != Int) {
-                analysis_cache_add_error(cache, "invalid operation for given type", TypeError, ass->var);
+                analysis_cache_add_error(cache, "invalid operation for given type", TypeError, var);
             } else {
                 ass->datatype = datatype;
-                if (cache->current_function == NULL) {
-                    ass->scope = scope;
-                } else {
-                    ass->scope = -1;
-                }
             }
             break;
         }
         default: {
             GenericDT *exp_datatype;
-            analysis_cache_process_expression(cache, ass->exp, &exp_datatype);
-            switch (ass->op->ttype) {
+            analysis_cache_process_expression(cache, ast_expression(cache->ast, ass->exp), &exp_datatype);
+            switch (op->ttype) {
             case PlusEq:
             case MinusEq:
             case StarEq:
             case SlashEq:
             case ModEq: {
                 GenericDT *var_datatype;
-                int scope;
-                analysis_cache_get(cache, ass->var, &var_datatype, &scope);
+                analysis_cache_get(cache, var, &var_datatype, &ass->decl);
                 ass->datatype = var_datatype;
                 if (var_datatype == NULL) {
-                    analysis_cache_add_error(cache, "undefined variable", ReferenceError, ass->var);
+                    analysis_cache_add_error(cache, "undefined variable", ReferenceError, var);
                 } else if (var_datatype != NULL && var_datatype->data.simple_datatype != Int) {
-                    analysis_cache_add_error(cache, "invalid operation for given type", TypeError, ass->var);
-                } else if (cache->current_function == NULL) {
-                    ass->scope = scope;
-                } else {
-                    ass->scope = -1;
+                    analysis_cache_add_error(cache, "invalid operation for given type", TypeError, var);
                 }
                 if (exp_datatype != NULL && (exp_datatype->type != Simple || exp_datatype->data.simple_datatype != Int)) {
-                    analysis_cache_add_error(cache, "expected a number", TypeError, ass->var);
+                    analysis_cache_add_error(cache, "expected a number", TypeError, var);
                 }
                 break;
             }
@@ -349,13 +265,8 @@ static void analysis_cache_process_oneliner(AnalysisCache *cache, Oneliner *onel
                 if (is_defined_in_current_scope) {
                     break;
                 }
-                if (cache->current_function == NULL) {
-                    ass->scope = cache->cache_size - 1;
-                } else {
-                    ass->scope = -1;
-                }
                 ass->datatype = exp_datatype;
-                analysis_cache_set(cache, ass->var, exp_datatype, -1);
+                ass->decl = analysis_cache_set(cache, var, exp_datatype, 0);
                 break;
             }
             default: {
@@ -363,30 +274,19 @@ static void analysis_cache_process_oneliner(AnalysisCache *cache, Oneliner *onel
                     break;
                 }
                 if (ass->new_var) {
-                    analysis_cache_set(cache, ass->var, ass->datatype, -1);
+                    ass->decl = analysis_cache_set(cache, var, ass->datatype, 0);
                     if (!generic_datatype_compare(ass->datatype, exp_datatype)) {
-                        analysis_cache_add_error(cache, "invalid type", TypeError, ass->var);
-                    }
-                    if (cache->current_function == NULL) {
-                        ass->scope = cache->cache_size - 1;
-                    } else {
-                        ass->scope = -1;
+                        analysis_cache_add_error(cache, "invalid type", TypeError, var);
                     }
                     break;
                 }
                 GenericDT *var_datatype;
-                int scope;
-                analysis_cache_get(cache, ass->var, &var_datatype, &scope);
+                analysis_cache_get(cache, var, &var_datatype, &ass->decl);
                 ass->datatype = var_datatype;
                 if (var_datatype == NULL) {
-                    analysis_cache_add_error(cache, "undefined variable", ReferenceError, ass->var);
+                    analysis_cache_add_error(cache, "undefined variable", ReferenceError, var);
                 } else if (!generic_datatype_compare(exp_datatype, var_datatype)) {
-                    analysis_cache_add_error(cache, "invalid type", TypeError, ass->var);
-                }
-                if (cache->current_function == NULL) {
-                    ass->scope = scope;
-                } else {
-                    ass->scope = -1;
+                    analysis_cache_add_error(cache, "invalid type", TypeError, var);
                 }
                 break;
             }
@@ -396,34 +296,33 @@ static void analysis_cache_process_oneliner(AnalysisCache *cache, Oneliner *onel
         break;
     }
     case CallOL: {
-        Call *call = oneliner->data.call;
+        Expression *call = ast_expression(cache->ast, oneliner->index);
+        Token *call_name = ast_token(cache->ast, call->token);
         GenericDT *datatype;
-        int scope;
-        analysis_cache_get(cache, call->call_name, &datatype, &scope);
+        analysis_cache_get(cache, call_name, &datatype, &call->decl);
         call->datatype = datatype;
         int is_defined = datatype != NULL;
         int is_a_function = is_defined && datatype->type != Simple;
         int returns_void = is_a_function && datatype->data.fn_datatype->return_type->type == Simple &&
                            datatype->data.fn_datatype->return_type->data.simple_datatype == Void;
+        if (is_a_function) {
+            call->datatype = datatype->data.fn_datatype->return_type;
+        }
         if (!is_defined) {
-            analysis_cache_add_error(cache, "undefined function", ReferenceError, call->call_name);
+            analysis_cache_add_error(cache, "undefined function", ReferenceError, call_name);
         } else if (!is_a_function) {
-            analysis_cache_add_error(cache, "is not a function", TypeError, call->call_name);
+            analysis_cache_add_error(cache, "is not a function", TypeError, call_name);
         } else if (!returns_void) {
-            analysis_cache_add_error(cache, "void call returns a value", TypeError, call->call_name);
-        } else if (cache->current_function == NULL) {
-            call->scope = cache->cache_size - 1;
-        } else {
-            call->scope = -1;
+            analysis_cache_add_error(cache, "void call returns a value", TypeError, call_name);
         }
 
-        int is_args_count_valid = is_a_function && call->args_size == datatype->data.fn_datatype->params_size;
+        int is_args_count_valid = is_a_function && call->args.size == datatype->data.fn_datatype->params_size;
 
-        for (int i = 0; i < call->args_size; i++) {
+        for (int i = 0; i < call->args.size; i++) {
             GenericDT *arg_datatype;
-            analysis_cache_process_expression(cache, &call->args[i], &arg_datatype);
+            analysis_cache_process_expression(cache, ast_arg(cache->ast, call, i), &arg_datatype);
             if (is_args_count_valid && !generic_datatype_compare(arg_datatype, datatype->data.fn_datatype->params[i].datatype)) {
-                analysis_cache_add_error(cache, "wrong parameter type for the function", TypeError, call->call_name);
+                analysis_cache_add_error(cache, "wrong parameter type for the function", TypeError, call_name);
             }
         }
 
@@ -432,58 +331,39 @@ static void analysis_cache_process_oneliner(AnalysisCache *cache, Oneliner *onel
     }
 }
 
-static int block_returns(Stmt *stmts, size_t stmts_size) {
-    if (stmts == NULL) {
-        return 0;
-    }
-    Stmt **to_validate = NULL;
-    size_t to_validate_size = 0;
-    for (int i = 0; i < stmts_size; i++) {
-        Stmt *stmt = &stmts[i];
-        switch (stmt->type) {
-        case ReturnStmt:
-            free(to_validate);
+static int block_returns(Ast *ast, AstList stmts) {
+    for (int i = 0; i < stmts.size; i++) {
+        if (ast_stmt(ast, stmts, i)->type == ReturnStmt) {
             return 1;
-        case ForStmt:
-        case ConditionalStmt: {
-            to_validate_size++;
-            Stmt **new_to_validate = realloc(to_validate, to_validate_size);
-            new_to_validate[to_validate_size - 1] = stmt;
-            to_validate = new_to_validate;
-            continue;
-        }
-        default:
-            continue;
         }
     }
-    for (int i = to_validate_size - 1; i >= 0; i--) {
-        Stmt *stmt = to_validate[i];
+    for (int i = stmts.size - 1; i >= 0; i--) {
+        Stmt *stmt = ast_stmt(ast, stmts, i);
         switch (stmt->type) {
         case ForStmt: {
-            ForLoop *for_loop = stmt->data.for_loop;
-            if (block_returns(for_loop->body, for_loop->body_size)) {
+            if (block_returns(ast, ast->for_loops[stmt->index].body)) {
                 return 1;
             }
             break;
         }
-        default: {
-            Conditional *cond = stmt->data.conditional;
-            if (block_returns(cond->then_block, cond->then_size) && block_returns(cond->else_block, cond->else_size)) {
+        case ConditionalStmt: {
+            Conditional *cond = &ast->conditionals[stmt->index];
+            if (block_returns(ast, cond->then_block) && block_returns(ast, cond->else_block)) {
                 return 1;
             }
             break;
         }
+        default:
+            break;
         }
-        to_validate_size--;
-        Stmt **new_to_validate = realloc(to_validate, to_validate_size);
-        to_validate = new_to_validate;
     }
     return 0;
 }
 
-void validate(AnalysisCache *cache, Stmt *stmts, size_t stmts_size) {
-    for (int i = 0; i < stmts_size; i++) {
-        Stmt *stmt = &stmts[i];
+void validate(AnalysisCache *cache, AstList stmts) {
+    for (int i = 0; i < stmts.size; i++) {
+        Stmt *stmt = ast_stmt(cache->ast, stmts, i);
+        Token *token = ast_token(cache->ast, stmt->token);
         switch (stmt->type) {
         case OpenScopeStmt:
             analysis_cache_extend(cache);
@@ -493,66 +373,65 @@ void validate(AnalysisCache *cache, Stmt *stmts, size_t stmts_size) {
             break;
         case BreakStmt:
             if (!cache->in_loop) {
-                analysis_cache_add_error(cache, "break statement outside of a loop", SyntaxError, stmt->data.break_cmd->token);
+                analysis_cache_add_error(cache, "break statement outside of a loop", SyntaxError, token);
             }
             break;
         case ContinueStmt:
             if (!cache->in_loop) {
-                analysis_cache_add_error(cache, "continue statement outside of a loop", SyntaxError, stmt->data.continue_cmd->token);
+                analysis_cache_add_error(cache, "continue statement outside of a loop", SyntaxError, token);
             }
             break;
         case ReturnStmt: {
-            ReturnCmd *cmd = stmt->data.return_cmd;
             if (cache->current_function == NULL) {
-                analysis_cache_add_error(cache, "return statement outside of a function body", SyntaxError, cmd->token);
-            } else if (cmd->exp != NULL) {
+                analysis_cache_add_error(cache, "return statement outside of a function body", SyntaxError, token);
+            } else if (stmt->index != AST_NONE) {
                 GenericDT *return_type;
-                analysis_cache_process_expression(cache, cmd->exp, &return_type);
+                analysis_cache_process_expression(cache, ast_expression(cache->ast, stmt->index), &return_type);
                 if (!generic_datatype_compare(cache->current_function->return_type, return_type)) {
-                    analysis_cache_add_error(cache, "returning wrong type", TypeError, cmd->token);
+                    analysis_cache_add_error(cache, "returning wrong type", TypeError, token);
                 }
             } else if (cache->current_function->return_type->type != Simple || cache->current_function->return_type->data.simple_datatype != Void) {
-                analysis_cache_add_error(cache, "returning wrong type", TypeError, cmd->token);
+                analysis_cache_add_error(cache, "returning wrong type", TypeError, token);
             }
             break;
         }
         case OnelinerStmt: {
-            analysis_cache_process_oneliner(cache, stmt->data.oneliner);
+            analysis_cache_process_oneliner(cache, &cache->ast->oneliners[stmt->index]);
             break;
         }
         case ConditionalStmt: {
-            Conditional *cond = stmt->data.conditional;
+            Conditional *cond = &cache->ast->conditionals[stmt->index];
             GenericDT *condition_datatype;
-            analysis_cache_process_expression(cache, cond->condition, &condition_datatype);
+            analysis_cache_process_expression(cache, ast_expression(cache->ast, cond->condition), &condition_datatype);
             if (condition_datatype->type != Simple || condition_datatype->data.simple_datatype != Bool) {
-                analysis_cache_add_error(cache, "condition must be a boolean expression", TypeError, cond->token);
+                analysis_cache_add_error(cache, "condition must be a boolean expression", TypeError, token);
             }
-            if (cond->then_size) {
+            if (cond->then_block.size) {
                 analysis_cache_extend(cache);
-                validate(cache, cond->then_block, cond->then_size);
+                validate(cache, cond->then_block);
                 analysis_cache_shrink(cache);
             }
-            if (cond->else_size) {
+            if (cond->else_block.size) {
                 analysis_cache_extend(cache);
-                validate(cache, cond->else_block, cond->else_size);
+                validate(cache, cond->else_block);
                 analysis_cache_shrink(cache);
             }
             break;
         }
         case ForStmt: {
-            ForLoop *loop = stmt->data.for_loop;
+            ForLoop *loop = &cache->ast->for_loops[stmt->index];
             GenericDT *cond_datatype;
             analysis_cache_extend(cache);
-            analysis_cache_process_oneliner(cache, loop->init);
-            analysis_cache_process_expression(cache, loop->condition, &cond_datatype);
+            analysis_cache_process_oneliner(cache, &cache->ast->oneliners[loop->init]);
+            analysis_cache_process_expression(cache, ast_expression(cache->ast, loop->condition), &cond_datatype);
             if (cond_datatype->type != Simple || cond_datatype->data.simple_datatype != Bool) {
-                analysis_cache_add_error(cache, "condition must be a boolean expression", TypeError, loop->token);
+                analysis_cache_add_error(cache, "condition must be a boolean expression", TypeError, token);
             }
-            analysis_cache_process_oneliner(cache, loop->after);
-            if (loop->body_size) {
+            analysis_cache_process_oneliner(cache, &cache->ast->oneliners[loop->after]);
+            if (loop->body.size) {
                 analysis_cache_extend(cache);
                 cache->in_loop++;
-                validate(cache, loop->body, loop->body_size);
+                validate(cache, loop->body);
                 analysis_cache_shrink(cache);
                 cache->in_loop--;
             }
@@ -560,48 +439,47 @@ void validate(AnalysisCache *cache, Stmt *stmts, size_t stmts_size) {
             break;
         }
         case FnStmt: {
-            FnDefinition *fn = stmt->data.fn_def;
+            FnDefinition *fn = &cache->ast->fn_defs[stmt->index];
+            Token *name = ast_token(cache->ast, fn->name);
             int fn_is_redefined = 0;
-            int is_invalid = 0;
             {
                 GenericDT *defined_var_datatype;
-                int scope;
-                analysis_cache_get(cache, fn->name, &defined_var_datatype, &scope);
+                AstIndex decl;
+                analysis_cache_get(cache, name, &defined_var_datatype, &decl);
                 if (defined_var_datatype != NULL) {
                     fn_is_redefined = 1;
-                    analysis_cache_add_error(cache, "variable redefinition is not allowed", ReferenceError, fn->name);
+                    analysis_cache_add_error(cache, "variable redefinition is not allowed", ReferenceError, name);
                 }
             }
 
+            if (!fn_is_redefined) {
+                fn->decl = analysis_cache_set(cache, name, fn_datatype_intern(cache->ast, fn->datatype), 1);
+            }
+
+            // the function's frame starts with its parameters
             analysis_cache_extend(cache);
+            cache->stack_index = -1;
+            cache->fn_depth++;
             for (int i = 0; i < fn->datatype->params_size; i++) {
-                int param_is_redefined = analysis_cache_defined_in_current_scope(cache, fn->datatype->params[i].name);
+                Token *param_name = ast_token(cache->ast, fn->datatype->params[i].name);
+                int param_is_redefined = analysis_cache_defined_in_current_scope(cache, param_name);
                 if (param_is_redefined) {
-                    analysis_cache_add_error(cache, "parameter with the same name already exists for given function", ReferenceError,
-                                             fn->datatype->params[i].name);
+                    analysis_cache_add_error(cache, "parameter with the same name already exists for given function", ReferenceError, param_name);
                 } else {
-                    analysis_cache_set(cache, fn->datatype->params[i].name, fn->datatype->params[i].datatype, -1);
+                    fn->datatype->params[i].decl = analysis_cache_set(cache, param_name, fn->datatype->params[i].datatype, 0);
                 }
             }
-            if (is_invalid) {
-                fn->datatype = NULL;
-            }
-            if (!fn_is_redefined) {
-                GenericDT *datatype = generic_datatype_create();
-                datatype->type = Complex;
-                datatype->data.fn_datatype = fn->datatype;
-                analysis_cache_set(cache, fn->name, datatype, cache->cache_size - 2);
-            }
 
             cache->current_function = fn->datatype;
-            if (fn->body_size) {
-                validate(cache, fn->body, fn->body_size);
+            if (fn->body.size) {
+                validate(cache, fn->body);
             }
             int function_should_return_value = (fn->datatype->return_type->type != Simple || fn->datatype->return_type->data.simple_datatype != Void);
-            if (function_should_return_value && !block_returns(fn->body, fn->body_size)) {
-                analysis_cache_add_error(cache, "function must return a value", TypeError, fn->name);
+            if (function_should_return_value && !block_returns(cache->ast, fn->body)) {
+                analysis_cache_add_error(cache, "function must return a value", TypeError, name);
             }
 
+            cache->fn_depth--;
             analysis_cache_shrink(cache);
             cache->current_function = NULL;
             break;
@@ -2,39 +2,31 @@
 #define ANALYZER_H
 #include "ast.h"
 #include "error.h"
+#include "scope.h"
 #include "token.h"
 #include <stdlib.h>
 
+// Allocated from arena together with its errors, its scope table and the function types it creates.
 typedef struct {
-    char *(*keys)[512];
-    GenericDT *(*datatypes)[512];
-    size_t size;
-} HashTable;
-
-HashTable *hashtable_create();
-
-void hashtable_set(HashTable *ht, char *key, GenericDT *value);
-
-void hashtable_get(HashTable *ht, char *key, GenericDT **datatype);
-
-void hashtable_destroy(HashTable *ht);
-
-typedef struct {
+    Ast *ast;
     char *source;
-    HashTable **defs;
-    size_t cache_size;
+    Arena *arena;
+    ScopeTable scopes;
     Error **errors;
     size_t errors_size;
     FunctionType *current_function;
-    int current_scope;
     int in_loop;
+    int fn_depth;       // functions around the statement being checked
+    int stack_index;    // last slot taken in the current frame, numbered like the compiler does
+    int *scope_slots;   // stack_index when each open scope began
+    int scope_slots_capacity;
 } AnalysisCache;
 
-AnalysisCache *analysis_cache_create(char *source);
+AnalysisCache *analysis_cache_create(Ast *ast, char *source, Arena *arena);
 
-static void analysis_cache_get(AnalysisCache *cache, Token *var_token, GenericDT **datatype, int *scope);
+static void analysis_cache_get(AnalysisCache *cache, Token *var_token, GenericDT **datatype, AstIndex *decl);
 
-static void analysis_cache_set(AnalysisCache *cache, Token *var_token, GenericDT *datatype, int scope);
+static AstIndex analysis_cache_set(AnalysisCache *cache, Token *var_token, GenericDT *datatype, int is_function);
 
 static int analysis_cache_defined(AnalysisCache *cache, Token *var_token);
 
@@ -46,12 +38,14 @@ static void analysis_cache_shrink(AnalysisCache *cache);
 
 static void analysis_cache_add_error(AnalysisCache *cache, char *message, ErrorType type, Token *token);
 
+static void analysis_cache_process_call(AnalysisCache *cache, Expression *call, GenericDT **datatype);
+
 static void analysis_cache_process_expression(AnalysisCache *cache, Expression *exp, GenericDT **datatype);
 
 static void analysis_cache_process_oneliner(AnalysisCache *cache, Oneliner *oneliner);
 
-static int block_returns(Stmt *stmts, size_t stmts_size);
+static int block_returns(Ast *ast, AstList stmts);
 
-void validate(AnalysisCache *cache, Stmt *stmts, size_t stmts_size);
+void validate(AnalysisCache *cache, AstList stmts);
 
 #endif
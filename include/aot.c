@@ -0,0 +1,854 @@
+#include "aot.h"
+#include "ast.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} AotBuffer;
+
+// Names are the declarations the analyzer resolved them to. Variables nothing reads aren't declared and functions
+// nothing calls aren't written, which keeps the generated file free of unused-variable and unused-function warnings.
+typedef struct {
+    Ast *ast;
+    char *source;
+    LineIndex lines;        // for error messages
+    uint8_t *reads;         // per declaration, set when code that can run reads the variable or calls the function
+    AstIndex *fn_defs;      // per function declaration, its definition
+    AstIndex *pending;      // per variable nothing reads yet, the last assignment of it that can run
+    AstIndex *pending_next; // per assignment in that list, the one before it
+    int next_id;            // of the last temporary
+    int fn_depth;           // functions around the statements being written, 0 for the top level
+    int indent;             // of the statements being written
+    AotBuffer decls;        // file-scope variables and function prototypes
+    AotBuffer functions;
+    int has_error;
+} AotCache;
+
+// what every generated file starts with: wrapping arithmetic, a buffered println and a call depth limit, which stops
+// runaway recursion the way the VM's stack overflow does instead of crashing with the output still buffered
+static const char aot_runtime[] = "#include <stdint.h>\n"
+                                  "#include <stdio.h>\n"
+                                  "#include <stdlib.h>\n"
+                                  "#include <string.h>\n"
+                                  "\n"
+                                  "#define CIMPL_ADD(a, b) ((int32_t)((uint32_t)(a) + (uint32_t)(b)))\n"
+                                  "#define CIMPL_SUB(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)))\n"
+                                  "#define CIMPL_MUL(a, b) ((int32_t)((uint32_t)(a) * (uint32_t)(b)))\n"
+                                  "\n"
+                                  "static char cimpl_out[1 << 16];\n"
+                                  "static size_t cimpl_out_size;\n"
+                                  "\n"
+                                  "static inline void cimpl_flush(void) {\n"
+                                  "    fwrite(cimpl_out, 1, cimpl_out_size, stdout);\n"
+                                  "    cimpl_out_size = 0;\n"
+                                  "}\n"
+                                  "\n"
+                                  "static inline void cimpl_write(const char *data, size_t size) {\n"
+                                  "    if (size > sizeof(cimpl_out) - cimpl_out_size) {\n"
+                                  "        cimpl_flush();\n"
+                                  "        if (size > sizeof(cimpl_out)) {\n"
+                                  "            fwrite(data, 1, size, stdout);\n"
+                                  "            return;\n"
+                                  "        }\n"
+                                  "    }\n"
+                                  "    memcpy(cimpl_out + cimpl_out_size, data, size);\n"
+                                  "    cimpl_out_size += size;\n"
+                                  "}\n"
+                                  "\n"
+                                  "static inline void cimpl_println_int(int32_t value) {\n"
+                                  "    char digits[12];\n"
+                                  "    int at = sizeof(digits);\n"
+                                  "    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;\n"
+                                  "    digits[--at] = '\\n';\n"
+                                  "    do {\n"
+                                  "        digits[--at] = '0' + magnitude % 10;\n"
+                                  "        magnitude /= 10;\n"
+                                  "    } while (magnitude);\n"
+                                  "    if (value < 0) {\n"
+                                  "        digits[--at] = '-';\n"
+                                  "    }\n"
+                                  "    cimpl_write(digits + at, sizeof(digits) - at);\n"
+                                  "}\n"
+                                  "\n"
+                                  "static inline void cimpl_println_bool(int value) { cimpl_write(value ? \"true\\n\" : \"false\\n\", value ? 5 : 6); }\n"
+                                  "\n"
+                                  "static inline void cimpl_println_str(const char *value) {\n"
+                                  "    cimpl_write(value, strlen(value));\n"
+                                  "    cimpl_write(\"\\n\", 1);\n"
+                                  "}\n"
+                                  "\n"
+                                  "#define CIMPL_MAX_DEPTH (1 << 17)\n"
+                                  "\n"
+                                  "static int cimpl_depth;\n"
+                                  "\n"
+                                  "// every function starts with this, and takes its level back off right before it returns\n"
+                                  "static inline void cimpl_enter(void) {\n"
+                                  "    if (++cimpl_depth > CIMPL_MAX_DEPTH) {\n"
+                                  "        cimpl_flush();\n"
+                                  "        fflush(stdout);\n"
+                                  "        fprintf(stderr, \"Stack overflow: more than %d nested calls\\n\", CIMPL_MAX_DEPTH);\n"
+                                  "        exit(1);\n"
+                                  "    }\n"
+                                  "}\n"
+                                  "\n";
+
+static void buffer_printf(AotBuffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (buffer->size + needed + 1 > buffer->capacity) {
+        buffer->capacity = (buffer->size + needed + 1) * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->size, needed + 1, format, args);
+    va_end(args);
+    buffer->size += needed;
+}
+
+static void buffer_indent(AotBuffer *buffer, int indent) { buffer_printf(buffer, "%*s", indent * 4, ""); }
+
+static const char *buffer_text(AotBuffer *buffer) { return buffer->data == NULL ? "" : buffer->data; }
+
+static void aot_error(AotCache *cache, const char *message, Token *token) {
+    size_t line;
+    size_t column;
+    line_index_locate(&cache->lines, token->start, &line, &column);
+    printf("Can't compile to C at line %lu: %s\n", line, message);
+    cache->has_error = 1;
+}
+
+static const char *aot_type(GenericDT *datatype) {
+    if (datatype == NULL || datatype->type != Simple) {
+        return "void ";
+    }
+    switch (datatype->data.simple_datatype) {
+    case Int:
+        return "int32_t ";
+    case Bool:
+        return "int ";
+    case String:
+        return "const char *";
+    default:
+        return "void ";
+    }
+}
+
+// functions are f<decl>_name, top-level variables g<decl>_name and everything else v<decl>_name,
+// so script names never clash with C keywords, the runtime or each other
+static void aot_name(AotCache *cache, AotBuffer *buffer, AstIndex decl, uint32_t token) {
+    Declaration *declaration = &cache->ast->decls[decl];
+    Token *name = ast_token(cache->ast, token);
+    char prefix = declaration->slot < 0 ? 'f' : declaration->depth == 0 ? 'g' : 'v';
+    buffer_printf(buffer, "%c%u_%.*s", prefix, decl, (int)(name->end - name->start), cache->source + name->start);
+}
+
+// a variable can be a C local of the function being written or a file-scope one, not a local of an enclosing function
+static int aot_variable_valid(AotCache *cache, AstIndex decl, uint32_t token) {
+    Declaration *declaration = &cache->ast->decls[decl];
+    if (declaration->slot < 0) {
+        aot_error(cache, "functions can't be used as values", ast_token(cache->ast, token));
+        return 0;
+    }
+    if (declaration->depth != 0 && declaration->depth != cache->fn_depth) {
+        aot_error(cache, "a function uses a variable of the function around it", ast_token(cache->ast, token));
+        return 0;
+    }
+    return 1;
+}
+
+static void aot_mark_statements(AotCache *cache, AstList stmts);
+static void aot_mark_expression(AotCache *cache, Expression *exp);
+
+// a function is only walked once something that runs calls it, and the values of a variable only once something that
+// runs reads it, a call through a parameter just reads the parameter
+static void aot_mark_read(AotCache *cache, AstIndex decl) {
+    if (cache->reads[decl]) {
+        return;
+    }
+    cache->reads[decl] = 1;
+    if (cache->ast->decls[decl].slot < 0) {
+        aot_mark_statements(cache, cache->ast->fn_defs[cache->fn_defs[decl]].body);
+        return;
+    }
+    for (AstIndex i = cache->pending[decl]; i != AST_NONE; i = cache->pending_next[i]) {
+        aot_mark_expression(cache, ast_expression(cache->ast, cache->ast->assignments[i].exp));
+    }
+}
+
+static void aot_mark_expression(AotCache *cache, Expression *exp) {
+    if (exp == NULL) {
+        return;
+    }
+    if (exp->type == FnCallExp) {
+        aot_mark_read(cache, exp->decl);
+        for (uint32_t i = 0; i < exp->args.size; i++) {
+            aot_mark_expression(cache, ast_arg(cache->ast, exp, i));
+        }
+        return;
+    }
+    if (exp->decl != AST_NONE) {
+        aot_mark_read(cache, exp->decl);
+    }
+    aot_mark_expression(cache, ast_expression(cache->ast, exp->left));
+    aot_mark_expression(cache, ast_expression(cache->ast, exp->right));
+}
+
+// what aot_discard keeps of a value
+static void aot_mark_calls(AotCache *cache, Expression *exp) {
+    if (exp == NULL) {
+        return;
+    }
+    if (exp->type == FnCallExp) {
+        aot_mark_expression(cache, exp);
+        return;
+    }
+    aot_mark_calls(cache, ast_expression(cache->ast, exp->left));
+    aot_mark_calls(cache, ast_expression(cache->ast, exp->right));
+}
+
+static void aot_mark_oneliner(AotCache *cache, Oneliner *oneliner) {
+    if (oneliner->type != AssignmentOL) {
+        aot_mark_expression(cache, ast_expression(cache->ast, oneliner->index));
+        return;
+    }
+    AstIndex index = oneliner->index;
+    Assignment *ass = &cache->ast->assignments[index];
+    // compound operators and ++/-- read the variable they write
+    if (!ass->new_var && ast_token(cache->ast, ass->op)->ttype != Eq) {
+        aot_mark_read(cache, ass->decl);
+    }
+    if (cache->reads[ass->decl]) {
+        aot_mark_expression(cache, ast_expression(cache->ast, ass->exp));
+        return;
+    }
+    aot_mark_calls(cache, ast_expression(cache->ast, ass->exp));
+    cache->pending_next[index] = cache->pending[ass->decl];
+    cache->pending[ass->decl] = index;
+}
+
+// finds what the top level, and the functions it can call, read
+static void aot_mark_statements(AotCache *cache, AstList stmts) {
+    for (uint32_t i = 0; i < stmts.size; i++) {
+        Stmt *stmt = ast_stmt(cache->ast, stmts, i);
+        switch (stmt->type) {
+        case OnelinerStmt:
+            aot_mark_oneliner(cache, &cache->ast->oneliners[stmt->index]);
+            break;
+        case ConditionalStmt: {
+            Conditional *conditional = &cache->ast->conditionals[stmt->index];
+            aot_mark_expression(cache, ast_expression(cache->ast, conditional->condition));
+            aot_mark_statements(cache, conditional->then_block);
+            aot_mark_statements(cache, conditional->else_block);
+            break;
+        }
+        case ForStmt: {
+            ForLoop *for_loop = &cache->ast->for_loops[stmt->index];
+            aot_mark_oneliner(cache, &cache->ast->oneliners[for_loop->init]);
+            aot_mark_expression(cache, ast_expression(cache->ast, for_loop->condition));
+            aot_mark_oneliner(cache, &cache->ast->oneliners[for_loop->after]);
+            aot_mark_statements(cache, for_loop->body);
+            break;
+        }
+        case FnStmt:
+            // names are declared before they are used, so this comes before any call of the function
+            cache->fn_defs[cache->ast->fn_defs[stmt->index].decl] = stmt->index;
+            break;
+        case ReturnStmt:
+            aot_mark_expression(cache, ast_expression(cache->ast, stmt->index));
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// whether running stmts can get past their end, C compilers want a return on every path that does
+static int aot_falls_through(Ast *ast, AstList stmts) {
+    uint32_t size = stmts.size;
+    // what ends a nested scope at the end of the block ends the block
+    while (size && ast_stmt(ast, stmts, size - 1)->type == CloseScopeStmt) {
+        size--;
+    }
+    if (size == 0) {
+        return 1;
+    }
+    Stmt *last = ast_stmt(ast, stmts, size - 1);
+    if (last->type == ReturnStmt) {
+        return 0;
+    }
+    if (last->type == ConditionalStmt && ast_token(ast, last->token)->ttype == If) {
+        Conditional *conditional = &ast->conditionals[last->index];
+        return !conditional->else_block.size || aot_falls_through(ast, conditional->then_block) || aot_falls_through(ast, conditional->else_block);
+    }
+    return 1;
+}
+
+static int expression_has_call(Ast *ast, Expression *exp) {
+    if (exp == NULL) {
+        return 0;
+    }
+    if (exp->type == FnCallExp) {
+        return 1;
+    }
+    return expression_has_call(ast, ast_expression(ast, exp->left)) || expression_has_call(ast, ast_expression(ast, exp->right));
+}
+
+// moves an already written operand into a temporary, so that calls evaluated after it can't change what it read
+static void aot_spill(AotCache *cache, GenericDT *datatype, AotBuffer *prelude, AotBuffer *text) {
+    int id = ++cache->next_id;
+    buffer_indent(prelude, cache->indent);
+    buffer_printf(prelude, "%st%d = %s;\n", aot_type(datatype), id, buffer_text(text));
+    text->size = 0;
+    buffer_printf(text, "t%d", id);
+}
+
+static void aot_expression(AotCache *cache, Expression *exp, AotBuffer *prelude, AotBuffer *text);
+
+// writes the call into text, statements evaluating its arguments go to prelude
+static void aot_call(AotCache *cache, Expression *call, AotBuffer *prelude, AotBuffer *text) {
+    AotBuffer args = {0};
+    for (int i = 0; i < call->args.size; i++) {
+        AotBuffer arg = {0};
+        aot_expression(cache, ast_arg(cache->ast, call, i), prelude, &arg);
+        int later_call = 0;
+        for (int j = i + 1; j < call->args.size; j++) {
+            later_call |= expression_has_call(cache->ast, ast_arg(cache->ast, call, j));
+        }
+        if (later_call) {
+            aot_spill(cache, ast_arg(cache->ast, call, i)->datatype, prelude, &arg);
+        }
+        buffer_printf(&args, "%s%s", i ? ", " : "", buffer_text(&arg));
+        free(arg.data);
+    }
+    aot_name(cache, text, call->decl, call->token);
+    buffer_printf(text, "(%s)", buffer_text(&args));
+    free(args.data);
+}
+
+static void aot_string_literal(AotBuffer *text, Token *token, char *source) {
+    buffer_printf(text, "\"");
+    for (size_t i = token->start; i < token->end; i++) {
+        unsigned char ch = source[i];
+        if (ch == '\\' || ch == '"') {
+            buffer_printf(text, "\\%c", ch);
+        } else if (ch < ' ' || ch >= 0x7f || ch == '?') {
+            // octal escapes always take three digits, so a following digit can't extend them
+            buffer_printf(text, "\\%03o", ch);
+        } else {
+            buffer_printf(text, "%c", ch);
+        }
+    }
+    buffer_printf(text, "\"");
+}
+
+static void aot_expression(AotCache *cache, Expression *exp, AotBuffer *prelude, AotBuffer *text) {
+    if (exp->type == FnCallExp) {
+        // every call gets its own temporary, which fixes the order calls run in
+        aot_call(cache, exp, prelude, text);
+        aot_spill(cache, exp->datatype, prelude, text);
+        return;
+    }
+    Token *token = ast_token(cache->ast, exp->token);
+    Expression *left_exp = ast_expression(cache->ast, exp->left);
+    Expression *right_exp = ast_expression(cache->ast, exp->right);
+    switch (token->ttype) {
+    case Number:
+        buffer_printf(text, "%d", token->number);
+        break;
+    case True:
+        buffer_printf(text, "1");
+        break;
+    case False:
+        buffer_printf(text, "0");
+        break;
+    case Text:
+        aot_string_literal(text, token, cache->source);
+        break;
+    case Identifier:
+        if (aot_variable_valid(cache, exp->decl, exp->token)) {
+            aot_name(cache, text, exp->decl, exp->token);
+        }
+        break;
+    case Not: {
+        AotBuffer operand = {0};
+        aot_expression(cache, left_exp, prelude, &operand);
+        buffer_printf(text, "!(%s)", buffer_text(&operand));
+        free(operand.data);
+        break;
+    }
+    case Plus:
+    case Minus:
+    case Star:
+    case Slash:
+    case Mod:
+    case EqEq:
+    case NotEq:
+    case And:
+    case Or:
+    case Lt:
+    case Gt:
+    case LtE:
+    case GtE: {
+        AotBuffer left = {0};
+        AotBuffer right = {0};
+        aot_expression(cache, left_exp, prelude, &left);
+        if (expression_has_call(cache->ast, right_exp) && left_exp->type != FnCallExp) {
+            aot_spill(cache, left_exp->datatype, prelude, &left);
+        }
+        aot_expression(cache, right_exp, prelude, &right);
+        const char *l = buffer_text(&left);
+        const char *r = buffer_text(&right);
+        switch (token->ttype) {
+        case Plus:
+            buffer_printf(text, "CIMPL_ADD(%s, %s)", l, r);
+            break;
+        case Minus:
+            buffer_printf(text, "CIMPL_SUB(%s, %s)", l, r);
+            break;
+        case Star:
+            buffer_printf(text, "CIMPL_MUL(%s, %s)", l, r);
+            break;
+        case Slash:
+            buffer_printf(text, "(%s / %s)", l, r);
+            break;
+        case Mod:
+            buffer_printf(text, "(%s %% %s)", l, r);
+            break;
+        case EqEq:
+            buffer_printf(text, "(%s == %s)", l, r);
+            break;
+        case NotEq:
+            buffer_printf(text, "(%s != %s)", l, r);
+            break;
+        // the VM evaluates both operands, and booleans are always 0 or 1
+        case And:
+            buffer_printf(text, "(%s & %s)", l, r);
+            break;
+        case Or:
+            buffer_printf(text, "(%s | %s)", l, r);
+            break;
+        case Lt:
+            buffer_printf(text, "(%s < %s)", l, r);
+            break;
+        case Gt:
+            buffer_printf(text, "(%s > %s)", l, r);
+            break;
+        case LtE:
+            buffer_printf(text, "(%s <= %s)", l, r);
+            break;
+        default:
+            buffer_printf(text, "(%s >= %s)", l, r);
+            break;
+        }
+        free(left.data);
+        free(right.data);
+        break;
+    }
+    default:
+        aot_error(cache, "illegal operator in expression", token);
+        break;
+    }
+}
+
+static void aot_statements(AotCache *cache, AstList stmts, AotBuffer *out);
+
+// "x = value" for an assignment to an existing variable, with the variable read first for compound operators
+static void aot_assignment_expression(AotCache *cache, Assignment *ass, AotBuffer *prelude, AotBuffer *text) {
+    if (!aot_variable_valid(cache, ass->decl, ass->var)) {
+        return;
+    }
+    TokenType op = ast_token(cache->ast, ass->op)->ttype;
+    Expression *exp = ast_expression(cache->ast, ass->exp);
+    AotBuffer name = {0};
+    aot_name(cache, &name, ass->decl, ass->var);
+    AotBuffer value = {0};
+    switch (op) {
+    case Eq:
+        aot_expression(cache, exp, prelude, &value);
+        break;
+    case Inc:
+        buffer_printf(&value, "CIMPL_ADD(%s, 1)", name.data);
+        break;
+    case Dec:
+        buffer_printf(&value, "CIMPL_SUB(%s, 1)", name.data);
+        break;
+    default: {
+        AotBuffer left = {0};
+        AotBuffer right = {0};
+        buffer_printf(&left, "%s", name.data);
+        if (expression_has_call(cache->ast, exp)) {
+            aot_spill(cache, ass->datatype, prelude, &left);
+        }
+        aot_expression(cache, exp, prelude, &right);
+        const char *format = op == PlusEq    ? "CIMPL_ADD(%s, %s)"
+                             : op == MinusEq ? "CIMPL_SUB(%s, %s)"
+                             : op == StarEq  ? "CIMPL_MUL(%s, %s)"
+                             : op == SlashEq ? "(%s / %s)"
+                                             : "(%s %% %s)";
+        buffer_printf(&value, format, left.data, buffer_text(&right));
+        free(left.data);
+        free(right.data);
+        break;
+    }
+    }
+    buffer_printf(text, "%s = %s", name.data, buffer_text(&value));
+    free(name.data);
+    free(value.data);
+}
+
+// the value of a variable nothing reads, only the calls in it still have to run, in the order they run in
+static void aot_discard(AotCache *cache, Expression *exp, AotBuffer *out) {
+    if (exp == NULL) {
+        return;
+    }
+    if (exp->type != FnCallExp) {
+        aot_discard(cache, ast_expression(cache->ast, exp->left), out);
+        aot_discard(cache, ast_expression(cache->ast, exp->right), out);
+        return;
+    }
+    AotBuffer text = {0};
+    aot_call(cache, exp, out, &text);
+    buffer_indent(out, cache->indent);
+    buffer_printf(out, "%s;\n", buffer_text(&text));
+    free(text.data);
+}
+
+static void aot_oneliner(AotCache *cache, Oneliner *oneliner, AotBuffer *out) {
+    AotBuffer text = {0};
+    switch (oneliner->type) {
+    case PrintlnOL: {
+        Expression *exp = ast_expression(cache->ast, oneliner->index);
+        aot_expression(cache, exp, out, &text);
+        GenericDT *datatype = exp->datatype;
+        const char *printer = "cimpl_println_int";
+        if (datatype->type == Simple && datatype->data.simple_datatype == Bool) {
+            printer = "cimpl_println_bool";
+        } else if (datatype->type == Simple && datatype->data.simple_datatype == String) {
+            printer = "cimpl_println_str";
+        }
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "%s(%s);\n", printer, buffer_text(&text));
+        break;
+    }
+    case AssignmentOL: {
+        Assignment *ass = &cache->ast->assignments[oneliner->index];
+        if (!cache->reads[ass->decl]) {
+            aot_discard(cache, ast_expression(cache->ast, ass->exp), out);
+            break;
+        }
+        if (!ass->new_var) {
+            aot_assignment_expression(cache, ass, out, &text);
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "%s;\n", buffer_text(&text));
+            break;
+        }
+        // the value is written before the name is declared, "x := x + 1" in an inner scope reads the outer x
+        aot_expression(cache, ast_expression(cache->ast, ass->exp), out, &text);
+        buffer_indent(out, cache->indent);
+        if (cache->ast->decls[ass->decl].depth == 0) {
+            buffer_printf(&cache->decls, "static %s", aot_type(ass->datatype));
+            aot_name(cache, &cache->decls, ass->decl, ass->var);
+            buffer_printf(&cache->decls, ";\n");
+        } else {
+            buffer_printf(out, "%s", aot_type(ass->datatype));
+        }
+        aot_name(cache, out, ass->decl, ass->var);
+        buffer_printf(out, " = %s;\n", buffer_text(&text));
+        break;
+    }
+    case CallOL:
+        aot_call(cache, ast_expression(cache->ast, oneliner->index), out, &text);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "%s;\n", buffer_text(&text));
+        break;
+    }
+    free(text.data);
+}
+
+// writes a nested block one level deeper
+static void aot_block(AotCache *cache, AstList stmts, AotBuffer *out) {
+    cache->indent++;
+    aot_statements(cache, stmts, out);
+    cache->indent--;
+}
+
+// the statements that leave the current function give back its call depth level first
+static void aot_leave(AotCache *cache, AotBuffer *out) {
+    buffer_indent(out, cache->indent);
+    buffer_printf(out, "cimpl_depth--;\n");
+}
+
+static void aot_function(AotCache *cache, FnDefinition *fn_def) {
+    if (!cache->reads[fn_def->decl]) {
+        return;
+    }
+    int outer_indent = cache->indent;
+    cache->fn_depth++;
+    cache->indent = 1;
+
+    AotBuffer signature = {0};
+    GenericDT *return_type = fn_def->datatype->return_type;
+    buffer_printf(&signature, "static %s", aot_type(return_type));
+    aot_name(cache, &signature, fn_def->decl, fn_def->name);
+    buffer_printf(&signature, "(");
+    for (int i = 0; i < fn_def->datatype->params_size; i++) {
+        FnParam param = fn_def->datatype->params[i];
+        buffer_printf(&signature, "%s%s", i ? ", " : "", aot_type(param.datatype));
+        aot_name(cache, &signature, param.decl, param.name);
+    }
+    buffer_printf(&signature, "%s)", fn_def->datatype->params_size ? "" : "void");
+
+    AotBuffer body = {0};
+    buffer_printf(&body, "    cimpl_enter();\n");
+    aot_statements(cache, fn_def->body, &body);
+    if (aot_falls_through(cache->ast, fn_def->body)) {
+        aot_leave(cache, &body);
+        // the analyzer accepts a loop that returns as a returning block, C needs a value on every path
+        if (return_type->type == Simple && return_type->data.simple_datatype != Void) {
+            buffer_printf(&body, "    return %s;\n", return_type->data.simple_datatype == String ? "\"\"" : "0");
+        }
+    }
+    buffer_printf(&cache->decls, "%s;\n", signature.data);
+    buffer_printf(&cache->functions, "%s {\n%s}\n\n", signature.data, buffer_text(&body));
+    free(signature.data);
+    free(body.data);
+
+    cache->fn_depth--;
+    cache->indent = outer_indent;
+}
+
+static void aot_conditional(AotCache *cache, Stmt *stmt, AotBuffer *out) {
+    Conditional *conditional = &cache->ast->conditionals[stmt->index];
+    Expression *condition_exp = ast_expression(cache->ast, conditional->condition);
+    AotBuffer condition = {0};
+    int has_call = expression_has_call(cache->ast, condition_exp);
+    if (ast_token(cache->ast, stmt->token)->ttype == If) {
+        aot_expression(cache, condition_exp, out, &condition);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "if (%s) {\n", buffer_text(&condition));
+        aot_block(cache, conditional->then_block, out);
+        if (conditional->else_block.size) {
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "} else {\n");
+            aot_block(cache, conditional->else_block, out);
+        }
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "}\n");
+        free(condition.data);
+        return;
+    }
+
+    // while: the else block runs only when the condition fails on entry
+    if (!has_call && conditional->else_block.size) {
+        aot_expression(cache, condition_exp, out, &condition);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "if (%s) {\n", buffer_text(&condition));
+        cache->indent++;
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "do {\n");
+        aot_block(cache, conditional->then_block, out);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "} while (%s);\n", buffer_text(&condition));
+        cache->indent--;
+    } else if (!has_call) {
+        aot_expression(cache, condition_exp, out, &condition);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "while (%s) {\n", buffer_text(&condition));
+        aot_block(cache, conditional->then_block, out);
+    } else {
+        // the calls in the condition run at the top of every iteration, and a flag remembers whether the body ran
+        int entered = ++cache->next_id;
+        if (conditional->else_block.size) {
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "int t%d = 0;\n", entered);
+        }
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "for (;;) {\n");
+        cache->indent++;
+        aot_expression(cache, condition_exp, out, &condition);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "if (!(%s)) {\n", buffer_text(&condition));
+        buffer_indent(out, cache->indent + 1);
+        buffer_printf(out, "break;\n");
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "}\n");
+        if (conditional->else_block.size) {
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "t%d = 1;\n", entered);
+        }
+        cache->indent--;
+        aot_block(cache, conditional->then_block, out);
+        if (conditional->else_block.size) {
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "}\n");
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "if (!t%d) {\n", entered);
+        }
+    }
+    if (conditional->else_block.size) {
+        if (!has_call) {
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "} else {\n");
+        }
+        aot_block(cache, conditional->else_block, out);
+    }
+    buffer_indent(out, cache->indent);
+    buffer_printf(out, "}\n");
+    free(condition.data);
+}
+
+static void aot_for(AotCache *cache, ForLoop *for_loop, AotBuffer *out) {
+    buffer_indent(out, cache->indent);
+    buffer_printf(out, "{\n");
+    cache->indent++;
+    aot_oneliner(cache, &cache->ast->oneliners[for_loop->init], out);
+    Oneliner *after_ol = &cache->ast->oneliners[for_loop->after];
+    Expression *condition_exp = ast_expression(cache->ast, for_loop->condition);
+
+    AotBuffer condition = {0};
+    AotBuffer after = {0};
+    AotBuffer prelude = {0};
+    Assignment *after_ass = after_ol->type == AssignmentOL ? &cache->ast->assignments[after_ol->index] : NULL;
+    int plain_after = after_ass != NULL && !after_ass->new_var && cache->reads[after_ass->decl];
+    if (plain_after) {
+        aot_assignment_expression(cache, after_ass, &prelude, &after);
+    }
+    int simple = !expression_has_call(cache->ast, condition_exp) && plain_after && prelude.size == 0;
+    if (simple) {
+        aot_expression(cache, condition_exp, out, &condition);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "for (; %s; %s) {\n", buffer_text(&condition), buffer_text(&after));
+        aot_block(cache, for_loop->body, out);
+    } else {
+        // "after" runs at the top of every iteration but the first, its calls can't go into the for header
+        int first = ++cache->next_id;
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "for (int t%d = 1;; t%d = 0) {\n", first, first);
+        cache->indent++;
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "if (!t%d) {\n", first);
+        cache->indent++;
+        aot_oneliner(cache, after_ol, out);
+        cache->indent--;
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "}\n");
+        aot_expression(cache, condition_exp, out, &condition);
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "if (!(%s)) {\n", buffer_text(&condition));
+        buffer_indent(out, cache->indent + 1);
+        buffer_printf(out, "break;\n");
+        buffer_indent(out, cache->indent);
+        buffer_printf(out, "}\n");
+        cache->indent--;
+        aot_block(cache, for_loop->body, out);
+    }
+    buffer_indent(out, cache->indent);
+    buffer_printf(out, "}\n");
+    free(condition.data);
+    free(after.data);
+    free(prelude.data);
+
+    cache->indent--;
+    buffer_indent(out, cache->indent);
+    buffer_printf(out, "}\n");
+}
+
+static void aot_statements(AotCache *cache, AstList stmts, AotBuffer *out) {
+    for (uint32_t i = 0; i < stmts.size && !cache->has_error; i++) {
+        Stmt *stmt = ast_stmt(cache->ast, stmts, i);
+        switch (stmt->type) {
+        case OnelinerStmt:
+            aot_oneliner(cache, &cache->ast->oneliners[stmt->index], out);
+            break;
+        case OpenScopeStmt:
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "{\n");
+            cache->indent++;
+            break;
+        case CloseScopeStmt:
+            cache->indent--;
+            buffer_indent(out, cache->indent);
+            buffer_printf(out, "}\n");
+            break;
+        case ConditionalStmt:
+            aot_conditional(cache, stmt, out);
+            break;
+        case ForStmt:
+            aot_for(cache, &cache->ast->for_loops[stmt->index], out);
+            break;
+        case FnStmt:
+            aot_function(cache, &cache->ast->fn_defs[stmt->index]);
+            break;
+        case BreakStmt:
+        case ContinueStmt:
+            // the bytecode compiler has no break or continue either, a script runs the same on every backend
+            aot_error(cache, "illegal statement", ast_token(cache->ast, stmt->token));
+            break;
+        case ReturnStmt: {
+            Expression *exp = ast_expression(cache->ast, stmt->index);
+            AotBuffer value = {0};
+            if (exp != NULL && exp->type == FnCallExp) {
+                // a returned call takes over the caller's depth level like the VM's tail call takes over its frame,
+                // and stays in tail position so C compilers can turn it into a jump
+                aot_call(cache, exp, out, &value);
+                aot_leave(cache, out);
+                buffer_indent(out, cache->indent);
+                if (exp->datatype->type == Simple && exp->datatype->data.simple_datatype == Void) {
+                    buffer_printf(out, "%s;\n", buffer_text(&value));
+                    buffer_indent(out, cache->indent);
+                    buffer_printf(out, "return;\n");
+                } else {
+                    buffer_printf(out, "return %s;\n", buffer_text(&value));
+                }
+            } else if (exp != NULL) {
+                aot_expression(cache, exp, out, &value);
+                aot_leave(cache, out);
+                buffer_indent(out, cache->indent);
+                buffer_printf(out, "return %s;\n", buffer_text(&value));
+            } else {
+                aot_leave(cache, out);
+                buffer_indent(out, cache->indent);
+                buffer_printf(out, "return;\n");
+            }
+            free(value.data);
+            break;
+        }
+        }
+    }
+}
+
+int aot_compile_to_c(Ast *ast, char *source, size_t source_size, FILE *out) {
+    AotCache cache = {.ast = ast, .source = source, .indent = 1};
+    line_index_init(&cache.lines, source, source_size, ast->arena);
+    cache.reads = calloc(ast->decls_size + 1, sizeof(uint8_t));
+    cache.fn_defs = malloc((ast->decls_size + 1) * sizeof(AstIndex));
+    cache.pending = malloc((ast->decls_size + 1) * sizeof(AstIndex));
+    cache.pending_next = malloc((ast->assignments_size + 1) * sizeof(AstIndex));
+    for (uint32_t i = 0; i <= ast->decls_size; i++) {
+        cache.pending[i] = AST_NONE;
+    }
+    aot_mark_statements(&cache, ast->program);
+    AotBuffer main_body = {0};
+    aot_statements(&cache, ast->program, &main_body);
+    if (!cache.has_error) {
+        fputs(aot_runtime, out);
+        fprintf(out, "%s\n", buffer_text(&cache.decls));
+        fputs(buffer_text(&cache.functions), out);
+        fprintf(out, "int main(void) {\n%s    cimpl_flush();\n    return 0;\n}\n", buffer_text(&main_body));
+    }
+    free(main_body.data);
+    free(cache.decls.data);
+    free(cache.functions.data);
+    free(cache.reads);
+    free(cache.fn_defs);
+    free(cache.pending);
+    free(cache.pending_next);
+    return cache.has_error;
+}
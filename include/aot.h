@@ -0,0 +1,14 @@
+#ifndef aot_h
+#define aot_h
+#include "ast.h"
+#include <stdio.h>
+
+// Ahead-of-time backend: writes a validated program out as a standalone C file. Script functions become
+// static C functions, variables become C locals (top-level ones file-scope statics, since functions can
+// read them) and println goes through a buffered writer that is flushed on exit. Arithmetic wraps around
+// like in the VM and both operands of && and || are evaluated, with calls kept in source order.
+//
+// Returns 1 (after printing the reason) when the program uses something the C output can't express.
+int aot_compile_to_c(Ast *ast, char *source, size_t source_size, FILE *out);
+
+#endif
@@ -0,0 +1,66 @@
+#include "arena.h"
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    alignas(max_align_t) char data[];
+};
+
+void arena_init(Arena *arena) {
+    arena->blocks = NULL;
+    arena->cursor = NULL;
+    arena->limit = NULL;
+    arena->last = NULL;
+    arena->used = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if ((size_t)(arena->limit - arena->cursor) < size) {
+        // allocations larger than a block get a block of their own
+        size_t data_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock *block = malloc(sizeof(ArenaBlock) + data_size);
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->cursor = block->data;
+        arena->limit = block->data + data_size;
+    }
+    void *data = arena->cursor;
+    arena->cursor += size;
+    arena->last = data;
+    arena->used += size;
+    return data;
+}
+
+void *arena_grow(Arena *arena, void *data, size_t old_size, size_t new_size) {
+    if (data == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size <= old_size) {
+        return data;
+    }
+    if (data == arena->last && (size_t)(arena->limit - (char *)data) >= new_size) {
+        char *end = (char *)data + ((new_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1));
+        arena->used += end - arena->cursor;
+        arena->cursor = end;
+        return data;
+    }
+    void *grown = arena_alloc(arena, new_size);
+    memcpy(grown, data, old_size);
+    return grown;
+}
+
+void arena_release(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(arena);
+}
@@ -0,0 +1,28 @@
+#ifndef arena_h
+#define arena_h
+#include <stddef.h>
+
+// Bump allocator for everything a compilation builds on the way to bytecode: tokens, symbols, the AST,
+// types, errors and the compiler's bookkeeping. Nothing in it is freed on its own, arena_release drops
+// all of it at once. The program and its constants are allocated on the heap, they outlive the arena.
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *blocks; // newest first
+    char *cursor;
+    char *limit;
+    void *last; // the most recent allocation, the only one arena_grow can extend in place
+    size_t used; // bytes handed out, for -v
+} Arena;
+
+void arena_init(Arena *arena);
+
+// aligned for any type, like malloc
+void *arena_alloc(Arena *arena, size_t size);
+
+// realloc for arena memory: data (NULL or from this arena) keeps its first old_size bytes
+void *arena_grow(Arena *arena, void *data, size_t old_size, size_t new_size);
+
+void arena_release(Arena *arena);
+
+#endif
@@ -3,11 +3,16 @@
 #include "utils.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-GenericDT *generic_datatype_create() {
-    GenericDT *datatype = malloc(sizeof(GenericDT));
-    return datatype;
-}
+static GenericDT simple_datatypes[] = {
+    {.type = Simple, .data.simple_datatype = Bool},
+    {.type = Simple, .data.simple_datatype = Int},
+    {.type = Simple, .data.simple_datatype = String},
+    {.type = Simple, .data.simple_datatype = Void},
+};
+
+GenericDT *simple_datatype_get(DataType simple_datatype) { return &simple_datatypes[simple_datatype]; }
 
 void function_type_init(FunctionType *fn_type) {
     fn_type->params_size = 0;
@@ -15,98 +20,200 @@ void function_type_init(FunctionType *fn_type) {
     fn_type->return_type = NULL;
 }
 
-void op_expression_init(OpExpression *exp) {
-    exp->scope = -1;
+void expression_init(Expression *exp, ExpType type, uint32_t token) {
+    exp->type = type;
+    exp->token = token;
+    exp->decl = AST_NONE;
+    exp->left = AST_NONE;
+    exp->right = AST_NONE;
     exp->datatype = NULL;
-    exp->left = NULL;
-    exp->right = NULL;
-    exp->token = NULL;
-}
-
-void call_init(Call *call) {
-    call->datatype = NULL;
-    call->args = NULL;
-    call->args_size = 0;
-    call->call_name = NULL;
-    call->scope = -1;
 }
 
 void assignment_init(Assignment *ass) {
-    ass->exp = NULL;
-    ass->var = NULL;
-    ass->op = NULL;
+    ass->exp = AST_NONE;
+    ass->var = AST_NONE;
+    ass->op = AST_NONE;
     ass->datatype = NULL;
     ass->new_var = 0;
-    ass->scope = -1;
+    ass->decl = AST_NONE;
 }
 
 void fn_param_init(FnParam *param) {
-    param->name = NULL;
+    param->name = AST_NONE;
+    param->decl = AST_NONE;
     param->datatype = NULL;
 }
 
 void fn_definition_init(FnDefinition *fn_def) {
-    fn_def->name = NULL;
+    fn_def->name = AST_NONE;
+    fn_def->decl = AST_NONE;
     fn_def->datatype = NULL;
-    fn_def->body = NULL;
-    fn_def->body_size = 0;
+    fn_def->body = (AstList){0, 0};
 }
 
 void for_loop_init(ForLoop *loop) {
-    loop->token = NULL;
-    loop->init = NULL;
-    loop->condition = NULL;
-    loop->after = NULL;
-    loop->body = NULL;
-    loop->body_size = 0;
+    loop->init = AST_NONE;
+    loop->condition = AST_NONE;
+    loop->after = AST_NONE;
+    loop->body = (AstList){0, 0};
 }
 
 void conditional_init(Conditional *cond) {
-    cond->token = NULL;
-    cond->condition = NULL;
-    cond->then_block = NULL;
-    cond->else_block = NULL;
-    cond->then_size = 0;
-    cond->else_size = 0;
+    cond->condition = AST_NONE;
+    cond->then_block = (AstList){0, 0};
+    cond->else_block = (AstList){0, 0};
+}
+
+void ast_init(Ast *ast, Token *tokens, Arena *arena) {
+    memset(ast, 0, sizeof(Ast));
+    ast->tokens = tokens;
+    ast->arena = arena;
+}
+
+// makes room for count more items in an array of the Ast, doubling it when it is full
+static void *ast_reserve(Ast *ast, void *items, uint32_t size, uint32_t *capacity, uint32_t count, size_t item_size) {
+    if (size + count <= *capacity) {
+        return items;
+    }
+    uint32_t new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < size + count) {
+        new_capacity *= 2;
+    }
+    items = arena_grow(ast->arena, items, size * item_size, new_capacity * item_size);
+    *capacity = new_capacity;
+    return items;
+}
+
+AstIndex ast_add_expression(Ast *ast, Expression *exp) {
+    ast->expressions = ast_reserve(ast, ast->expressions, ast->expressions_size, &ast->expressions_capacity, 1, sizeof(Expression));
+    ast->expressions[ast->expressions_size] = *exp;
+    return ast->expressions_size++;
+}
+
+AstIndex ast_add_oneliner(Ast *ast, Oneliner *oneliner) {
+    ast->oneliners = ast_reserve(ast, ast->oneliners, ast->oneliners_size, &ast->oneliners_capacity, 1, sizeof(Oneliner));
+    ast->oneliners[ast->oneliners_size] = *oneliner;
+    return ast->oneliners_size++;
+}
+
+AstIndex ast_add_assignment(Ast *ast, Assignment *ass) {
+    ast->assignments = ast_reserve(ast, ast->assignments, ast->assignments_size, &ast->assignments_capacity, 1, sizeof(Assignment));
+    ast->assignments[ast->assignments_size] = *ass;
+    return ast->assignments_size++;
 }
 
-void break_cmd_init(BreakCmd *cmd) { cmd->token = NULL; }
+AstIndex ast_add_conditional(Ast *ast, Conditional *cond) {
+    ast->conditionals = ast_reserve(ast, ast->conditionals, ast->conditionals_size, &ast->conditionals_capacity, 1, sizeof(Conditional));
+    ast->conditionals[ast->conditionals_size] = *cond;
+    return ast->conditionals_size++;
+}
 
-void continue_cmd_init(ContinueCmd *cmd) { cmd->token = NULL; }
+AstIndex ast_add_for_loop(Ast *ast, ForLoop *loop) {
+    ast->for_loops = ast_reserve(ast, ast->for_loops, ast->for_loops_size, &ast->for_loops_capacity, 1, sizeof(ForLoop));
+    ast->for_loops[ast->for_loops_size] = *loop;
+    return ast->for_loops_size++;
+}
+
+AstIndex ast_add_fn_definition(Ast *ast, FnDefinition *fn_def) {
+    ast->fn_defs = ast_reserve(ast, ast->fn_defs, ast->fn_defs_size, &ast->fn_defs_capacity, 1, sizeof(FnDefinition));
+    ast->fn_defs[ast->fn_defs_size] = *fn_def;
+    return ast->fn_defs_size++;
+}
 
-void return_cmd_init(ReturnCmd *cmd) {
-    cmd->token = NULL;
-    cmd->exp = NULL;
+AstIndex ast_add_declaration(Ast *ast, int slot, int depth) {
+    ast->decls = ast_reserve(ast, ast->decls, ast->decls_size, &ast->decls_capacity, 1, sizeof(Declaration));
+    ast->decls[ast->decls_size] = (Declaration){.slot = slot, .depth = depth};
+    return ast->decls_size++;
 }
 
-void open_scope_cmd_init(OpenScopeCmd *cmd) { cmd->token = NULL; }
+AstList ast_add_expressions(Ast *ast, Expression *exps, uint32_t size) {
+    ast->expressions = ast_reserve(ast, ast->expressions, ast->expressions_size, &ast->expressions_capacity, size, sizeof(Expression));
+    AstList list = {.start = ast->expressions_size, .size = size};
+    memcpy(ast->expressions + ast->expressions_size, exps, size * sizeof(Expression));
+    ast->expressions_size += size;
+    return list;
+}
 
-void close_scope_cmd_init(CloseScopeCmd *cmd) { cmd->token = NULL; }
+AstList ast_add_stmts(Ast *ast, Stmt *stmts, uint32_t size) {
+    ast->stmts = ast_reserve(ast, ast->stmts, ast->stmts_size, &ast->stmts_capacity, size, sizeof(Stmt));
+    AstList list = {.start = ast->stmts_size, .size = size};
+    memcpy(ast->stmts + ast->stmts_size, stmts, size * sizeof(Stmt));
+    ast->stmts_size += size;
+    return list;
+}
 
-int generic_datatype_compare(GenericDT *first, GenericDT *second) {
-    if (first == NULL || second == NULL) {
-        return 1;
+// the parts of a function type are canonical, so hashing their addresses is enough
+static uint64_t fn_type_hash(FunctionType *fn_type) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = (hash ^ (uintptr_t)fn_type->return_type) * 0x100000001b3ull;
+    for (size_t i = 0; i < fn_type->params_size; i++) {
+        hash = (hash ^ (uintptr_t)fn_type->params[i].datatype) * 0x100000001b3ull;
     }
-    if (first->type != second->type) {
+    return hash ^ hash >> 29;
+}
+
+static int fn_type_equal(FunctionType *first, FunctionType *second) {
+    if (first->return_type != second->return_type || first->params_size != second->params_size) {
         return 0;
     }
-    switch (first->type) {
-    case Simple:
-        return first->data.simple_datatype == second->data.simple_datatype;
-    default:
-        if (!generic_datatype_compare(first->data.fn_datatype->return_type, second->data.fn_datatype->return_type)) {
+    for (size_t i = 0; i < first->params_size; i++) {
+        if (first->params[i].datatype != second->params[i].datatype) {
             return 0;
         }
-        if (first->data.fn_datatype->params_size != second->data.fn_datatype->params_size) {
-            return 0;
-        }
-        for (int i = 0; i < first->data.fn_datatype->params_size; i++) {
-            if (!generic_datatype_compare(first->data.fn_datatype->params[i].datatype, second->data.fn_datatype->params[i].datatype)) {
-                return 0;
+    }
+    return 1;
+}
+
+// the free slot or the slot of the type equal to fn_type
+static uint32_t fn_types_find(Ast *ast, FunctionType *fn_type) {
+    uint32_t mask = ast->fn_types_capacity - 1;
+    uint32_t i = (uint32_t)fn_type_hash(fn_type) & mask;
+    while (ast->fn_types[i] != NULL && !fn_type_equal(ast->fn_types[i]->data.fn_datatype, fn_type)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+GenericDT *fn_datatype_intern(Ast *ast, FunctionType *fn_type) {
+    if (ast->fn_types_capacity <= ast->fn_types_size * 2) {
+        GenericDT **old_types = ast->fn_types;
+        uint32_t old_capacity = ast->fn_types_capacity;
+        ast->fn_types_capacity = old_capacity ? old_capacity * 2 : 64;
+        ast->fn_types = arena_alloc(ast->arena, ast->fn_types_capacity * sizeof(GenericDT *));
+        memset(ast->fn_types, 0, ast->fn_types_capacity * sizeof(GenericDT *));
+        for (uint32_t i = 0; i < old_capacity; i++) {
+            if (old_types[i] != NULL) {
+                ast->fn_types[fn_types_find(ast, old_types[i]->data.fn_datatype)] = old_types[i];
             }
         }
     }
-    return 1;
+    uint32_t slot = fn_types_find(ast, fn_type);
+    if (ast->fn_types[slot] != NULL) {
+        return ast->fn_types[slot];
+    }
+
+    FunctionType *canonical = arena_alloc(ast->arena, sizeof(FunctionType));
+    function_type_init(canonical);
+    canonical->return_type = fn_type->return_type;
+    canonical->params_size = fn_type->params_size;
+    if (fn_type->params_size) {
+        canonical->params = arena_alloc(ast->arena, fn_type->params_size * sizeof(FnParam));
+        for (size_t i = 0; i < fn_type->params_size; i++) {
+            fn_param_init(&canonical->params[i]);
+            canonical->params[i].datatype = fn_type->params[i].datatype;
+        }
+    }
+    GenericDT *datatype = arena_alloc(ast->arena, sizeof(GenericDT));
+    datatype->type = Complex;
+    datatype->data.fn_datatype = canonical;
+    ast->fn_types[slot] = datatype;
+    ast->fn_types_size++;
+    return datatype;
+}
+
+size_t ast_node_count(Ast *ast) {
+    return ast->expressions_size + ast->stmts_size + ast->oneliners_size + ast->assignments_size + ast->conditionals_size + ast->for_loops_size +
+           ast->fn_defs_size;
 }
 
 void tab(int tab_size) {
@@ -116,82 +223,87 @@ void tab(int tab_size) {
     }
 }
 
-void visualize_oneliner(Oneliner *oneliner, char *source) {
+static void visualize_call(Ast *ast, Expression *call, char *source) {
+    Token *name = ast_token(ast, call->token);
+    printf("%s(", substring(source, name->start, name->end));
+    for (int i = 0; i < call->args.size; i++) {
+        visualize_expression(ast, ast_arg(ast, call, i), source);
+        if (i != call->args.size - 1) {
+            printf(", ");
+        }
+    }
+    printf(") : ");
+    generic_datatype_view(call->datatype, source);
+}
+
+void visualize_oneliner(Ast *ast, Oneliner *oneliner, char *source) {
     switch (oneliner->type) {
     case AssignmentOL: {
-        Assignment *ass = oneliner->data.assignment;
-        printf("%s : ", substring(source, ass->var->start, ass->var->end));
+        Assignment *ass = &ast->assignments[oneliner->index];
+        Token *var = ast_token(ast, ass->var);
+        Token *op = ast_token(ast, ass->op);
+        printf("%s : ", substring(source, var->start, var->end));
         generic_datatype_view(ass->datatype, source);
-        printf(" %s", substring(source, ass->op->start, ass->op->end));
-        if (ass->op->ttype != Inc && ass->op->ttype != Dec) {
+        printf(" %s", substring(source, op->start, op->end));
+        if (op->ttype != Inc && op->ttype != Dec) {
             printf(" ");
-            visualize_expression(ass->exp, source);
+            visualize_expression(ast, ast_expression(ast, ass->exp), source);
         }
         break;
     }
-    case CallOL: {
-        Call *call = oneliner->data.call;
-        printf("%s(", substring(source, call->call_name->start, call->call_name->end));
-        for (int i = 0; i < call->args_size; i++) {
-            visualize_expression(&call->args[i], source);
-            if (i != call->args_size - 1) {
-                printf(", ");
-            }
-        }
-        printf(") : ");
-        generic_datatype_view(call->datatype, source);
+    case CallOL:
+        visualize_call(ast, ast_expression(ast, oneliner->index), source);
         break;
-    }
     case PrintlnOL: {
         printf("println ");
-        visualize_expression(oneliner->data.println->exp, source);
+        visualize_expression(ast, ast_expression(ast, oneliner->index), source);
         break;
     }
     }
 }
 
-void visualize_program(Stmt *stmts, size_t stmts_size, int tab_size, char *source) {
-    for (int i = 0; i < stmts_size; i++) {
+void visualize_program(Ast *ast, AstList stmts, int tab_size, char *source) {
+    for (int i = 0; i < stmts.size; i++) {
         tab(tab_size);
-        Stmt stmt = stmts[i];
+        Stmt stmt = *ast_stmt(ast, stmts, i);
         switch (stmt.type) {
         case OnelinerStmt: {
-            Oneliner *oneliner = stmt.data.oneliner;
-            visualize_oneliner(oneliner, source);
+            visualize_oneliner(ast, &ast->oneliners[stmt.index], source);
             printf(";");
             break;
         }
         case ConditionalStmt: {
-            Conditional *cond = stmt.data.conditional;
-            printf("%s ", substring(source, cond->token->start, cond->token->end));
-            visualize_expression(cond->condition, source);
-            if (cond->then_size) {
+            Conditional *cond = &ast->conditionals[stmt.index];
+            Token *token = ast_token(ast, stmt.token);
+            printf("%s ", substring(source, token->start, token->end));
+            visualize_expression(ast, ast_expression(ast, cond->condition), source);
+            if (cond->then_block.size) {
                 printf(" {");
-                visualize_program(cond->then_block, cond->then_size, tab_size + 4, source);
+                visualize_program(ast, cond->then_block, tab_size + 4, source);
                 tab(tab_size);
                 printf("}");
             } else {
                 printf("{}");
             }
-            if (cond->else_size) {
+            if (cond->else_block.size) {
                 printf(" else {");
-                visualize_program(cond->else_block, cond->else_size, tab_size + 4, source);
+                visualize_program(ast, cond->else_block, tab_size + 4, source);
                 tab(tab_size);
                 printf("}");
             }
             break;
         }
         case ForStmt: {
-            ForLoop *for_loop = stmt.data.for_loop;
+            ForLoop *for_loop = &ast->for_loops[stmt.index];
             printf("for ");
-            visualize_oneliner(for_loop->init, source);
+            visualize_oneliner(ast, &ast->oneliners[for_loop->init], source);
             printf("; ");
-            visualize_expression(for_loop->condition, source);
+            visualize_expression(ast, ast_expression(ast, for_loop->condition), source);
             printf("; ");
-            visualize_oneliner(for_loop->after, source);
-            if (for_loop->body_size) {
+            visualize_oneliner(ast, &ast->oneliners[for_loop->after], source);
+            if (for_loop->body.size) {
                 printf(" {");
-                visualize_program(for_loop->body, for_loop->body_size, tab_size + 4, source);
+                visualize_program(ast, for_loop->body, tab_size + 4, source);
                 tab(tab_size);
                 printf("}");
             } else {
@@ -200,14 +312,15 @@ void visualize_program(Stmt *stmts, size_t stmts_size, int tab_size, char *sourc
             break;
         }
         case FnStmt: {
-            FnDefinition *fn = stmt.data.fn_def;
+            FnDefinition *fn = &ast->fn_defs[stmt.index];
+            Token *name = ast_token(ast, fn->name);
             GenericDT dt = {.type = Complex};
             dt.data.fn_datatype = fn->datatype;
-            printf("%s : ", substring(source, fn->name->start, fn->name->end));
+            printf("%s : ", substring(source, name->start, name->end));
             generic_datatype_view(&dt, source);
             printf("{");
-            if (fn->body_size != 0) {
-                visualize_program(fn->body, fn->body_size, tab_size + 4, source);
+            if (fn->body.size != 0) {
+                visualize_program(ast, fn->body, tab_size + 4, source);
                 tab(tab_size);
             }
             printf("}");
@@ -221,11 +334,10 @@ void visualize_program(Stmt *stmts, size_t stmts_size, int tab_size, char *sourc
             printf("continue;");
             break;
         case ReturnStmt: {
-            ReturnCmd *cmd = stmt.data.return_cmd;
             printf("return");
-            if (cmd->exp != NULL) {
+            if (stmt.index != AST_NONE) {
                 printf(" ");
-                visualize_expression(cmd->exp, source);
+                visualize_expression(ast, ast_expression(ast, stmt.index), source);
             }
             printf(";");
             break;
@@ -242,48 +354,38 @@ void visualize_program(Stmt *stmts, size_t stmts_size, int tab_size, char *sourc
     }
 }
 
-void visualize_expression(Expression *exp, char *source) {
+void visualize_expression(Ast *ast, Expression *exp, char *source) {
     switch (exp->type) {
     case ExpExp: {
-        OpExpression *op_exp = exp->data.exp;
-        switch (op_exp->token->ttype) {
+        Token *token = ast_token(ast, exp->token);
+        switch (token->ttype) {
         case Not:
             printf("! ");
-            visualize_expression(op_exp->left, source);
+            visualize_expression(ast, ast_expression(ast, exp->left), source);
             break;
         case Text:
         case Identifier:
         case Number:
         case True:
         case False: {
-            printf("%s:", substring(source, op_exp->token->start, op_exp->token->end));
-            generic_datatype_view(op_exp->datatype, source);
+            printf("%s:", substring(source, token->start, token->end));
+            generic_datatype_view(exp->datatype, source);
             break;
         }
         default: {
             printf("(");
-            visualize_expression(op_exp->left, source);
-            printf(" %s ", substring(source, op_exp->token->start, op_exp->token->end));
-            visualize_expression(op_exp->right, source);
+            visualize_expression(ast, ast_expression(ast, exp->left), source);
+            printf(" %s ", substring(source, token->start, token->end));
+            visualize_expression(ast, ast_expression(ast, exp->right), source);
             printf("):");
-            generic_datatype_view(op_exp->datatype, source);
+            generic_datatype_view(exp->datatype, source);
             break;
         }
         }
         break;
     }
-    case FnCallExp: {
-        Call *call = exp->data.fn_call;
-        printf("%s(", substring(source, call->call_name->start, call->call_name->end));
-        for (int i = 0; i < call->args_size; i++) {
-            visualize_expression(&call->args[i], source);
-            if (i != call->args_size - 1) {
-                printf(", ");
-            }
-        }
-        printf(") : ");
-        generic_datatype_view(call->datatype, source);
-    }
+    case FnCallExp:
+        visualize_call(ast, exp, source);
     }
 }
 
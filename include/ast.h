@@ -1,6 +1,7 @@
 #ifndef AST_H
 #define AST_H
 #include "token.h"
+#include <stdint.h>
 
 typedef enum { CallOL, AssignmentOL, PrintlnOL } OnelinerType;
 
@@ -12,25 +13,36 @@ typedef enum { Bool, Int, String, Void } DataType;
 
 typedef enum { Simple, Complex } VarType;
 
-typedef struct Stmt Stmt;
-
 typedef struct FnParam FnParam;
 
 typedef struct FunctionType FunctionType;
 
-typedef union ExpUnion ExpUnion;
-
 typedef union {
     DataType simple_datatype;
     FunctionType *fn_datatype;
 } DTUnion;
 
+// Types are interned and never change once made: there is one GenericDT per distinct type, so two types are
+// equal exactly when they are the same pointer. Get them from simple_datatype_get and fn_datatype_intern.
 typedef struct {
     VarType type;
     DTUnion data;
 } GenericDT;
 
-GenericDT *generic_datatype_create();
+// static, simple types take no allocation
+GenericDT *simple_datatype_get(DataType simple_datatype);
+
+// The tree is flat: every kind of node lives in one array of the Ast and nodes refer to their children and
+// to tokens by 32-bit index. The children of a node (statements of a block, arguments of a call) are
+// consecutive, so a block is a start and a size. Only the types are still pointers.
+typedef uint32_t AstIndex;
+
+#define AST_NONE UINT32_MAX
+
+typedef struct {
+    AstIndex start;
+    uint32_t size;
+} AstList;
 
 struct FunctionType {
     FnParam *params;
@@ -40,155 +52,167 @@ struct FunctionType {
 
 void function_type_init(FunctionType *fn_type);
 
+// an operator, literal or variable (ExpExp) or a call (FnCallExp)
 typedef struct {
-    GenericDT *datatype;
-    Token *token;
-    int scope;
-    struct Expression *left;
-    struct Expression *right;
-} OpExpression;
-
-void op_expression_init(OpExpression *exp);
-
-typedef struct {
-    GenericDT *datatype;
-    Token *call_name;
-    struct Expression *args;
-    size_t args_size;
-    int scope;
-} Call;
-
-void call_init(Call *call);
-
-union ExpUnion {
-    OpExpression *exp;
-    Call *fn_call;
-};
-
-typedef struct Expression {
     ExpType type;
-    ExpUnion data;
+    uint32_t token; // the operator, literal or variable, or the called function's name
+    AstIndex decl;  // what a variable or called name resolves to, set by the analyzer
+    union {
+        struct {
+            AstIndex left; // the only operand of !, AST_NONE for literals and variables
+            AstIndex right;
+        };
+        AstList args; // FnCallExp
+    };
+    GenericDT *datatype; // FnCallExp: the return type
 } Expression;
 
+void expression_init(Expression *exp, ExpType type, uint32_t token);
+
 typedef struct {
-    Token *var;
-    GenericDT *datatype;
+    uint32_t var;
+    uint32_t op;
     int new_var;
-    Token *op;
-    Expression *exp;
-    int scope;
+    AstIndex decl; // the variable assigned to, or declared by a new_var
+    AstIndex exp;  // AST_NONE for ++ and --
+    GenericDT *datatype;
 } Assignment;
 
 void assignment_init(Assignment *ass);
 
 struct FnParam {
     GenericDT *datatype;
-    Token *name;
+    uint32_t name; // AST_NONE in function types that aren't definitions
+    AstIndex decl; // set by the analyzer in definitions
 };
 
 void fn_param_init(FnParam *param);
 
 typedef struct {
-    Token *name;
+    uint32_t name;
+    AstIndex decl;
     FunctionType *datatype;
-    Stmt *body;
-    size_t body_size;
+    AstList body;
 } FnDefinition;
 
 void fn_definition_init(FnDefinition *fn_def);
 
-// TODO: add initializers
-typedef struct {
-    Token *token;
-    Expression *exp;
-} PrintlnCmd;
-
-typedef union {
-    Assignment *assignment;
-    Call *call;
-    PrintlnCmd *println;
-} OnelinerUnion;
-
+// index is the call (CallOL) or the printed value (PrintlnOL) in expressions, or the assignment
 typedef struct {
     OnelinerType type;
-    OnelinerUnion data;
+    AstIndex index;
 } Oneliner;
 
 typedef struct ForLoop {
-    Token *token;
-    Oneliner *init;
-    Expression *condition;
-    Oneliner *after;
-    Stmt *body;
-    size_t body_size;
+    AstIndex init; // oneliners
+    AstIndex condition;
+    AstIndex after;
+    AstList body;
 } ForLoop;
 
 void for_loop_init(ForLoop *loop);
 
 typedef struct {
-    Token *token;
-    Expression *condition;
-    Stmt *then_block;
-    Stmt *else_block;
-    size_t then_size;
-    size_t else_size;
+    AstIndex condition;
+    AstList then_block;
+    AstList else_block;
 } Conditional;
 
 void conditional_init(Conditional *cond);
 
+// A declared name, every use of it points here. Slots are numbered from 0 in each frame (the top level or
+// a function call) and reused once the scope declaring them closes, the parameters take the first ones.
 typedef struct {
-    Token *token;
-} BreakCmd;
+    int slot;  // -1 for functions, the compiler tracks where they start
+    int depth; // functions around the declaration, 0 for the top level
+} Declaration;
 
-void break_cmd_init(BreakCmd *cmd);
+// token is the keyword, brace or (for OnelinerStmt) first token of the statement. index points into the
+// array for its type: oneliners, conditionals, for_loops or fn_defs, and for ReturnStmt to the returned
+// expression (AST_NONE when there is none). Break, continue and scope braces have no node.
+typedef struct {
+    StmtType type;
+    uint32_t token;
+    AstIndex index;
+} Stmt;
 
 typedef struct {
-    Token *token;
-} ContinueCmd;
+    Token *tokens;
+    Arena *arena;
+    Expression *expressions;
+    Stmt *stmts;
+    Oneliner *oneliners;
+    Assignment *assignments;
+    Conditional *conditionals;
+    ForLoop *for_loops;
+    FnDefinition *fn_defs;
+    Declaration *decls;
+    uint32_t expressions_size;
+    uint32_t expressions_capacity;
+    uint32_t stmts_size;
+    uint32_t stmts_capacity;
+    uint32_t oneliners_size;
+    uint32_t oneliners_capacity;
+    uint32_t assignments_size;
+    uint32_t assignments_capacity;
+    uint32_t conditionals_size;
+    uint32_t conditionals_capacity;
+    uint32_t for_loops_size;
+    uint32_t for_loops_capacity;
+    uint32_t fn_defs_size;
+    uint32_t fn_defs_capacity;
+    uint32_t decls_size;
+    uint32_t decls_capacity;
+    GenericDT **fn_types; // the interned function types, open addressing on their parameter and return types
+    uint32_t fn_types_size;
+    uint32_t fn_types_capacity;
+    AstList program; // the top-level statements
+} Ast;
 
-void continue_cmd_init(ContinueCmd *cmd);
+// the node arrays are allocated from arena
+void ast_init(Ast *ast, Token *tokens, Arena *arena);
 
-typedef struct {
-    Token *token;
-} OpenScopeCmd;
+AstIndex ast_add_expression(Ast *ast, Expression *exp);
 
-void open_scope_cmd_init(OpenScopeCmd *cmd);
+AstIndex ast_add_oneliner(Ast *ast, Oneliner *oneliner);
 
-typedef struct {
-    Token *token;
-} CloseScopeCmd;
+AstIndex ast_add_assignment(Ast *ast, Assignment *ass);
 
-void close_scope_cmd_init(CloseScopeCmd *cmd);
+AstIndex ast_add_conditional(Ast *ast, Conditional *cond);
 
-typedef struct {
-    Token *token;
-    Expression *exp;
-} ReturnCmd;
+AstIndex ast_add_for_loop(Ast *ast, ForLoop *loop);
 
-void return_cmd_init(ReturnCmd *cmd);
+AstIndex ast_add_fn_definition(Ast *ast, FnDefinition *fn_def);
 
-typedef union {
-    ForLoop *for_loop;
-    Conditional *conditional;
-    Oneliner *oneliner;
-    FnDefinition *fn_def;
-    BreakCmd *break_cmd;
-    ContinueCmd *continue_cmd;
-    OpenScopeCmd *open_scope_cmd;
-    CloseScopeCmd *close_scope_cmd;
-    ReturnCmd *return_cmd;
-} StmtUnion;
-
-struct Stmt {
-    StmtType type;
-    StmtUnion data;
-};
+AstIndex ast_add_declaration(Ast *ast, int slot, int depth);
+
+// the canonical type of functions taking fn_type's parameter types and returning its return type, whose own
+// types must be canonical already. Parameter names aren't part of the type, fn_type isn't kept.
+GenericDT *fn_datatype_intern(Ast *ast, FunctionType *fn_type);
+
+// appends copies of size nodes one after another
+AstList ast_add_expressions(Ast *ast, Expression *exps, uint32_t size);
+
+AstList ast_add_stmts(Ast *ast, Stmt *stmts, uint32_t size);
+
+// NULL for AST_NONE
+static inline Expression *ast_expression(Ast *ast, AstIndex index) { return index == AST_NONE ? NULL : &ast->expressions[index]; }
+
+static inline Token *ast_token(Ast *ast, uint32_t index) { return &ast->tokens[index]; }
+
+static inline Stmt *ast_stmt(Ast *ast, AstList list, uint32_t i) { return &ast->stmts[list.start + i]; }
+
+static inline Expression *ast_arg(Ast *ast, Expression *call, uint32_t i) { return &ast->expressions[call->args.start + i]; }
 
 static void generic_datatype_view(GenericDT *datatype, char *source);
 
-int generic_datatype_compare(GenericDT *first, GenericDT *second);
+// a type that couldn't be worked out (NULL) matches anything, the error was already reported
+static inline int generic_datatype_compare(GenericDT *first, GenericDT *second) { return first == NULL || second == NULL || first == second; }
+
+// number of nodes in the tree, used as a size hint by later passes
+size_t ast_node_count(Ast *ast);
 
-void visualize_program(Stmt *stmts, size_t stmts_size, int tab_size, char *source);
+void visualize_program(Ast *ast, AstList stmts, int tab_size, char *source);
 
-static void visualize_expression(Expression *exp, char *source);
+static void visualize_expression(Ast *ast, Expression *exp, char *source);
 #endif
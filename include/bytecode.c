@@ -1,37 +1,91 @@
 #include "bytecode.h"
 #include <stdio.h>
 
-void bytecode_visualize(OpCode *commands, Constant *args, size_t program_size) {
+// whether arg of the instruction is a jump target within the program (calls excluded)
+int bytecode_is_jump(uint8_t code) {
+    switch (code) {
+    case GotoCode:
+    case GotoIfCode:
+    case GotoIfNotCode:
+    case GotoIfLocalEqCode:
+    case GotoIfLocalNotEqCode:
+    case GotoIfLocalGtCode:
+    case GotoIfLocalLtCode:
+    case GotoIfLocalGtECode:
+    case GotoIfLocalLtECode:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void bytecode_visualize(Instruction *program, size_t program_size, Constant *constants) {
     printf("\nVisualizing bytecode\n\n");
     for (int i = 0; i < program_size; i++) {
         printf("%d: ", i);
-        switch (commands[i]) {
-        case ShiftStackCode:
-            printf("SHIFT to %d\n", args[i].int_data);
+        switch (program[i].code) {
+        case EnterCode:
+            printf("ENTER with %d slots\n", program[i].arg);
             break;
         case GotoCode:
-            printf("GOTO %d\n", args[i].int_data);
+            printf("GOTO %d\n", program[i].arg);
             break;
         case GotoIfCode:
-            printf("GOTO_IF %d\n", args[i].int_data);
+            printf("GOTO_IF %d\n", program[i].arg);
+            break;
+        case GotoIfNotCode:
+            printf("GOTO_IF_NOT %d\n", program[i].arg);
+            break;
+        case GotoIfLocalEqCode:
+            printf("GOTO_IF_LOCAL slot %d == %d TO %d\n", program[i].local, program[i].imm, program[i].arg);
+            break;
+        case GotoIfLocalNotEqCode:
+            printf("GOTO_IF_LOCAL slot %d != %d TO %d\n", program[i].local, program[i].imm, program[i].arg);
+            break;
+        case GotoIfLocalGtCode:
+            printf("GOTO_IF_LOCAL slot %d > %d TO %d\n", program[i].local, program[i].imm, program[i].arg);
+            break;
+        case GotoIfLocalLtCode:
+            printf("GOTO_IF_LOCAL slot %d < %d TO %d\n", program[i].local, program[i].imm, program[i].arg);
+            break;
+        case GotoIfLocalGtECode:
+            printf("GOTO_IF_LOCAL slot %d >= %d TO %d\n", program[i].local, program[i].imm, program[i].arg);
+            break;
+        case GotoIfLocalLtECode:
+            printf("GOTO_IF_LOCAL slot %d <= %d TO %d\n", program[i].local, program[i].imm, program[i].arg);
+            break;
+        case AddLocalCode:
+            printf("ADD_LOCAL slot %d by %d\n", program[i].local, program[i].arg);
             break;
         case PushCode:
-            printf("PUSH %d\n", args[i].int_data);
+            printf("PUSH %d\n", program[i].arg);
+            break;
+        case PushConstCode:
+            printf("PUSH_CONST %d (\"%s\")\n", program[i].arg, constants[program[i].arg].string_data);
             break;
         case LoadCode:
-            printf("LOAD with offset %d\n", args[i].int_data);
+            printf("LOAD slot %d\n", program[i].arg);
+            break;
+        case LoadGlobalCode:
+            printf("LOAD_GLOBAL slot %d\n", program[i].arg);
             break;
         case StoreCode:
-            printf("STORE with offset %d\n", args[i].int_data);
+            printf("STORE slot %d\n", program[i].arg);
+            break;
+        case StoreGlobalCode:
+            printf("STORE_GLOBAL slot %d\n", program[i].arg);
             break;
         case ReturnCode:
-            printf("RETURN with shift %d\n", args[i].int_data);
+            printf("RETURN\n");
             break;
         case ResumeCode:
-            printf("RESUME with shift %d\n", args[i].int_data);
+            printf("RESUME\n");
             break;
         case CallCode:
-            printf("CALL to %d\n", args[i].int_data);
+            printf("CALL to %d with %d args\n", program[i].arg, program[i].imm);
+            break;
+        case TailCallCode:
+            printf("TAIL_CALL to %d with %d args\n", program[i].arg, program[i].imm);
             break;
         case IntAddCode:
             printf("ADD\n");
@@ -90,3 +144,144 @@ void bytecode_visualize(OpCode *commands, Constant *args, size_t program_size) {
         }
     }
 }
+
+int reg_bytecode_is_jump(uint8_t code) { return code >= RegGotoCode && code <= RegGotoIfLtEImmCode; }
+
+void reg_bytecode_visualize(RegInstruction *program, size_t program_size, Constant *constants) {
+    printf("\nVisualizing register bytecode\n\n");
+    for (int i = 0; i < program_size; i++) {
+        RegInstruction instruction = program[i];
+        printf("%d: ", i);
+        switch (instruction.code) {
+        case RegLoadIntCode:
+            printf("r%d = %d\n", instruction.a, instruction.b);
+            break;
+        case RegLoadConstCode:
+            printf("r%d = CONST %d (\"%s\")\n", instruction.a, instruction.b, constants[instruction.b].string_data);
+            break;
+        case RegMoveCode:
+            printf("r%d = r%d\n", instruction.a, instruction.b);
+            break;
+        case RegGetGlobalCode:
+            printf("r%d = GLOBAL %d\n", instruction.a, instruction.b);
+            break;
+        case RegSetGlobalCode:
+            printf("GLOBAL %d = r%d\n", instruction.a, instruction.b);
+            break;
+        case RegIntAddCode:
+            printf("r%d = r%d + r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntSubtractCode:
+            printf("r%d = r%d - r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntMultiplyCode:
+            printf("r%d = r%d * r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntDivideCode:
+            printf("r%d = r%d / r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntModCode:
+            printf("r%d = r%d %% r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntEqCode:
+            printf("r%d = r%d == r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntNotEqCode:
+            printf("r%d = r%d != r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntGtCode:
+            printf("r%d = r%d > r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntLtCode:
+            printf("r%d = r%d < r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntGtECode:
+            printf("r%d = r%d >= r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegIntLtECode:
+            printf("r%d = r%d <= r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegBoolAndCode:
+            printf("r%d = r%d && r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegBoolOrCode:
+            printf("r%d = r%d || r%d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegBoolNotCode:
+            printf("r%d = !r%d\n", instruction.a, instruction.b);
+            break;
+        case RegIntAddImmCode:
+            printf("r%d = r%d + %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoCode:
+            printf("GOTO %d\n", instruction.c);
+            break;
+        case RegGotoIfCode:
+            printf("GOTO_IF r%d TO %d\n", instruction.a, instruction.c);
+            break;
+        case RegGotoIfNotCode:
+            printf("GOTO_IF_NOT r%d TO %d\n", instruction.a, instruction.c);
+            break;
+        case RegGotoIfEqCode:
+            printf("GOTO_IF r%d == r%d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfNotEqCode:
+            printf("GOTO_IF r%d != r%d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfGtCode:
+            printf("GOTO_IF r%d > r%d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfLtCode:
+            printf("GOTO_IF r%d < r%d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfGtECode:
+            printf("GOTO_IF r%d >= r%d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfLtECode:
+            printf("GOTO_IF r%d <= r%d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfEqImmCode:
+            printf("GOTO_IF r%d == %d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfNotEqImmCode:
+            printf("GOTO_IF r%d != %d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfGtImmCode:
+            printf("GOTO_IF r%d > %d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfLtImmCode:
+            printf("GOTO_IF r%d < %d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfGtEImmCode:
+            printf("GOTO_IF r%d >= %d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegGotoIfLtEImmCode:
+            printf("GOTO_IF r%d <= %d TO %d\n", instruction.a, instruction.b, instruction.c);
+            break;
+        case RegCallCode:
+            printf("CALL to %d with base r%d\n", instruction.a, instruction.b);
+            break;
+        case RegTailCallCode:
+            printf("TAIL_CALL to %d with %d args from r%d\n", instruction.a, instruction.c, instruction.b);
+            break;
+        case RegReturnCode:
+            printf("RETURN r%d\n", instruction.a);
+            break;
+        case RegResumeCode:
+            printf("RESUME\n");
+            break;
+        case RegPrintlnIntCode:
+            printf("PRINTLN_INT r%d\n", instruction.a);
+            break;
+        case RegPrintlnBoolCode:
+            printf("PRINTLN_BOOL r%d\n", instruction.a);
+            break;
+        case RegPrintlnStrCode:
+            printf("PRINTLN_STR r%d\n", instruction.a);
+            break;
+        case RegEndCode:
+            printf("END\n");
+            break;
+        }
+    }
+}
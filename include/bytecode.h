@@ -3,13 +3,19 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// variables live in slots relative to the base of the current call frame, arg of LOAD/STORE is the slot;
+// the operand stack starts right above the frame's slots
 typedef enum {
-    ShiftStackCode,
+    EnterCode, // first instruction of the program and of every function, reserves arg variable slots
     PushCode,
+    PushConstCode,
     LoadCode,
+    LoadGlobalCode, // loads a top-level variable from inside a function, arg is its slot in the top-level frame
     ReturnCode,
     StoreCode,
-    CallCode,
+    StoreGlobalCode,
+    CallCode,     // arg is the function, imm the argument count, the arguments become the callee's first slots
+    TailCallCode, // call reusing the current frame, operands as in CallCode
 
     IntAddCode,
     IntSubtractCode,
@@ -28,9 +34,19 @@ typedef enum {
     BoolOrCode,
 
     GotoIfCode,
+    GotoIfNotCode,
     GotoCode,
     ResumeCode,
 
+    // fused forms of load + push + compare + goto_if and load + push + add + store on a single local
+    GotoIfLocalEqCode,
+    GotoIfLocalNotEqCode,
+    GotoIfLocalGtCode,
+    GotoIfLocalLtCode,
+    GotoIfLocalGtECode,
+    GotoIfLocalLtECode,
+    AddLocalCode,
+
     PrintlnIntCode,
     PrintlnBoolCode,
     PrintlnStrCode,
@@ -38,125 +54,169 @@ typedef enum {
     EndCode,
 } OpCode;
 
-// cond := true;
-// if cond {
-//     cond = false;
-// } else {
-//     cond = true;
-// }
-// answer := 42;
-//
-// 0: push true
-// 1: store cond
-//
-// 2: load cond
-// 3: goto_if 5
-// 4: goto 10
-// 5: cscope
-// 6: push false
-// 7: store cond
-// 8: dscope
-// 9: goto end
-// 10: cscope
-// 11: push true
-// 12: store cond
-// 13: dscope
-// 14: push 42
-// 15: store answer
+// listings as printed by -v, after the peephole pass
 //
-//
-//
-// while a == 1 {
-//     b := 1;
-//     a = b + 1;
+// calls := 0;
+// fn sum(a:int, b:int): int {
+//     calls += 1;
+//     return a + b;
+// }
+// result := sum(1, 2);
+// if result > calls {
+//     println result;
 // } else {
-//     a = 0;
+//     println calls;
 // }
-// final := 42;
 //
-// 0: load a
-// 1: push 1
-// 2: eq
-// 3: goto_if 10
-// 4: goto 18
-// 5: load a
-// 6: push 1
-// 7: eq
-// 8: goto_if 10
-// 9: goto 22
-// 10: cscope
-// 11: push 1
-// 12: store b
-// 13: load b
-// 14: push 1
-// 15: store a
-// 16: dscope
-// 17: goto 8
-// 18: cscope
-// 19: push 0
-// 20: store a
-// 21: dscope
+// 0: ENTER with 2 slots         calls is slot 0 and result slot 1 of the top-level frame
+// 1: PUSH 0
+// 2: STORE slot 0
+// 3: GOTO 13                    skips the body of sum
+// 4: ENTER with 2 slots         the arguments a and b are already in slots 0 and 1
+// 5: LOAD_GLOBAL slot 0
+// 6: PUSH 1
+// 7: ADD
+// 8: STORE_GLOBAL slot 0
+// 9: LOAD slot 0
+// 10: LOAD slot 1
+// 11: ADD
+// 12: RETURN
+// 13: PUSH 1
+// 14: PUSH 2
+// 15: CALL to 4 with 2 args
+// 16: STORE slot 1
+// 17: LOAD slot 1
+// 18: LOAD slot 0
+// 19: GT
+// 20: GOTO_IF_NOT 24
+// 21: LOAD slot 1
+// 22: PRINTLN_INT
+// 23: GOTO 26
+// 24: LOAD slot 0
+// 25: PRINTLN_INT
+// 26: END
 //
-// 22: push 42
-// 23: store final
 //
+// fn count(n:int): int {
+//     total := 0;
+//     for i := 0; i < n; i++ {
+//         total += 3;
+//     }
+//     return total;
+// }
+// println count(4);
 //
+// 0: ENTER with 0 slots
+// 1: GOTO 16
+// 2: ENTER with 3 slots         n, total, i
+// 3: PUSH 0
+// 4: STORE slot 1
+// 5: PUSH 0
+// 6: STORE slot 2
+// 7: GOTO_IF_LOCAL slot 0 <= 0 TO 14    entry check, i is known to be 0 here
+// 8: ADD_LOCAL slot 1 by 3
+// 9: ADD_LOCAL slot 2 by 1
+// 10: LOAD slot 2
+// 11: LOAD slot 0
+// 12: LT
+// 13: GOTO_IF 8                 the condition is checked again at the bottom of the loop
+// 14: LOAD slot 1
+// 15: RETURN
+// 16: PUSH 4
+// 17: CALL to 2 with 1 args
+// 18: PRINTLN_INT
+// 19: END
+
+typedef union {
+    int int_data;
+    char *string_data;
+} Constant;
+
+// opcode and its operand packed into one record, so dispatch reads a single stream;
+// operands that don't fit into arg (string literals) live in the constant pool and arg holds their index;
+// fused instructions keep the slot of their local and a small immediate in what used to be padding
+typedef struct {
+    uint8_t code;
+    uint8_t local;
+    int16_t imm;
+    int32_t arg;
+} Instruction;
+
+int bytecode_is_jump(uint8_t code);
+void bytecode_visualize(Instruction *program, size_t program_size, Constant *constants);
+
+// register instruction set: three-address ops on slots relative to the frame base, operands named a, b, c like in
+// "a = b + c"; jump targets always go in c
 //
 // total := 0;
 // for i := 0; i < 10; i++ {
 //     total += 3;
 // }
-// result := total + 1;
-//
-// 0: cscope
-// 1: push 0
-// 2: store i
-// 3: load i
-// 4: push 10
-// 5: int_lt
-// 6: goto_if 8
-// 7: goto 18
-// 8: cscope
-// 9: load total
-// 10: push 3
-// 11: int_add
-// 12: store total
-// 13: load i
-// 14: push 1
-// 15: int_add
-// 16: store i
-// 17: goto 4
-// 18: dscope
-// 19: dscope
-// 20: load total
-// 21: push 1
-// 22: int_add
-// 23: store result
-//
 //
-// fn sum(a:int, b:int) int {
-//     return a + b;
-// }
-// result := sum(1, 2);
-//
-//
-// 0: load 1
-// 1: load 1
-// 2: add
-// 3: return 0
-// 4: cscope
-// 5: push 1
-// 6: store arg_offset1
-// 7: push 2
-// 8: store arg_offset2
-// 9: goto 0
-// 10: store result
+// 0: r0 = 0
+// 1: r1 = 0
+// 2: r0 = r0 + 3
+// 3: r1 = r1 + 1
+// 4: goto_if r1 < 10 to 2
+typedef enum {
+    RegLoadIntCode,   // a = imm, the immediate held in b
+    RegLoadConstCode, // a = constants[b]
+    RegMoveCode,      // a = b
+    RegGetGlobalCode, // a = top-level slot b, for top-level variables used inside functions
+    RegSetGlobalCode, // top-level slot a = b
 
-typedef union {
-    int int_data;
-    char *string_data;
-} Constant;
+    RegIntAddCode,
+    RegIntSubtractCode,
+    RegIntMultiplyCode,
+    RegIntDivideCode,
+    RegIntModCode,
+    RegIntEqCode,
+    RegIntNotEqCode,
+    RegIntGtCode,
+    RegIntLtCode,
+    RegIntGtECode,
+    RegIntLtECode,
+    RegBoolAndCode,
+    RegBoolOrCode,
+    RegBoolNotCode,   // a = !b
+    RegIntAddImmCode, // a = b + c, where c is an immediate
+
+    RegGotoCode,
+    RegGotoIfCode,
+    RegGotoIfNotCode,
+    RegGotoIfEqCode, // goto c if a == b
+    RegGotoIfNotEqCode,
+    RegGotoIfGtCode,
+    RegGotoIfLtCode,
+    RegGotoIfGtECode,
+    RegGotoIfLtECode,
+    RegGotoIfEqImmCode, // goto c if a == b, where b is an immediate
+    RegGotoIfNotEqImmCode,
+    RegGotoIfGtImmCode,
+    RegGotoIfLtImmCode,
+    RegGotoIfGtEImmCode,
+    RegGotoIfLtEImmCode,
+
+    RegCallCode,     // call the function at a with its frame based at slot b, where the arguments are and the result goes
+    RegTailCallCode, // call the function at a in the current frame, moving c arguments from slot b down to slot 0
+    RegReturnCode, // return slot a
+    RegResumeCode,
+
+    RegPrintlnIntCode,
+    RegPrintlnBoolCode,
+    RegPrintlnStrCode,
+
+    RegEndCode,
+} RegOpCode;
+
+typedef struct {
+    uint8_t code;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+} RegInstruction;
 
-void bytecode_visualize(OpCode *commands, Constant *args, size_t program_size);
+int reg_bytecode_is_jump(uint8_t code);
+void reg_bytecode_visualize(RegInstruction *program, size_t program_size, Constant *constants);
 
 #endif
@@ -3,215 +3,582 @@
 #include "bytecode.h"
 #include "token.h"
 #include "utils.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 void compile_cache_init(CompileCache *cache) {
+    cache->ast = NULL;
     cache->source = NULL;
-    cache->args = NULL;
-    cache->commands = NULL;
-    cache->memory = NULL;
+    cache->arena = NULL;
+    cache->program = NULL;
+    cache->constants = NULL;
+    cache->labels = NULL;
+    cache->known_values = NULL;
+    cache->known_values_capacity = 0;
+    cache->known_generation = 1;
+    cache->program_capacity = 0;
+    cache->constants_size = 0;
+    cache->constants_capacity = 0;
+    cache->labels_size = 0;
+    cache->labels_capacity = 0;
     cache->scope_start_positions = NULL;
-    cache->function_param_count = 0;
+    cache->scope_starts_capacity = 0;
+    cache->scope_depth = 0;
+    cache->fn_positions = NULL;
+    cache->fn_depth = 0;
     cache->has_error = 0;
     cache->stack_index = -1;
-    cache->memory_size = 0;
-    cache->memory_capacity = 0;
+    cache->frame_size = 0;
+    cache->temp_depth = 0;
+    cache->max_temp_depth = 0;
+    cache->max_frame_size = 0;
+    cache->reg_program = NULL;
+    cache->reg_program_size = 0;
+    cache->reg_program_capacity = 0;
     cache->program_size = 0;
 }
 
-void var_positions_init(VarPositions *table) {
-    table->size = 0;
-    table->positions = NULL;
-    table->var_names = NULL;
+void memory_extend(CompileCache *cache) {
+    if (cache->scope_starts_capacity <= cache->scope_depth) {
+        int capacity = cache->scope_starts_capacity + 32;
+        cache->scope_start_positions =
+            arena_grow(cache->arena, cache->scope_start_positions, cache->scope_starts_capacity * sizeof(int), capacity * sizeof(int));
+        cache->scope_starts_capacity = capacity;
+    }
+    cache->scope_start_positions[cache->scope_depth++] = cache->stack_index;
 }
 
-void var_positions_destroy(VarPositions *table) {
-    free(table->var_names);
-    free(table->positions);
+void memory_shrink(CompileCache *cache) { cache->stack_index = cache->scope_start_positions[--cache->scope_depth]; }
+
+static void stack_index_increment(CompileCache *cache) {
+    cache->stack_index++;
+    if (cache->stack_index + 1 > cache->frame_size) {
+        cache->frame_size = cache->stack_index + 1;
+    }
+}
+
+// a new variable takes the slot the analyzer gave its declaration, the next one of the frame
+static int var_declare(CompileCache *cache, AstIndex decl) {
+    cache->stack_index = cache->ast->decls[decl].slot;
+    if (cache->stack_index + 1 > cache->frame_size) {
+        cache->frame_size = cache->stack_index + 1;
+    }
+    return cache->stack_index;
+}
+
+static void temp_push(CompileCache *cache) {
+    cache->temp_depth++;
+    if (cache->temp_depth > cache->max_temp_depth) {
+        cache->max_temp_depth = cache->temp_depth;
+    }
+}
+
+// the compile-time state of the function being compiled, saved around nested function definitions
+typedef struct {
+    int stack_index;
+    int frame_size;
+    int temp_depth;
+    int max_temp_depth;
+} FrameState;
+
+// starts the frame of a function whose memory scope was just opened
+static FrameState frame_enter(CompileCache *cache) {
+    FrameState outer = {
+        .stack_index = cache->stack_index, .frame_size = cache->frame_size, .temp_depth = cache->temp_depth, .max_temp_depth = cache->max_temp_depth};
+    cache->fn_depth++;
+    cache->stack_index = -1;
+    cache->frame_size = 0;
+    cache->temp_depth = 0;
+    cache->max_temp_depth = 0;
+    return outer;
 }
 
-int hash(char *key) {
-    int length = strlen(key);
-    int sum = 0;
-    for (int i = 0; i < length; i++) {
-        sum += (i + 1) * key[i];
+static void frame_finish(CompileCache *cache) {
+    int frame_size = cache->frame_size + cache->max_temp_depth;
+    if (frame_size > cache->max_frame_size) {
+        cache->max_frame_size = frame_size;
     }
-    return sum % 512;
 }
 
-void var_positions_set(VarPositions *table, char *var_name, int position) {
-    int index = hash(var_name);
-    for (int i = 0; i < table->size; i++) {
-        if (table->var_names[i][index] != NULL && strcmp(table->var_names[i][index], var_name)) {
-            continue;
+static void frame_leave(CompileCache *cache, FrameState outer) {
+    frame_finish(cache);
+    cache->stack_index = outer.stack_index;
+    cache->frame_size = outer.frame_size;
+    cache->temp_depth = outer.temp_depth;
+    cache->max_temp_depth = outer.max_temp_depth;
+    cache->fn_depth--;
+}
+
+// constant propagation only trusts values assigned in the current straight-line stretch of code:
+// bumping the generation forgets every known value at once
+static void known_values_clear(CompileCache *cache) { cache->known_generation++; }
+
+static void known_value_set(CompileCache *cache, int position, int value) {
+    if (position < 0) {
+        return;
+    }
+    if (cache->known_values_capacity <= position) {
+        int new_capacity = cache->known_values_capacity ? cache->known_values_capacity : 64;
+        while (new_capacity <= position) {
+            new_capacity *= 2;
+        }
+        KnownValue *new_known_values =
+            arena_grow(cache->arena, cache->known_values, cache->known_values_capacity * sizeof(KnownValue), new_capacity * sizeof(KnownValue));
+        for (int i = cache->known_values_capacity; i < new_capacity; i++) {
+            new_known_values[i].generation = 0;
         }
-        table->var_names[i][index] = var_name;
-        table->positions[i][index] = position;
+        cache->known_values = new_known_values;
+        cache->known_values_capacity = new_capacity;
+    }
+    cache->known_values[position].generation = cache->known_generation;
+    cache->known_values[position].value = value;
+}
+
+static void known_value_forget(CompileCache *cache, int position) {
+    if (position >= 0 && position < cache->known_values_capacity) {
+        cache->known_values[position].generation = 0;
+    }
+}
+
+static int known_value_get(CompileCache *cache, int position, int *value) {
+    if (position < 0 || position >= cache->known_values_capacity || cache->known_values[position].generation != cache->known_generation) {
+        return 0;
+    }
+    *value = cache->known_values[position].value;
+    return 1;
+}
+
+void compile_cache_reserve(CompileCache *cache, int capacity) {
+    if (cache->program_capacity >= capacity) {
         return;
     }
-    table->size++;
-    char *(*new_var_names)[512] = realloc(table->var_names, table->size * sizeof(char *[512]));
+    Instruction *new_program = realloc(cache->program, capacity * sizeof(Instruction));
+    cache->program = new_program;
+    cache->program_capacity = capacity;
+}
+
+static void add_fused_command(CompileCache *cache, OpCode command, int local, int imm, int arg) {
+    if (cache->program_capacity <= cache->program_size) {
+        compile_cache_reserve(cache, cache->program_capacity ? cache->program_capacity * 2 : 256);
+    }
+    Instruction instruction = {.code = command, .local = local, .imm = imm, .arg = arg};
+    cache->program[cache->program_size] = instruction;
+    cache->program_size++;
+}
+
+static void add_command(CompileCache *cache, OpCode command, int arg) { add_fused_command(cache, command, 0, 0, arg); }
+
+// adds an operand that doesn't fit into an instruction to the constant pool and returns its index
+static int add_constant(CompileCache *cache, Constant constant) {
+    if (cache->constants_capacity <= cache->constants_size) {
+        cache->constants_capacity = cache->constants_capacity ? cache->constants_capacity * 2 : 32;
+        Constant *new_constants = realloc(cache->constants, cache->constants_capacity * sizeof(Constant));
+        cache->constants = new_constants;
+    }
+    cache->constants[cache->constants_size] = constant;
+    cache->constants_size++;
+    return cache->constants_size - 1;
+}
 
-    int(*new_positions)[512] = realloc(table->positions, table->size * sizeof(int[512]));
-    for (int i = 0; i < 512; i++) {
-        new_var_names[table->size - 1][i] = NULL;
+// jumps are emitted against label handles and only resolved to instruction indices once the whole program is emitted
+static int label_create(CompileCache *cache) {
+    if (cache->labels_capacity <= cache->labels_size) {
+        int capacity = cache->labels_capacity;
+        cache->labels_capacity = capacity ? capacity * 2 : 64;
+        int *new_labels = arena_grow(cache->arena, cache->labels, capacity * sizeof(int), cache->labels_capacity * sizeof(int));
+        cache->labels = new_labels;
     }
-    new_var_names[table->size - 1][index] = var_name;
-    new_positions[table->size - 1][index] = position;
-    table->var_names = new_var_names;
-    table->positions = new_positions;
+    cache->labels[cache->labels_size] = -1;
+    cache->labels_size++;
+    return cache->labels_size - 1;
+}
+
+static void label_bind(CompileCache *cache, int label) {
+    cache->labels[label] = cache->program_size;
+    known_values_clear(cache); // control flow can reach a label from more than one place
 }
 
-int var_positions_get(VarPositions *table, char *var_name, int *position) {
-    int index = hash(var_name);
-    for (int i = 0; i < table->size; i++) {
-        if (strcmp(table->var_names[i][index], var_name)) {
-            continue;
+static void add_jump(CompileCache *cache, OpCode command, int label) { add_command(cache, command, label); }
+
+static void resolve_labels(CompileCache *cache) {
+    for (int i = 0; i < cache->program_size; i++) {
+        if (bytecode_is_jump(cache->program[i].code)) {
+            cache->program[i].arg = cache->labels[cache->program[i].arg];
         }
-        *position = table->positions[i][index];
+    }
+    cache->labels = NULL;
+    cache->labels_size = 0;
+    cache->labels_capacity = 0;
+}
+
+static int binary_command(TokenType ttype, OpCode *command) {
+    switch (ttype) {
+    case Plus:
+    case PlusEq:
+    case Inc:
+        *command = IntAddCode;
+        return 1;
+    case Minus:
+    case MinusEq:
+    case Dec:
+        *command = IntSubtractCode;
+        return 1;
+    case Star:
+    case StarEq:
+        *command = IntMultiplyCode;
+        return 1;
+    case Slash:
+    case SlashEq:
+        *command = IntDivideCode;
+        return 1;
+    case Mod:
+    case ModEq:
+        *command = IntModCode;
+        return 1;
+    case EqEq:
+        *command = IntEqCode;
+        return 1;
+    case NotEq:
+        *command = IntNotEqCode;
+        return 1;
+    case Lt:
+        *command = IntLtCode;
+        return 1;
+    case Gt:
+        *command = IntGtCode;
+        return 1;
+    case LtE:
+        *command = IntLtECode;
+        return 1;
+    case GtE:
+        *command = IntGtECode;
+        return 1;
+    case And:
+        *command = BoolAndCode;
+        return 1;
+    case Or:
+        *command = BoolOrCode;
+        return 1;
+    default:
         return 0;
     }
-    return 1;
 }
 
-void memory_store(VarPositions *memory, int memory_size, char *var_name, int var_scope, int position) {
-    if (var_scope == -1) {
-        var_scope = memory_size - 1;
+// evaluates a binary operation the way vm_run would, refusing to fold what would fault at runtime
+static int fold_binary(OpCode command, int left, int right, int *result) {
+    switch (command) {
+    case IntAddCode:
+        *result = (int)((unsigned)left + (unsigned)right);
+        return 1;
+    case IntSubtractCode:
+        *result = (int)((unsigned)left - (unsigned)right);
+        return 1;
+    case IntMultiplyCode:
+        *result = (int)((unsigned)left * (unsigned)right);
+        return 1;
+    case IntDivideCode:
+    case IntModCode:
+        if (right == 0 || (left == INT_MIN && right == -1)) {
+            return 0;
+        }
+        *result = command == IntDivideCode ? left / right : left % right;
+        return 1;
+    case IntEqCode:
+        *result = left == right;
+        return 1;
+    case IntNotEqCode:
+        *result = left != right;
+        return 1;
+    case IntLtCode:
+        *result = left < right;
+        return 1;
+    case IntGtCode:
+        *result = left > right;
+        return 1;
+    case IntLtECode:
+        *result = left <= right;
+        return 1;
+    case IntGtECode:
+        *result = left >= right;
+        return 1;
+    case BoolAndCode:
+        *result = left && right;
+        return 1;
+    case BoolOrCode:
+        *result = left || right;
+        return 1;
+    default:
+        return 0;
     }
-    VarPositions *scope = &(memory[var_scope]);
-    var_positions_set(scope, var_name, position);
 }
 
-void memory_load(VarPositions *memory, int memory_size, char *var_name, int var_scope, int *position) {
-    if (var_scope == -1) {
-        for (int i = memory_size - 1; i >= 0; i--) {
-            VarPositions *scope = &(memory[i]);
-            int err = var_positions_get(scope, var_name, position);
-            if (err) {
-                continue;
-            }
-            break;
+// 1 for a slot of the current frame, 0 for a top-level variable used inside a function
+static int var_slot_get(CompileCache *cache, AstIndex decl, int *slot) {
+    Declaration *declaration = &cache->ast->decls[decl];
+    *slot = declaration->slot;
+    if (declaration->depth == cache->fn_depth) {
+        return 1;
+    }
+    if (declaration->depth == 0) {
+        return 0;
+    }
+    printf("Variables of an enclosing function can't be accessed\n");
+    cache->has_error = 1;
+    return -1;
+}
+
+// the slot of a variable of the current frame, -1 for anything else
+static int local_slot_get(CompileCache *cache, AstIndex decl) {
+    Declaration *declaration = &cache->ast->decls[decl];
+    return declaration->depth == cache->fn_depth ? declaration->slot : -1;
+}
+
+// returns 1 and the value if the expression is an int or bool known at compile time
+static int fold_expression(Expression *exp, CompileCache *cache, int *value) {
+    if (exp->type != ExpExp) {
+        return 0;
+    }
+    Token *token = ast_token(cache->ast, exp->token);
+    switch (token->ttype) {
+    case Number:
+        *value = token->number;
+        return 1;
+    case True:
+    case False:
+        *value = token->ttype == True;
+        return 1;
+    case Identifier:
+        // known values are indexed by slots of the current frame
+        return known_value_get(cache, local_slot_get(cache, exp->decl), value);
+    case Not: {
+        int sub_value;
+        if (!fold_expression(ast_expression(cache->ast, exp->left), cache, &sub_value)) {
+            return 0;
         }
-        return;
+        *value = !sub_value;
+        return 1;
+    }
+    default: {
+        OpCode command;
+        int left;
+        int right;
+        if (!binary_command(token->ttype, &command)) {
+            return 0;
+        }
+        if (!fold_expression(ast_expression(cache->ast, exp->left), cache, &left) || !fold_expression(ast_expression(cache->ast, exp->right), cache, &right)) {
+            return 0;
+        }
+        return fold_binary(command, left, right, value);
+    }
     }
-    VarPositions *scope = &(memory[var_scope]);
-    var_positions_get(scope, var_name, position);
 }
 
-void memory_extend(CompileCache *cache) {
-    if (cache->memory_capacity <= cache->memory_size) {
-        cache->memory_capacity += 32;
-        VarPositions *new_memory = realloc(cache->memory, cache->memory_capacity * sizeof(VarPositions));
-        int *new_scope_starts = realloc(cache->scope_start_positions, cache->memory_capacity * sizeof(int));
-        cache->memory = new_memory;
-        cache->scope_start_positions = new_scope_starts;
+// the comparison a branch has to test, negated when the branch is taken on false
+static int branch_comparison(TokenType ttype, int jump_if, TokenType *comparison) {
+    switch (ttype) {
+    case EqEq:
+        *comparison = jump_if ? EqEq : NotEq;
+        return 1;
+    case NotEq:
+        *comparison = jump_if ? NotEq : EqEq;
+        return 1;
+    case Lt:
+        *comparison = jump_if ? Lt : GtE;
+        return 1;
+    case Gt:
+        *comparison = jump_if ? Gt : LtE;
+        return 1;
+    case LtE:
+        *comparison = jump_if ? LtE : Gt;
+        return 1;
+    case GtE:
+        *comparison = jump_if ? GtE : Lt;
+        return 1;
+    default:
+        return 0;
     }
-    VarPositions new_scope;
-    var_positions_init(&new_scope);
-    cache->memory[cache->memory_size] = new_scope;
-    cache->scope_start_positions[cache->memory_size] = cache->stack_index;
-    cache->memory_size++;
 }
 
-void memory_shrink(CompileCache *cache) {
-    cache->memory_size--;
-    cache->stack_index = cache->scope_start_positions[cache->memory_size];
-    var_positions_destroy(&cache->memory[cache->memory_size]);
+// picks the fused compare-and-branch for "local <ttype> imm", inverted when the branch is taken on false
+static int local_branch_command(TokenType ttype, int jump_if, OpCode *command) {
+    if (!branch_comparison(ttype, jump_if, &ttype)) {
+        return 0;
+    }
+    switch (ttype) {
+    case EqEq:
+        *command = GotoIfLocalEqCode;
+        return 1;
+    case NotEq:
+        *command = GotoIfLocalNotEqCode;
+        return 1;
+    case Lt:
+        *command = GotoIfLocalLtCode;
+        return 1;
+    case Gt:
+        *command = GotoIfLocalGtCode;
+        return 1;
+    case LtE:
+        *command = GotoIfLocalLtECode;
+        return 1;
+    case GtE:
+        *command = GotoIfLocalGtECode;
+        return 1;
+    default:
+        return 0;
+    }
 }
 
-static void add_command(CompileCache *cache, OpCode command) {
-    cache->program_size++;
-    OpCode *new_commands = realloc(cache->commands, cache->program_size * sizeof(OpCode));
-    new_commands[cache->program_size - 1] = command;
-    cache->commands = new_commands;
+// swaps the sides of a comparison, so "imm < local" can be handled as "local > imm"
+static TokenType mirror_comparison(TokenType ttype) {
+    switch (ttype) {
+    case Lt:
+        return Gt;
+    case Gt:
+        return Lt;
+    case LtE:
+        return GtE;
+    case GtE:
+        return LtE;
+    default:
+        return ttype;
+    }
+}
+
+// emits a jump to label taken when the condition evaluates to jump_if, so the other outcome falls through;
+// a local compared with a small constant becomes a single instruction that doesn't touch the stack
+static void compile_branch(Expression *condition, int jump_if, int label, CompileCache *cache) {
+    if (condition->type == ExpExp) {
+        TokenType ttype = ast_token(cache->ast, condition->token)->ttype;
+        if (ttype == Not) {
+            compile_branch(ast_expression(cache->ast, condition->left), !jump_if, label, cache);
+            return;
+        }
+        Expression *local = ast_expression(cache->ast, condition->left);
+        Expression *other = ast_expression(cache->ast, condition->right);
+        int value;
+        if (other != NULL && other->type == ExpExp && ast_token(cache->ast, other->token)->ttype == Identifier) {
+            local = ast_expression(cache->ast, condition->right);
+            other = ast_expression(cache->ast, condition->left);
+            ttype = mirror_comparison(ttype);
+        }
+        OpCode command;
+        if (other != NULL && local->type == ExpExp && ast_token(cache->ast, local->token)->ttype == Identifier && !fold_expression(local, cache, &value) &&
+            fold_expression(other, cache, &value) && value >= INT16_MIN && value <= INT16_MAX && local_branch_command(ttype, jump_if, &command)) {
+            int slot = local_slot_get(cache, local->decl);
+            if (slot >= 0 && slot <= UINT8_MAX) {
+                add_fused_command(cache, command, slot, value, label);
+                return;
+            }
+        }
+    }
+    compile_expression(condition, cache);
+    add_jump(cache, jump_if ? GotoIfCode : GotoIfNotCode, label);
+    cache->temp_depth--;
 }
 
-static void add_constant(CompileCache *cache, Constant constant) {
-    Constant *new_args = realloc(cache->args, cache->program_size * sizeof(Constant));
-    new_args[cache->program_size - 1] = constant;
-    cache->args = new_args;
+// the constant "x += c", "x -= c", "x++" and "x--" add to x, these are done in place on the local
+static int local_add_value(Assignment *ass, CompileCache *cache, int *value) {
+    Expression *exp = ast_expression(cache->ast, ass->exp);
+    switch (ast_token(cache->ast, ass->op)->ttype) {
+    case Inc:
+        *value = 1;
+        return 1;
+    case Dec:
+        *value = -1;
+        return 1;
+    case PlusEq:
+        return fold_expression(exp, cache, value);
+    case MinusEq:
+        if (!fold_expression(exp, cache, value)) {
+            return 0;
+        }
+        *value = (int)(0u - (unsigned)*value);
+        return 1;
+    default:
+        return 0;
+    }
 }
 
-static void compile_call(Call *call, CompileCache *cache) {
-    int fn_def_index;
-    char *fn_name = substring(cache->source, call->call_name->start, call->call_name->end);
-    memory_load(cache->memory, cache->memory_size, fn_name, call->scope, &fn_def_index);
-    free(fn_name);
+// the instruction index a function starts at
+static int fn_index_get(Expression *call, CompileCache *cache) { return cache->fn_positions[call->decl]; }
+
+static void compile_call(Expression *call, CompileCache *cache) {
+    int fn_def_index = fn_index_get(call, cache);
+    if (call->args.size > INT16_MAX) {
+        printf("Too many arguments in a call\n");
+        cache->has_error = 1;
+        return;
+    }
 
-    for (int i = 0; i < call->args_size; i++) {
-        compile_expression(call->args + i, cache);
+    for (int i = 0; i < call->args.size; i++) {
+        compile_expression(ast_arg(cache->ast, call, i), cache);
     }
 
-    Constant call_index = {.int_data = fn_def_index};
-    add_command(cache, CallCode);
-    add_constant(cache, call_index);
+    add_fused_command(cache, CallCode, 0, call->args.size, fn_def_index);
+    known_values_clear(cache); // the callee may have written to any variable visible to it
+    cache->temp_depth -= call->args.size;
     if (call->datatype->type != Simple || call->datatype->data.simple_datatype != Void) {
-        cache->stack_index++;
+        temp_push(cache);
     }
-    cache->stack_index -= call->args_size;
 }
 
 static void compile_expression(Expression *exp, CompileCache *cache) {
     if (exp->type == FnCallExp) {
-        compile_call(exp->data.fn_call, cache);
+        compile_call(exp, cache);
         return;
     }
 
     // Temporary, for now cannot assign functions
-    if (exp->data.exp->datatype->type != Simple) {
+    if (exp->datatype->type != Simple) {
         printf("Illegal expression type\n");
         cache->has_error = 1;
         return;
     }
 
-    OpExpression *op_exp = exp->data.exp;
-    switch (op_exp->token->ttype) {
-    case Number: {
-        char *str_value = substring(cache->source, op_exp->token->start, op_exp->token->end);
-        int int_value = atoi(str_value);
-        Constant constant = {.int_data = int_value};
-        add_command(cache, PushCode);
-        add_constant(cache, constant);
-        cache->stack_index++;
-        free(str_value);
-        break;
+    int folded_value;
+    if (fold_expression(exp, cache, &folded_value)) {
+        add_command(cache, PushCode, folded_value);
+        temp_push(cache);
+        return;
     }
+
+    Token *token = ast_token(cache->ast, exp->token);
+    Expression *left = ast_expression(cache->ast, exp->left);
+    Expression *right = ast_expression(cache->ast, exp->right);
+    switch (token->ttype) {
+    case Number:
+        add_command(cache, PushCode, token->number);
+        temp_push(cache);
+        break;
     case Text: {
-        char *value = substring(cache->source, op_exp->token->start, op_exp->token->end);
+        char *value = substring(cache->source, token->start, token->end);
         Constant constant = {.string_data = value};
-        add_command(cache, PushCode);
-        add_constant(cache, constant);
-        cache->stack_index++;
+        add_command(cache, PushConstCode, add_constant(cache, constant));
+        temp_push(cache);
         break;
     }
     case True:
     case False: {
-        int bool_value = op_exp->token->ttype == True;
-        Constant constant = {.int_data = bool_value};
-        add_command(cache, PushCode);
-        add_constant(cache, constant);
-        cache->stack_index++;
+        int bool_value = token->ttype == True;
+        add_command(cache, PushCode, bool_value);
+        temp_push(cache);
         break;
     }
     case Not: {
-        compile_expression(op_exp->left, cache);
+        compile_expression(left, cache);
         if (cache->has_error) {
             return;
         }
-        add_command(cache, BoolNotCode);
+        add_command(cache, BoolNotCode, 0);
         break;
     }
     case Identifier: {
-        int var_position;
-        char *var_name = substring(cache->source, op_exp->token->start, op_exp->token->end);
-        memory_load(cache->memory, cache->memory_size, var_name, op_exp->scope, &var_position);
-        Constant constant = {.int_data = cache->stack_index - var_position};
-        add_command(cache, LoadCode);
-        add_constant(cache, constant);
-        cache->stack_index++;
-        free(var_name);
+        int slot;
+        int is_local = var_slot_get(cache, exp->decl, &slot);
+        add_command(cache, is_local ? LoadCode : LoadGlobalCode, slot);
+        temp_push(cache);
         break;
     }
     case Plus:
@@ -227,61 +594,31 @@ static void compile_expression(Expression *exp, CompileCache *cache) {
     case Gt:
     case LtE:
     case GtE: {
-        compile_expression(op_exp->left, cache);
-        if (cache->has_error) {
-            return;
+        OpCode command;
+        binary_command(token->ttype, &command);
+        // both operands are always evaluated, so "true && x" and "false || x" are just x
+        int side_value;
+        if (command == BoolAndCode || command == BoolOrCode) {
+            int identity = command == BoolAndCode;
+            if (fold_expression(left, cache, &side_value) && side_value == identity) {
+                compile_expression(right, cache);
+                break;
+            }
+            if (fold_expression(right, cache, &side_value) && side_value == identity) {
+                compile_expression(left, cache);
+                break;
+            }
         }
-        compile_expression(op_exp->right, cache);
+        compile_expression(left, cache);
         if (cache->has_error) {
             return;
         }
-        OpCode command;
-        switch (op_exp->token->ttype) {
-        case Plus:
-            command = IntAddCode;
-            break;
-        case Minus:
-            command = IntSubtractCode;
-            break;
-        case Star:
-            command = IntMultiplyCode;
-            break;
-        case Slash:
-            command = IntDivideCode;
-            break;
-        case Mod:
-            command = IntModCode;
-            break;
-        case EqEq:
-            command = IntEqCode;
-            break;
-        case NotEq:
-            command = IntNotEqCode;
-            break;
-        case Lt:
-            command = IntLtCode;
-            break;
-        case Gt:
-            command = IntGtCode;
-            break;
-        case LtE:
-            command = IntLtECode;
-            break;
-        case GtE:
-            command = IntGtECode;
-            break;
-        case And:
-            command = BoolAndCode;
-            break;
-        case Or:
-            command = BoolOrCode;
-            break;
-        default:
-            printf("Illegal binary operator\n");
+        compile_expression(right, cache);
+        if (cache->has_error) {
             return;
         }
-        add_command(cache, command);
-        cache->stack_index--;
+        add_command(cache, command, 0);
+        cache->temp_depth--;
         break;
     }
     default: {
@@ -295,28 +632,21 @@ static void compile_expression(Expression *exp, CompileCache *cache) {
 static void compile_oneliner(Oneliner *oneliner, CompileCache *cache) {
     switch (oneliner->type) {
     case PrintlnOL: {
-        compile_expression(oneliner->data.println->exp, cache);
-        DataType simple_dt;
-        switch (oneliner->data.println->exp->type) {
-        case ExpExp:
-            simple_dt = oneliner->data.println->exp->data.exp->datatype->data.simple_datatype;
-            break;
-        case FnCallExp:
-            simple_dt = oneliner->data.println->exp->data.fn_call->datatype->data.simple_datatype;
-            break;
-        }
+        Expression *exp = ast_expression(cache->ast, oneliner->index);
+        compile_expression(exp, cache);
+        DataType simple_dt = exp->datatype->data.simple_datatype;
         switch (simple_dt) {
         case Int:
-            add_command(cache, PrintlnIntCode);
-            cache->stack_index--;
+            add_command(cache, PrintlnIntCode, 0);
+            cache->temp_depth--;
             break;
         case Bool:
-            add_command(cache, PrintlnBoolCode);
-            cache->stack_index--;
+            add_command(cache, PrintlnBoolCode, 0);
+            cache->temp_depth--;
             break;
         case String:
-            add_command(cache, PrintlnStrCode);
-            cache->stack_index--;
+            add_command(cache, PrintlnStrCode, 0);
+            cache->temp_depth--;
             break;
         default:
             printf("Invalid type for println\n");
@@ -326,275 +656,794 @@ static void compile_oneliner(Oneliner *oneliner, CompileCache *cache) {
         break;
     }
     case AssignmentOL: {
-        Assignment *ass = oneliner->data.assignment;
-        if (ass->exp != NULL) {
+        Assignment *ass = &cache->ast->assignments[oneliner->index];
+        TokenType op = ast_token(cache->ast, ass->op)->ttype;
+        Expression *exp = ast_expression(cache->ast, ass->exp);
+        int slot = -1;
+        int is_local = 1;
+        if (!ass->new_var) {
+            is_local = var_slot_get(cache, ass->decl, &slot);
+            if (is_local < 0) {
+                return;
+            }
         }
-        OpCode command;
-        switch (ass->op->ttype) {
+        int known_position = is_local ? slot : -1;
+        int known_result = 0;
+        int result_value;
+        switch (op) {
         case ColEq:
-        case Eq: {
-            compile_expression(ass->exp, cache);
-            if (cache->has_error) {
-                return;
+        case Eq:
+            known_result = fold_expression(exp, cache, &result_value);
+            break;
+        default: {
+            OpCode command;
+            int var_value;
+            int exp_value = 1;
+            binary_command(op, &command);
+            if (known_value_get(cache, known_position, &var_value) && (exp == NULL || fold_expression(exp, cache, &exp_value))) {
+                known_result = fold_binary(command, var_value, exp_value, &result_value);
             }
             break;
         }
-        case PlusEq:
-        case MinusEq:
-        case StarEq:
-        case SlashEq:
-        case ModEq:
-        case Inc:
-        case Dec: {
-            int var_position;
-            char *var_name = substring(cache->source, ass->var->start, ass->var->end);
-            memory_load(cache->memory, cache->memory_size, var_name, ass->scope, &var_position);
-            Constant offset = {.int_data = cache->stack_index - var_position};
-            add_command(cache, LoadCode);
-            add_constant(cache, offset);
-            cache->stack_index++;
-            free(var_name);
-
-            switch (ass->op->ttype) {
-            case Inc:
-            case Dec: {
-                Constant exp_value = {.int_data = 1};
-                add_command(cache, PushCode);
-                add_constant(cache, exp_value);
-                cache->stack_index++;
-                break;
-            }
-            default:
-                compile_expression(ass->exp, cache);
+        }
+
+        int add_value;
+        if (!known_result && !ass->new_var && is_local && slot <= UINT8_MAX && local_add_value(ass, cache, &add_value)) {
+            add_fused_command(cache, AddLocalCode, slot, 0, add_value);
+            known_value_forget(cache, slot);
+            break;
+        }
+
+        if (known_result) {
+            add_command(cache, PushCode, result_value);
+            temp_push(cache);
+        } else {
+            switch (op) {
+            case ColEq:
+            case Eq: {
+                compile_expression(exp, cache);
+                if (cache->has_error) {
+                    return;
+                }
                 break;
             }
-
-            OpCode command;
-            switch (ass->op->ttype) {
-            case Inc:
             case PlusEq:
-                command = IntAddCode;
-                break;
-            case Dec:
             case MinusEq:
-                command = IntSubtractCode;
-                break;
             case StarEq:
-                command = IntMultiplyCode;
-                break;
             case SlashEq:
-                command = IntDivideCode;
+            case ModEq:
+            case Inc:
+            case Dec: {
+                add_command(cache, is_local ? LoadCode : LoadGlobalCode, slot);
+                temp_push(cache);
+
+                switch (op) {
+                case Inc:
+                case Dec: {
+                    add_command(cache, PushCode, 1);
+                    temp_push(cache);
+                    break;
+                }
+                default:
+                    compile_expression(exp, cache);
+                    break;
+                }
+
+                OpCode command;
+                binary_command(op, &command);
+                add_command(cache, command, 0);
+                cache->temp_depth--;
                 break;
+            }
             default:
-                command = IntModCode;
-                break;
+                printf("Illegal assignment operator\n");
+                return;
             }
-            add_command(cache, command);
-            cache->stack_index--;
-            break;
         }
-        default:
-            printf("Illegal assignment operator\n");
-            return;
-        }
-        Constant offset;
-        char *var_name = substring(cache->source, ass->var->start, ass->var->end);
         if (ass->new_var) {
-            offset.int_data = 0;
-        } else {
-            int var_position;
-            memory_load(cache->memory, cache->memory_size, var_name, ass->scope, &var_position);
-            offset.int_data = cache->stack_index - var_position;
+            slot = var_declare(cache, ass->decl);
+            known_position = slot;
         }
-        if (!ass->new_var) {
-            add_command(cache, StoreCode);
-            add_constant(cache, offset);
-            cache->stack_index--;
-            free(var_name);
+        add_command(cache, is_local ? StoreCode : StoreGlobalCode, slot);
+        cache->temp_depth--;
+        if (known_result) {
+            known_value_set(cache, known_position, result_value);
         } else {
-            memory_store(cache->memory, cache->memory_size, var_name, ass->scope, cache->stack_index);
+            known_value_forget(cache, known_position);
         }
         break;
     }
     case CallOL: {
-        Call *call = oneliner->data.call;
-        compile_call(call, cache);
+        compile_call(ast_expression(cache->ast, oneliner->index), cache);
         break;
     }
     }
 }
 
-void compile_program(Stmt *stmts, int stmts_size, CompileCache *cache) {
-    if (stmts_size == 0) {
+void compile_program(AstList stmts, CompileCache *cache) {
+    if (stmts.size == 0) {
         return;
     }
+    compile_cache_reserve(cache, ast_node_count(cache->ast) + 2);
+    cache->fn_positions = arena_alloc(cache->arena, (cache->ast->decls_size + 1) * sizeof(int));
     memory_extend(cache);
-    compile_to_bytecode(stmts, stmts_size, 0, cache);
-    add_command(cache, EndCode);
+    add_command(cache, EnterCode, 0);
+    compile_to_bytecode(stmts, 0, cache);
+    add_command(cache, EndCode, 0);
+    cache->program[0].arg = cache->frame_size;
+    frame_finish(cache);
     memory_shrink(cache);
+    resolve_labels(cache);
 }
 
-void compile_to_bytecode(Stmt *stmts, int stmts_size, int does_wrap, CompileCache *cache) {
-    if (stmts_size == 0) {
+void compile_to_bytecode(AstList stmts, int does_wrap, CompileCache *cache) {
+    if (stmts.size == 0) {
         return;
     }
     if (does_wrap) {
         memory_extend(cache);
     }
-    for (int stmt_i = 0; stmt_i < stmts_size; stmt_i++) {
-        Stmt *stmt = &stmts[stmt_i];
+    for (int stmt_i = 0; stmt_i < stmts.size; stmt_i++) {
+        Stmt *stmt = ast_stmt(cache->ast, stmts, stmt_i);
         switch (stmt->type) {
         case OnelinerStmt: {
-            Oneliner *oneliner = stmt->data.oneliner;
-            compile_oneliner(oneliner, cache);
+            compile_oneliner(&cache->ast->oneliners[stmt->index], cache);
             break;
         }
         case OpenScopeStmt:
             memory_extend(cache);
             break;
-        case CloseScopeStmt: {
-            Constant shift_to = {.int_data = cache->scope_start_positions[cache->memory_size - 1]};
-            add_command(cache, ShiftStackCode);
-            add_constant(cache, shift_to);
+        case CloseScopeStmt:
             memory_shrink(cache);
             break;
-        }
         case ConditionalStmt: {
-            Conditional *conditional = stmt->data.conditional;
-            Expression *condition = conditional->condition;
-            int start_index = cache->program_size;
-            compile_expression(condition, cache);
-            if (conditional->token->ttype == If) {
-                Constant goto_then_arg = {.int_data = cache->program_size + 2};
-                add_command(cache, GotoIfCode);
-                add_constant(cache, goto_then_arg);
-                cache->stack_index--;
-                Constant goto_else_arg = {.int_data = -1};
-                int goto_else_arg_index = cache->program_size;
-                add_command(cache, GotoCode);
-                add_constant(cache, goto_else_arg);
-                if (conditional->then_size) {
-                    compile_to_bytecode(conditional->then_block, conditional->then_size, 1, cache);
+            Conditional *conditional = &cache->ast->conditionals[stmt->index];
+            TokenType keyword = ast_token(cache->ast, stmt->token)->ttype;
+            Expression *condition = ast_expression(cache->ast, conditional->condition);
+            int condition_value;
+            // prune branches decided at compile time, a while loop whose condition is false up front only runs its else block
+            if (fold_expression(condition, cache, &condition_value) && (keyword == If || !condition_value)) {
+                if (condition_value && conditional->then_block.size) {
+                    compile_to_bytecode(conditional->then_block, 1, cache);
+                } else if (!condition_value && conditional->else_block.size) {
+                    compile_to_bytecode(conditional->else_block, 1, cache);
+                }
+                break;
+            }
+            if (keyword == If) {
+                int else_label = label_create(cache);
+                int end_label = label_create(cache);
+                compile_branch(condition, 0, else_label, cache);
+                if (conditional->then_block.size) {
+                    compile_to_bytecode(conditional->then_block, 1, cache);
+                }
+                if (conditional->else_block.size) {
+                    add_jump(cache, GotoCode, end_label);
                 }
-                Constant goto_end_arg = {.int_data = -1};
-                int goto_end_arg_index = cache->program_size;
-                add_command(cache, GotoCode);
-                add_constant(cache, goto_end_arg);
-                (cache->args)[goto_else_arg_index].int_data = cache->program_size;
-                if (conditional->else_size) {
-                    compile_to_bytecode(conditional->else_block, conditional->else_size, 1, cache);
+                label_bind(cache, else_label);
+                if (conditional->else_block.size) {
+                    compile_to_bytecode(conditional->else_block, 1, cache);
                 }
-                (cache->args)[goto_end_arg_index].int_data = cache->program_size;
+                label_bind(cache, end_label);
             } else {
-                Constant goto_then_arg = {.int_data = -1};
-                int goto_then_arg_index = cache->program_size;
-                add_command(cache, GotoIfCode);
-                add_constant(cache, goto_then_arg);
-                cache->stack_index--;
-                Constant goto_else_arg = {.int_data = -1};
-                int goto_else_arg_index = cache->program_size;
-                add_command(cache, GotoCode);
-                add_constant(cache, goto_else_arg);
-                int start_command_index = cache->program_size;
-                compile_expression(condition, cache);
-                goto_then_arg.int_data = cache->program_size + 2;
-                add_command(cache, GotoIfCode);
-                add_constant(cache, goto_then_arg);
-                cache->stack_index--;
-                Constant goto_end_arg = {.int_data = -1};
-                int goto_end_arg_index = cache->program_size;
-                add_command(cache, GotoCode);
-                add_constant(cache, goto_end_arg);
-                (cache->args)[goto_then_arg_index].int_data = cache->program_size;
-                if (conditional->then_size) {
-                    compile_to_bytecode(conditional->then_block, conditional->then_size, 1, cache);
+                // the condition is checked once on entry, where failing runs the else block,
+                // and then at the bottom of the body, so every iteration takes a single branch
+                int body_label = label_create(cache);
+                int else_label = label_create(cache);
+                int end_label = label_create(cache);
+                if (!fold_expression(condition, cache, &condition_value)) {
+                    compile_branch(condition, 0, else_label, cache);
                 }
-                Constant goto_start_arg = {.int_data = start_command_index};
-                add_command(cache, GotoCode);
-                add_constant(cache, goto_start_arg);
-                (cache->args)[goto_else_arg_index].int_data = cache->program_size;
-                if (conditional->else_size) {
-                    compile_to_bytecode(conditional->else_block, conditional->else_size, 1, cache);
+                label_bind(cache, body_label);
+                if (conditional->then_block.size) {
+                    compile_to_bytecode(conditional->then_block, 1, cache);
                 }
-                (cache->args)[goto_end_arg_index].int_data = cache->program_size;
+                compile_branch(condition, 1, body_label, cache);
+                if (conditional->else_block.size) {
+                    add_jump(cache, GotoCode, end_label);
+                }
+                label_bind(cache, else_label);
+                if (conditional->else_block.size) {
+                    compile_to_bytecode(conditional->else_block, 1, cache);
+                }
+                label_bind(cache, end_label);
             }
             break;
         }
         case ForStmt: {
-            ForLoop *for_loop = stmt->data.for_loop;
-            Oneliner *init = for_loop->init;
-            Expression *condition = for_loop->condition;
-            Oneliner *after = for_loop->after;
-            Stmt *body = for_loop->body;
-            int body_size = for_loop->body_size;
+            ForLoop *for_loop = &cache->ast->for_loops[stmt->index];
+            Oneliner *init = &cache->ast->oneliners[for_loop->init];
+            Expression *condition = ast_expression(cache->ast, for_loop->condition);
+            Oneliner *after = &cache->ast->oneliners[for_loop->after];
 
             memory_extend(cache);
             compile_oneliner(init, cache);
-            int start_command_index = cache->program_size;
-            compile_expression(condition, cache);
-            Constant goto_then_arg = {.int_data = cache->program_size + 2};
-            add_command(cache, GotoIfCode);
-            add_constant(cache, goto_then_arg);
-            cache->stack_index--;
-            Constant goto_end_arg = {.int_data = -1};
-            int goto_end_arg_index = cache->program_size;
-            add_command(cache, GotoCode);
-            add_constant(cache, goto_end_arg);
-            if (body_size) {
-                compile_to_bytecode(body, body_size, 1, cache);
+            int condition_value;
+            if (fold_expression(condition, cache, &condition_value) && !condition_value) {
+                memory_shrink(cache);
+                break;
+            }
+            // rotated like the while loop, and the entry check is dropped when init already decides it
+            int body_label = label_create(cache);
+            int end_label = label_create(cache);
+            if (!fold_expression(condition, cache, &condition_value)) {
+                compile_branch(condition, 0, end_label, cache);
+            }
+            label_bind(cache, body_label);
+            if (for_loop->body.size) {
+                compile_to_bytecode(for_loop->body, 1, cache);
             }
             compile_oneliner(after, cache);
-            Constant goto_start_arg = {.int_data = start_command_index};
-            add_command(cache, GotoCode);
-            add_constant(cache, goto_start_arg);
+            compile_branch(condition, 1, body_label, cache);
+
+            label_bind(cache, end_label);
+            memory_shrink(cache);
+            break;
+        }
+        case FnStmt: {
+            int skip_label = label_create(cache);
+            add_jump(cache, GotoCode, skip_label);
+
+            FnDefinition *fn_def = &cache->ast->fn_defs[stmt->index];
+            cache->fn_positions[fn_def->decl] = cache->program_size;
+
+            memory_extend(cache);
+            known_values_clear(cache);
+            FrameState outer = frame_enter(cache);
+            int enter_index = cache->program_size;
+            add_command(cache, EnterCode, 0);
+            for (int i = 0; i < fn_def->datatype->params_size; i++) {
+                stack_index_increment(cache);
+            }
+            compile_to_bytecode(fn_def->body, 0, cache);
+            add_command(cache, ResumeCode, 0);
+            cache->program[enter_index].arg = cache->frame_size;
+            frame_leave(cache, outer);
+            memory_shrink(cache);
+            label_bind(cache, skip_label);
+            break;
+        }
+        case ReturnStmt: {
+            Expression *exp = ast_expression(cache->ast, stmt->index);
+            if (exp == NULL) {
+                add_command(cache, ResumeCode, 0);
+                break;
+            }
+            // "return f(x);" replaces the current call instead of nesting in it
+            if (exp->type == FnCallExp && exp->args.size <= INT16_MAX) {
+                int fn_def_index = fn_index_get(exp, cache);
+                for (int i = 0; i < exp->args.size; i++) {
+                    compile_expression(ast_arg(cache->ast, exp, i), cache);
+                }
+                add_fused_command(cache, TailCallCode, 0, exp->args.size, fn_def_index);
+                cache->temp_depth -= exp->args.size;
+                break;
+            }
+            compile_expression(exp, cache);
+            add_command(cache, ReturnCode, 0);
+            cache->temp_depth--;
+            break;
+        }
+        default:
+            printf("Illegal statement\n");
+            return;
+        }
+    }
+    if (does_wrap) {
+        memory_shrink(cache);
+    }
+}
+
+// Register backend. It compiles the same AST into RegInstruction, where every variable and temporary is a slot relative
+// to the frame base: variables are used in place instead of being loaded, and slots of closed scopes are reused.
+// Functions get their own frames with parameters in the first slots, top-level variables are reached from inside
+// them through RegGetGlobalCode/RegSetGlobalCode.
+
+static void reg_program_reserve(CompileCache *cache, int capacity) {
+    if (cache->reg_program_capacity >= capacity) {
+        return;
+    }
+    RegInstruction *new_program = realloc(cache->reg_program, capacity * sizeof(RegInstruction));
+    cache->reg_program = new_program;
+    cache->reg_program_capacity = capacity;
+}
+
+static void add_reg_command(CompileCache *cache, RegOpCode command, int a, int b, int c) {
+    if (cache->reg_program_capacity <= cache->reg_program_size) {
+        reg_program_reserve(cache, cache->reg_program_capacity ? cache->reg_program_capacity * 2 : 256);
+    }
+    RegInstruction instruction = {.code = command, .a = a, .b = b, .c = c};
+    cache->reg_program[cache->reg_program_size] = instruction;
+    cache->reg_program_size++;
+}
+
+static void reg_label_bind(CompileCache *cache, int label) {
+    cache->labels[label] = cache->reg_program_size;
+    known_values_clear(cache);
+}
+
+static void resolve_reg_labels(CompileCache *cache) {
+    for (int i = 0; i < cache->reg_program_size; i++) {
+        if (reg_bytecode_is_jump(cache->reg_program[i].code)) {
+            cache->reg_program[i].c = cache->labels[cache->reg_program[i].c];
+        }
+    }
+    cache->labels = NULL;
+    cache->labels_size = 0;
+    cache->labels_capacity = 0;
+}
+
+static int reg_temp(CompileCache *cache) {
+    stack_index_increment(cache);
+    return cache->stack_index;
+}
+
+static int reg_move(CompileCache *cache, int dst, int src) {
+    if (dst < 0 || dst == src) {
+        return src;
+    }
+    add_reg_command(cache, RegMoveCode, dst, src, 0);
+    return dst;
+}
+
+static int expression_has_call(Expression *exp, CompileCache *cache) {
+    if (exp == NULL) {
+        return 0;
+    }
+    if (exp->type == FnCallExp) {
+        return 1;
+    }
+    return expression_has_call(ast_expression(cache->ast, exp->left), cache) || expression_has_call(ast_expression(cache->ast, exp->right), cache);
+}
+
+static RegOpCode reg_binary_command(OpCode command) {
+    switch (command) {
+    case IntAddCode:
+        return RegIntAddCode;
+    case IntSubtractCode:
+        return RegIntSubtractCode;
+    case IntMultiplyCode:
+        return RegIntMultiplyCode;
+    case IntDivideCode:
+        return RegIntDivideCode;
+    case IntModCode:
+        return RegIntModCode;
+    case IntEqCode:
+        return RegIntEqCode;
+    case IntNotEqCode:
+        return RegIntNotEqCode;
+    case IntGtCode:
+        return RegIntGtCode;
+    case IntLtCode:
+        return RegIntLtCode;
+    case IntGtECode:
+        return RegIntGtECode;
+    case IntLtECode:
+        return RegIntLtECode;
+    case BoolAndCode:
+        return RegBoolAndCode;
+    default:
+        return RegBoolOrCode;
+    }
+}
+
+static RegOpCode reg_branch_command(TokenType comparison, int with_imm) {
+    switch (comparison) {
+    case EqEq:
+        return with_imm ? RegGotoIfEqImmCode : RegGotoIfEqCode;
+    case NotEq:
+        return with_imm ? RegGotoIfNotEqImmCode : RegGotoIfNotEqCode;
+    case Lt:
+        return with_imm ? RegGotoIfLtImmCode : RegGotoIfLtCode;
+    case Gt:
+        return with_imm ? RegGotoIfGtImmCode : RegGotoIfGtCode;
+    case LtE:
+        return with_imm ? RegGotoIfLtEImmCode : RegGotoIfLtECode;
+    default:
+        return with_imm ? RegGotoIfGtEImmCode : RegGotoIfGtECode;
+    }
+}
+
+// the left operand has to be read before a call on the right side runs, which may assign to it
+static int reg_compile_left_operand(Expression *left, Expression *right, int mark, CompileCache *cache) {
+    int slot = reg_compile_expression(left, -1, cache);
+    if (slot <= mark && expression_has_call(right, cache)) {
+        slot = reg_move(cache, reg_temp(cache), slot);
+    }
+    return slot;
+}
+
+static int reg_compile_call(Expression *call, CompileCache *cache) {
+    int fn_def_index = fn_index_get(call, cache);
+
+    int base = cache->stack_index + 1;
+    for (int i = 0; i < call->args.size; i++) {
+        reg_compile_expression(ast_arg(cache->ast, call, i), reg_temp(cache), cache);
+    }
+    add_reg_command(cache, RegCallCode, fn_def_index, base, 0);
+    known_values_clear(cache);
+    cache->stack_index = base - 1;
+    if (call->datatype->type != Simple || call->datatype->data.simple_datatype != Void) {
+        reg_temp(cache);
+    }
+    return base;
+}
+
+// compiles the expression into dst and returns dst, or with dst of -1 returns whatever slot holds the result,
+// which is either a variable or a new temporary on top of the frame
+static int reg_compile_expression(Expression *exp, int dst, CompileCache *cache) {
+    int mark = cache->stack_index;
+    if (exp->type == FnCallExp) {
+        int result = reg_compile_call(exp, cache);
+        if (dst >= 0) {
+            cache->stack_index = mark;
+        }
+        return reg_move(cache, dst, result);
+    }
+
+    if (exp->datatype->type != Simple) {
+        printf("Illegal expression type\n");
+        cache->has_error = 1;
+        return 0;
+    }
+
+    int folded_value;
+    if (fold_expression(exp, cache, &folded_value)) {
+        int target = dst >= 0 ? dst : reg_temp(cache);
+        add_reg_command(cache, RegLoadIntCode, target, folded_value, 0);
+        return target;
+    }
+
+    Token *token = ast_token(cache->ast, exp->token);
+    Expression *left_exp = ast_expression(cache->ast, exp->left);
+    Expression *right_exp = ast_expression(cache->ast, exp->right);
+    switch (token->ttype) {
+    case Text: {
+        char *value = substring(cache->source, token->start, token->end);
+        Constant constant = {.string_data = value};
+        int target = dst >= 0 ? dst : reg_temp(cache);
+        add_reg_command(cache, RegLoadConstCode, target, add_constant(cache, constant), 0);
+        return target;
+    }
+    case Identifier: {
+        int slot;
+        int is_local = var_slot_get(cache, exp->decl, &slot);
+        if (is_local) {
+            return reg_move(cache, dst, slot);
+        }
+        int target = dst >= 0 ? dst : reg_temp(cache);
+        add_reg_command(cache, RegGetGlobalCode, target, slot, 0);
+        return target;
+    }
+    case Not: {
+        int operand = reg_compile_expression(left_exp, -1, cache);
+        cache->stack_index = mark;
+        int target = dst >= 0 ? dst : reg_temp(cache);
+        add_reg_command(cache, RegBoolNotCode, target, operand, 0);
+        return target;
+    }
+    case Plus:
+    case Minus:
+    case Star:
+    case Slash:
+    case Mod:
+    case EqEq:
+    case NotEq:
+    case And:
+    case Or:
+    case Lt:
+    case Gt:
+    case LtE:
+    case GtE: {
+        OpCode command;
+        binary_command(token->ttype, &command);
+        int side_value;
+        if (command == BoolAndCode || command == BoolOrCode) {
+            int identity = command == BoolAndCode;
+            if (fold_expression(left_exp, cache, &side_value) && side_value == identity) {
+                return reg_compile_expression(right_exp, dst, cache);
+            }
+            if (fold_expression(right_exp, cache, &side_value) && side_value == identity) {
+                return reg_compile_expression(left_exp, dst, cache);
+            }
+        }
+        // adding or subtracting a constant doesn't need a slot for it
+        if ((command == IntAddCode || command == IntSubtractCode) && fold_expression(right_exp, cache, &side_value)) {
+            int operand = reg_compile_expression(left_exp, -1, cache);
+            cache->stack_index = mark;
+            int target = dst >= 0 ? dst : reg_temp(cache);
+            int imm = command == IntAddCode ? side_value : (int)(0u - (unsigned)side_value);
+            add_reg_command(cache, RegIntAddImmCode, target, operand, imm);
+            return target;
+        }
+        if (command == IntAddCode && fold_expression(left_exp, cache, &side_value)) {
+            int operand = reg_compile_expression(right_exp, -1, cache);
+            cache->stack_index = mark;
+            int target = dst >= 0 ? dst : reg_temp(cache);
+            add_reg_command(cache, RegIntAddImmCode, target, operand, side_value);
+            return target;
+        }
+        int left = reg_compile_left_operand(left_exp, right_exp, mark, cache);
+        int right = reg_compile_expression(right_exp, -1, cache);
+        cache->stack_index = mark;
+        int target = dst >= 0 ? dst : reg_temp(cache);
+        add_reg_command(cache, reg_binary_command(command), target, left, right);
+        return target;
+    }
+    default: {
+        printf("Illegal operator in expression\n");
+        cache->has_error = 1;
+        return 0;
+    }
+    }
+}
 
-            (cache->args)[goto_end_arg_index].int_data = cache->program_size;
+// emits a jump to label taken when the condition evaluates to jump_if, comparisons branch on their operands directly
+static void reg_compile_branch(Expression *condition, int jump_if, int label, CompileCache *cache) {
+    int mark = cache->stack_index;
+    TokenType comparison;
+    if (condition->type == ExpExp && ast_token(cache->ast, condition->token)->ttype == Not) {
+        reg_compile_branch(ast_expression(cache->ast, condition->left), !jump_if, label, cache);
+        return;
+    }
+    if (condition->type == ExpExp && branch_comparison(ast_token(cache->ast, condition->token)->ttype, jump_if, &comparison)) {
+        Expression *left_exp = ast_expression(cache->ast, condition->left);
+        Expression *right_exp = ast_expression(cache->ast, condition->right);
+        int value;
+        if (fold_expression(right_exp, cache, &value)) {
+            int left = reg_compile_expression(left_exp, -1, cache);
+            add_reg_command(cache, reg_branch_command(comparison, 1), left, value, label);
+        } else if (fold_expression(left_exp, cache, &value)) {
+            int right = reg_compile_expression(right_exp, -1, cache);
+            add_reg_command(cache, reg_branch_command(mirror_comparison(comparison), 1), right, value, label);
+        } else {
+            int left = reg_compile_left_operand(left_exp, right_exp, mark, cache);
+            int right = reg_compile_expression(right_exp, -1, cache);
+            add_reg_command(cache, reg_branch_command(comparison, 0), left, right, label);
+        }
+        cache->stack_index = mark;
+        return;
+    }
+    int slot = reg_compile_expression(condition, -1, cache);
+    add_reg_command(cache, jump_if ? RegGotoIfCode : RegGotoIfNotCode, slot, 0, label);
+    cache->stack_index = mark;
+}
 
-            Constant shift_to = {.int_data = cache->scope_start_positions[cache->memory_size - 1]};
-            add_command(cache, ShiftStackCode);
-            add_constant(cache, shift_to);
+static void reg_compile_oneliner(Oneliner *oneliner, CompileCache *cache) {
+    int mark = cache->stack_index;
+    switch (oneliner->type) {
+    case PrintlnOL: {
+        Expression *exp = ast_expression(cache->ast, oneliner->index);
+        int slot = reg_compile_expression(exp, -1, cache);
+        DataType simple_dt = exp->datatype->data.simple_datatype;
+        switch (simple_dt) {
+        case Int:
+            add_reg_command(cache, RegPrintlnIntCode, slot, 0, 0);
+            break;
+        case Bool:
+            add_reg_command(cache, RegPrintlnBoolCode, slot, 0, 0);
+            break;
+        case String:
+            add_reg_command(cache, RegPrintlnStrCode, slot, 0, 0);
+            break;
+        default:
+            printf("Invalid type for println\n");
+            cache->has_error = 1;
+            break;
+        }
+        cache->stack_index = mark;
+        break;
+    }
+    case AssignmentOL: {
+        Assignment *ass = &cache->ast->assignments[oneliner->index];
+        TokenType op = ast_token(cache->ast, ass->op)->ttype;
+        Expression *exp = ast_expression(cache->ast, ass->exp);
+        int slot;
+        int is_local = 1;
+        if (ass->new_var) {
+            slot = var_declare(cache, ass->decl);
+        } else {
+            is_local = var_slot_get(cache, ass->decl, &slot);
+            if (is_local < 0) {
+                return;
+            }
+        }
+        int known_position = is_local ? slot : -1;
+        int known_result = 0;
+        int result_value;
+        switch (op) {
+        case ColEq:
+        case Eq:
+            known_result = fold_expression(exp, cache, &result_value);
+            break;
+        default: {
+            OpCode command;
+            int var_value;
+            int exp_value = 1;
+            binary_command(op, &command);
+            if (known_value_get(cache, known_position, &var_value) && (exp == NULL || fold_expression(exp, cache, &exp_value))) {
+                known_result = fold_binary(command, var_value, exp_value, &result_value);
+            }
+            break;
+        }
+        }
 
+        int target = is_local ? slot : reg_temp(cache);
+        int add_value;
+        if (known_result) {
+            add_reg_command(cache, RegLoadIntCode, target, result_value, 0);
+        } else if (op == ColEq || op == Eq) {
+            reg_compile_expression(exp, target, cache);
+        } else {
+            int current = target;
+            if (!is_local) {
+                add_reg_command(cache, RegGetGlobalCode, target, slot, 0);
+            } else if (expression_has_call(exp, cache)) {
+                current = reg_move(cache, reg_temp(cache), slot);
+            }
+            if (local_add_value(ass, cache, &add_value)) {
+                add_reg_command(cache, RegIntAddImmCode, target, current, add_value);
+            } else {
+                OpCode command;
+                binary_command(op, &command);
+                int operand = reg_compile_expression(exp, -1, cache);
+                add_reg_command(cache, reg_binary_command(command), target, current, operand);
+            }
+        }
+        if (!is_local) {
+            add_reg_command(cache, RegSetGlobalCode, slot, target, 0);
+        }
+        cache->stack_index = ass->new_var ? slot : mark;
+        if (known_result) {
+            known_value_set(cache, known_position, result_value);
+        } else {
+            known_value_forget(cache, known_position);
+        }
+        break;
+    }
+    case CallOL: {
+        reg_compile_call(ast_expression(cache->ast, oneliner->index), cache);
+        cache->stack_index = mark;
+        break;
+    }
+    }
+}
+
+void compile_reg_program(AstList stmts, CompileCache *cache) {
+    if (stmts.size == 0) {
+        return;
+    }
+    reg_program_reserve(cache, ast_node_count(cache->ast) + 1);
+    cache->fn_positions = arena_alloc(cache->arena, (cache->ast->decls_size + 1) * sizeof(int));
+    memory_extend(cache);
+    compile_to_reg_bytecode(stmts, 0, cache);
+    add_reg_command(cache, RegEndCode, 0, 0, 0);
+    frame_finish(cache);
+    memory_shrink(cache);
+    resolve_reg_labels(cache);
+}
+
+void compile_to_reg_bytecode(AstList stmts, int does_wrap, CompileCache *cache) {
+    if (stmts.size == 0) {
+        return;
+    }
+    if (does_wrap) {
+        memory_extend(cache);
+    }
+    for (int stmt_i = 0; stmt_i < stmts.size; stmt_i++) {
+        Stmt *stmt = ast_stmt(cache->ast, stmts, stmt_i);
+        switch (stmt->type) {
+        case OnelinerStmt:
+            reg_compile_oneliner(&cache->ast->oneliners[stmt->index], cache);
+            break;
+        case OpenScopeStmt:
+            memory_extend(cache);
+            break;
+        case CloseScopeStmt:
+            memory_shrink(cache);
+            break;
+        case ConditionalStmt: {
+            Conditional *conditional = &cache->ast->conditionals[stmt->index];
+            TokenType keyword = ast_token(cache->ast, stmt->token)->ttype;
+            Expression *condition = ast_expression(cache->ast, conditional->condition);
+            int condition_value;
+            if (fold_expression(condition, cache, &condition_value) && (keyword == If || !condition_value)) {
+                if (condition_value && conditional->then_block.size) {
+                    compile_to_reg_bytecode(conditional->then_block, 1, cache);
+                } else if (!condition_value && conditional->else_block.size) {
+                    compile_to_reg_bytecode(conditional->else_block, 1, cache);
+                }
+                break;
+            }
+            int body_label = label_create(cache);
+            int else_label = label_create(cache);
+            int end_label = label_create(cache);
+            if (keyword == If || !fold_expression(condition, cache, &condition_value)) {
+                reg_compile_branch(condition, 0, else_label, cache);
+            }
+            if (keyword == While) {
+                reg_label_bind(cache, body_label);
+            }
+            if (conditional->then_block.size) {
+                compile_to_reg_bytecode(conditional->then_block, 1, cache);
+            }
+            if (keyword == While) {
+                reg_compile_branch(condition, 1, body_label, cache);
+            }
+            if (conditional->else_block.size) {
+                add_reg_command(cache, RegGotoCode, 0, 0, end_label);
+            }
+            reg_label_bind(cache, else_label);
+            if (conditional->else_block.size) {
+                compile_to_reg_bytecode(conditional->else_block, 1, cache);
+            }
+            reg_label_bind(cache, end_label);
+            break;
+        }
+        case ForStmt: {
+            ForLoop *for_loop = &cache->ast->for_loops[stmt->index];
+            Expression *condition = ast_expression(cache->ast, for_loop->condition);
+            memory_extend(cache);
+            reg_compile_oneliner(&cache->ast->oneliners[for_loop->init], cache);
+            int condition_value;
+            if (fold_expression(condition, cache, &condition_value) && !condition_value) {
+                memory_shrink(cache);
+                break;
+            }
+            int body_label = label_create(cache);
+            int end_label = label_create(cache);
+            if (!fold_expression(condition, cache, &condition_value)) {
+                reg_compile_branch(condition, 0, end_label, cache);
+            }
+            reg_label_bind(cache, body_label);
+            if (for_loop->body.size) {
+                compile_to_reg_bytecode(for_loop->body, 1, cache);
+            }
+            reg_compile_oneliner(&cache->ast->oneliners[for_loop->after], cache);
+            reg_compile_branch(condition, 1, body_label, cache);
+            reg_label_bind(cache, end_label);
             memory_shrink(cache);
             break;
         }
         case FnStmt: {
-            add_command(cache, GotoCode);
-            Constant goto_arg = {.int_data = -1};
-            int goto_arg_index = cache->program_size - 1;
-            add_constant(cache, goto_arg);
+            int skip_label = label_create(cache);
+            add_reg_command(cache, RegGotoCode, 0, 0, skip_label);
 
-            FnDefinition *fn_def = stmt->data.fn_def;
-            char *fn_name = substring(cache->source, fn_def->name->start, fn_def->name->end);
-            memory_store(cache->memory, cache->memory_size, fn_name, -1, cache->program_size); // storing command index, not stack index
+            FnDefinition *fn_def = &cache->ast->fn_defs[stmt->index];
+            cache->fn_positions[fn_def->decl] = cache->reg_program_size;
 
             memory_extend(cache);
+            known_values_clear(cache);
+            FrameState outer = frame_enter(cache);
             for (int i = 0; i < fn_def->datatype->params_size; i++) {
-                cache->stack_index++;
-                FnParam param = fn_def->datatype->params[i];
-                char *param_name = substring(cache->source, param.name->start, param.name->end);
-                memory_store(cache->memory, cache->memory_size, param_name, -1, cache->stack_index);
+                reg_temp(cache);
             }
-            cache->function_param_count = fn_def->datatype->params_size;
-            compile_to_bytecode(fn_def->body, fn_def->body_size, 0, cache);
+            compile_to_reg_bytecode(fn_def->body, 0, cache);
+            add_reg_command(cache, RegResumeCode, 0, 0, 0);
+            frame_leave(cache, outer);
             memory_shrink(cache);
-            Constant shift = {.int_data = fn_def->datatype->params_size};
-            ;
-            add_command(cache, ResumeCode);
-            add_constant(cache, shift);
-            (cache->args)[goto_arg_index].int_data = cache->program_size;
+            reg_label_bind(cache, skip_label);
             break;
         }
         case ReturnStmt: {
-            Constant shift = {.int_data = cache->function_param_count};
-            ReturnCmd *cmd = stmt->data.return_cmd;
-            if (cmd->exp == NULL) {
-                add_command(cache, ResumeCode);
-                add_constant(cache, shift);
+            Expression *exp = ast_expression(cache->ast, stmt->index);
+            if (exp == NULL) {
+                add_reg_command(cache, RegResumeCode, 0, 0, 0);
+                break;
+            }
+            int mark = cache->stack_index;
+            if (exp->type == FnCallExp) {
+                int fn_def_index = fn_index_get(exp, cache);
+                int args = cache->stack_index + 1;
+                for (int i = 0; i < exp->args.size; i++) {
+                    reg_compile_expression(ast_arg(cache->ast, exp, i), reg_temp(cache), cache);
+                }
+                add_reg_command(cache, RegTailCallCode, fn_def_index, args, exp->args.size);
+                cache->stack_index = mark;
                 break;
             }
-            compile_expression(cmd->exp, cache);
-            add_command(cache, ReturnCode);
-            add_constant(cache, shift);
+            add_reg_command(cache, RegReturnCode, reg_compile_expression(exp, -1, cache), 0, 0);
+            cache->stack_index = mark;
             break;
         }
         default:
@@ -603,9 +1452,6 @@ void compile_to_bytecode(Stmt *stmts, int stmts_size, int does_wrap, CompileCach
         }
     }
     if (does_wrap) {
-        Constant shift_to = {.int_data = cache->scope_start_positions[cache->memory_size - 1]};
-        add_command(cache, ShiftStackCode);
-        add_constant(cache, shift_to);
         memory_shrink(cache);
     }
 }
@@ -6,44 +6,54 @@
 
 // a := 1 + 2;
 // b := a + 1;
-// OpCode *commands = {Push, Push, IntAdd, Store, Load, Push, Add, Store};
-// Constant *data = {{.int_data = 1}, {.int_data = 2}, {.int_data = 0}, {.ind_data = 0}, {.int_data = 1}, {.int_data = 0}}
+// s := "hi";
+// Instruction *program = {{Enter, 3}, {Push, 3}, {Store, 0}, {Push, 4}, {Store, 1}, {PushConst, 0}, {Store, 2}, {End, 0}};
+// Constant *constants = {"hi"} (only string literals go to the constant pool)
+// both sums are folded: a is known to be 3 when b is assigned
 
+// compile-time value of a variable slot, valid only while generation matches the cache's known_generation
 typedef struct {
-    char *(*var_names)[512];
-    int (*positions)[512];
-    int size;
-} VarPositions;
-
-void var_positions_init(VarPositions *table);
-
-void var_positions_destroy(VarPositions *table);
-
-int hash(char *key);
-
-void var_positions_set(VarPositions *table, char *var_name, int position);
-
-int var_positions_get(VarPositions *table, char *var_name, int *position);
+    int generation;
+    int value;
+} KnownValue;
 
+// program, constants and reg_program are on the heap and outlive the compilation, everything else the
+// compiler keeps comes from arena
 typedef struct {
+    Ast *ast;
     char *source;
-    OpCode *commands;
-    Constant *args;
-    VarPositions *memory;
-    int *scope_start_positions;
-    int function_param_count;
+    Arena *arena;
+    Instruction *program;
+    Constant *constants;
+    int *labels; // label handle -> instruction index, -1 while unbound
+    int program_capacity;
+    int constants_size;
+    int constants_capacity;
+    int labels_size;
+    int labels_capacity;
+    KnownValue *known_values; // indexed by stack position
+    int known_values_capacity;
+    int known_generation;
+    int *scope_start_positions; // stack_index when each open scope began
+    int scope_starts_capacity;
+    int scope_depth;
+    int *fn_positions; // declaration -> instruction index the function starts at
     int program_size;
-    int memory_size;
-    int memory_capacity;
-    int stack_index;
+    int stack_index;    // last variable slot taken in the current frame, slots are relative to the frame base
+    int frame_size;     // variable slots the current frame needs, the most stack_index + 1 reached in it
+    int temp_depth;     // values the current expression has on the operand stack above the frame's variables
+    int max_temp_depth; // the most temp_depth reached in the current frame
+    int max_frame_size; // the most stack slots any single frame (or the top level) occupies at once
+    RegInstruction *reg_program; // output of the register backend, program stays empty when it is used
+    int reg_program_size;
+    int reg_program_capacity;
+    int fn_depth; // functions around the code being compiled, compared with the depth of a declaration
     int has_error;
 } CompileCache;
 
 void compile_cache_init(CompileCache *cache);
 
-void memory_store(VarPositions *memory, int memory_size, char *var_name, int var_scope, int position);
-
-void memory_load(VarPositions *memory, int memory_size, char *var_name, int var_scope, int *position);
+void compile_cache_reserve(CompileCache *cache, int capacity);
 
 void memory_extend(CompileCache *cache);
 
@@ -53,9 +63,19 @@ static void compile_expression(Expression *exp, CompileCache *cache);
 
 static void compile_oneliner(Oneliner *oneliner, CompileCache *cache);
 
-static void compile_call(Call *calll, CompileCache *cache);
+static void compile_call(Expression *call, CompileCache *cache);
+
+void compile_to_bytecode(AstList stmts, int does_wrap, CompileCache *cache);
+
+void compile_program(AstList stmts, CompileCache *cache);
+
+static int reg_compile_expression(Expression *exp, int dst, CompileCache *cache);
+
+static void reg_compile_oneliner(Oneliner *oneliner, CompileCache *cache);
+
+static int reg_compile_call(Expression *call, CompileCache *cache);
 
-void compile_to_bytecode(Stmt *stmts, int stmts_size, int does_wrap, CompileCache *cache);
+void compile_to_reg_bytecode(AstList stmts, int does_wrap, CompileCache *cache);
 
-void compile_program(Stmt *stmts, int stmts_size, CompileCache *cache);
+void compile_reg_program(AstList stmts, CompileCache *cache);
 #endif
@@ -2,14 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-Error *error_create() {
-    Error *err = malloc(sizeof(Error));
+Error *error_create(Arena *arena) {
+    Error *err = arena_alloc(arena, sizeof(Error));
     err->token = NULL;
     err->message = NULL;
     return err;
 }
 
-void error_print(Error *err) {
+void error_print(Error *err, LineIndex *lines) {
     switch (err->type) {
     case SyntaxError:
         printf("Syntax Error");
@@ -24,6 +24,9 @@ void error_print(Error *err) {
         printf("Parse Error");
         break;
     }
-    printf(" at %lu:%lu: ", err->token->ln, err->token->start - err->token->ln_start + 1);
+    size_t line;
+    size_t column;
+    line_index_locate(lines, err->token->start, &line, &column);
+    printf(" at %lu:%lu: ", line, column);
     printf("%s\n", err->message);
 }
@@ -11,7 +11,7 @@ typedef struct {
     Token *token;
 } Error;
 
-Error *error_create();
+Error *error_create(Arena *arena);
 
-void error_print(Error *err);
+void error_print(Error *err, LineIndex *lines);
 #endif
@@ -0,0 +1,295 @@
+#include "image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#define IMAGE_MMAP
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define IMAGE_MAGIC "CIMPLBC"
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+// Written as the host lays it out, byte_order and layout keep images from being used on a different kind of host.
+// Followed by program_size instructions, constants_size 8 byte constant slots and strings_size bytes of text.
+// A constant slot holds 1 + the offset of its NUL terminated text, or 0 for a NULL string_data (an empty string still
+// gets an offset, of its lone NUL).
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t layout; // sizeof(Instruction) << 8 | sizeof(Constant)
+    int32_t max_frame_size;
+    uint64_t source_hash;
+    uint64_t build_id;     // hash of IMAGE_BUILD_ID
+    uint64_t payload_hash; // hash of everything after the header, catches damage the checks of image_map can't see
+    uint32_t program_size;
+    uint32_t constants_size;
+    uint64_t strings_size;
+} ImageHeader;
+
+#define IMAGE_LAYOUT ((uint32_t)(sizeof(Instruction) << 8 | sizeof(Constant)))
+
+#define IMAGE_HASH_START 0xcbf29ce484222325ull
+
+// continues a 64-bit FNV-1a hash with size more bytes
+static uint64_t image_hash(uint64_t hash, const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= ((const uint8_t *)data)[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t image_source_hash(const char *source, size_t size) { return image_hash(IMAGE_HASH_START, source, size); }
+
+#ifdef IMAGE_MMAP
+
+static uint64_t image_build_id(void) { return image_hash(IMAGE_HASH_START, IMAGE_BUILD_ID, sizeof(IMAGE_BUILD_ID) - 1); }
+
+static int make_directory(const char *path) { return mkdir(path, 0755) && errno != EEXIST; }
+
+char *image_cache_path(uint64_t source_hash) {
+    char *directory = NULL;
+    const char *configured = getenv("CIMPL_CACHE_DIR");
+    const char *home = getenv("HOME");
+    if (configured != NULL && configured[0]) {
+        directory = strdup(configured);
+        if (make_directory(directory)) {
+            free(directory);
+            return NULL;
+        }
+    } else if (home != NULL && home[0]) {
+        directory = malloc(strlen(home) + sizeof("/.cache/cimpl"));
+        sprintf(directory, "%s/.cache", home);
+        make_directory(directory);
+        strcat(directory, "/cimpl");
+        if (make_directory(directory)) {
+            free(directory);
+            return NULL;
+        }
+    } else {
+        return NULL;
+    }
+    char *path = malloc(strlen(directory) + sizeof("/0123456789abcdef.cbc"));
+    sprintf(path, "%s/%016llx.cbc", directory, (unsigned long long)source_hash);
+    free(directory);
+    return path;
+}
+
+int image_write(const char *path, uint64_t source_hash, Instruction *program, size_t program_size, Constant *constants, int constants_size,
+                int max_frame_size) {
+    uint64_t *slots = malloc((constants_size + 1) * sizeof(uint64_t));
+    uint64_t strings_size = 0;
+    for (int i = 0; i < constants_size; i++) {
+        // only string literals go to the constant pool
+        char *string = constants[i].string_data;
+        slots[i] = string == NULL ? 0 : strings_size + 1;
+        strings_size += string == NULL ? 0 : strlen(string) + 1;
+    }
+    // hashed in the order the payload is written
+    uint64_t payload_hash = image_hash(IMAGE_HASH_START, program, program_size * sizeof(Instruction));
+    payload_hash = image_hash(payload_hash, slots, constants_size * sizeof(uint64_t));
+    for (int i = 0; i < constants_size; i++) {
+        char *string = constants[i].string_data;
+        if (string != NULL) {
+            payload_hash = image_hash(payload_hash, string, strlen(string) + 1);
+        }
+    }
+    ImageHeader header = {.magic = IMAGE_MAGIC,
+                          .version = IMAGE_VERSION,
+                          .byte_order = IMAGE_BYTE_ORDER,
+                          .layout = IMAGE_LAYOUT,
+                          .max_frame_size = max_frame_size,
+                          .source_hash = source_hash,
+                          .build_id = image_build_id(),
+                          .payload_hash = payload_hash,
+                          .program_size = (uint32_t)program_size,
+                          .constants_size = (uint32_t)constants_size,
+                          .strings_size = strings_size};
+
+    char *temp_path = malloc(strlen(path) + 32);
+    sprintf(temp_path, "%s.%ld.tmp", path, (long)getpid());
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        free(slots);
+        free(temp_path);
+        return 1;
+    }
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    failed |= program_size && fwrite(program, sizeof(Instruction), program_size, file) != program_size;
+    failed |= constants_size && fwrite(slots, sizeof(uint64_t), constants_size, file) != (size_t)constants_size;
+    for (int i = 0; i < constants_size && !failed; i++) {
+        char *string = constants[i].string_data;
+        if (string != NULL) {
+            failed |= fwrite(string, 1, strlen(string) + 1, file) != strlen(string) + 1;
+        }
+    }
+    failed |= fclose(file) != 0;
+    if (!failed) {
+        failed = rename(temp_path, path) != 0;
+    }
+    if (failed) {
+        remove(temp_path);
+    }
+    free(slots);
+    free(temp_path);
+    return failed;
+}
+
+static int image_target_valid(int32_t target, uint32_t program_size) { return target >= 0 && (uint32_t)target < program_size; }
+
+// A program (unless it is empty) must start with the top-level ENTER and finish with END, and every operand must stay
+// inside what the VM trusts without checking: jump and call targets inside the program (calls land on an ENTER),
+// slots inside a frame of max_frame_size, top-level slots inside the top-level frame and constants inside the pool.
+static int image_program_valid(Instruction *program, uint32_t program_size, uint32_t constants_size, int32_t max_frame_size) {
+    if (max_frame_size < 0) {
+        return 0;
+    }
+    if (program_size == 0) {
+        return 1;
+    }
+    if (program[0].code != EnterCode || program[program_size - 1].code != EndCode) {
+        return 0;
+    }
+    int32_t globals_size = program[0].arg;
+    for (uint32_t i = 0; i < program_size; i++) {
+        Instruction instruction = program[i];
+        int valid;
+        switch (instruction.code) {
+        case EnterCode:
+            valid = instruction.arg >= 0 && instruction.arg <= max_frame_size;
+            break;
+        case PushConstCode:
+            valid = instruction.arg >= 0 && (uint32_t)instruction.arg < constants_size;
+            break;
+        case LoadCode:
+        case StoreCode:
+            valid = instruction.arg >= 0 && instruction.arg < max_frame_size;
+            break;
+        case LoadGlobalCode:
+        case StoreGlobalCode:
+            valid = instruction.arg >= 0 && instruction.arg < globals_size;
+            break;
+        case CallCode:
+        case TailCallCode:
+            valid = image_target_valid(instruction.arg, program_size) && program[instruction.arg].code == EnterCode && instruction.imm >= 0 &&
+                    instruction.imm <= max_frame_size;
+            break;
+        case GotoCode:
+        case GotoIfCode:
+        case GotoIfNotCode:
+            valid = image_target_valid(instruction.arg, program_size);
+            break;
+        case GotoIfLocalEqCode:
+        case GotoIfLocalNotEqCode:
+        case GotoIfLocalGtCode:
+        case GotoIfLocalLtCode:
+        case GotoIfLocalGtECode:
+        case GotoIfLocalLtECode:
+            valid = image_target_valid(instruction.arg, program_size) && instruction.local < max_frame_size;
+            break;
+        case AddLocalCode:
+            valid = instruction.local < max_frame_size;
+            break;
+        default:
+            valid = instruction.code <= EndCode;
+            break;
+        }
+        if (!valid) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int image_map(BytecodeImage *image, const char *path, uint64_t source_hash) {
+    image->mapping = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || (size_t)info.st_size < sizeof(ImageHeader)) {
+        close(fd);
+        return 1;
+    }
+    size_t size = (size_t)info.st_size;
+    // private and writable: the string constants are fixed up in place without touching the file
+    uint8_t *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return 1;
+    }
+
+    ImageHeader *header = (ImageHeader *)mapping;
+    size_t program_bytes = (size_t)header->program_size * sizeof(Instruction);
+    size_t constants_bytes = (size_t)header->constants_size * sizeof(uint64_t);
+    int valid = !memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) && header->version == IMAGE_VERSION &&
+                header->byte_order == IMAGE_BYTE_ORDER && header->layout == IMAGE_LAYOUT && header->source_hash == source_hash &&
+                header->build_id == image_build_id() && sizeof(ImageHeader) + program_bytes + constants_bytes + header->strings_size == size &&
+                image_hash(IMAGE_HASH_START, mapping + sizeof(ImageHeader), size - sizeof(ImageHeader)) == header->payload_hash;
+    if (!valid) {
+        munmap(mapping, size);
+        return 1;
+    }
+    Instruction *program = (Instruction *)(mapping + sizeof(ImageHeader));
+    uint64_t *slots = (uint64_t *)(mapping + sizeof(ImageHeader) + program_bytes);
+    char *strings = (char *)slots + constants_bytes;
+    if (header->strings_size && strings[header->strings_size - 1] != '\0') {
+        munmap(mapping, size);
+        return 1;
+    }
+    if (!image_program_valid(program, header->program_size, header->constants_size, header->max_frame_size)) {
+        munmap(mapping, size);
+        return 1;
+    }
+    Constant *constants = (Constant *)slots;
+    for (uint32_t i = 0; i < header->constants_size; i++) {
+        uint64_t slot = slots[i];
+        if (slot > header->strings_size) {
+            munmap(mapping, size);
+            return 1;
+        }
+        constants[i].string_data = slot ? strings + slot - 1 : NULL;
+    }
+
+    image->program = program;
+    image->program_size = header->program_size;
+    image->constants = constants;
+    image->constants_size = (int)header->constants_size;
+    image->max_frame_size = header->max_frame_size;
+    image->mapping = mapping;
+    image->mapped_size = size;
+    return 0;
+}
+
+void image_unmap(BytecodeImage *image) {
+    if (image->mapping != NULL) {
+        munmap(image->mapping, image->mapped_size);
+    }
+    image->mapping = NULL;
+}
+
+#else
+
+char *image_cache_path(uint64_t source_hash) { return NULL; }
+
+int image_write(const char *path, uint64_t source_hash, Instruction *program, size_t program_size, Constant *constants, int constants_size,
+                int max_frame_size) {
+    return 1;
+}
+
+int image_map(BytecodeImage *image, const char *path, uint64_t source_hash) {
+    image->mapping = NULL;
+    return 1;
+}
+
+void image_unmap(BytecodeImage *image) { image->mapping = NULL; }
+
+#endif
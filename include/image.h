@@ -0,0 +1,49 @@
+#ifndef image_h
+#define image_h
+#include "bytecode.h"
+
+// On-disk bytecode image: a fixed header, the instructions exactly as the VM reads them, the constant pool
+// and the text of its strings. Loading maps the file and points the VM at the mapping, only the string
+// constants get their offsets turned into pointers (in a private copy of the page).
+//
+// Images are also stamped with the build of the compiler that wrote them, so a rebuilt compiler, which may
+// emit different bytecode for the same source, ignores and rebuilds them. compile.sh builds every file in
+// one go, so the default stamp (the time image.c was compiled) changes with every build; builds that
+// compile files separately should pass their own -DIMAGE_BUILD_ID="...". Bump IMAGE_VERSION with every
+// change to the image layout.
+#define IMAGE_VERSION 2
+
+#ifndef IMAGE_BUILD_ID
+#define IMAGE_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+typedef struct {
+    Instruction *program;
+    size_t program_size;
+    Constant *constants;
+    int constants_size;
+    int max_frame_size;
+    void *mapping;
+    size_t mapped_size;
+} BytecodeImage;
+
+// 64-bit FNV-1a of the source, images are only used for the exact source they were built from
+uint64_t image_source_hash(const char *source, size_t size);
+
+// where the image for a source with this hash is cached: $CIMPL_CACHE_DIR, or ~/.cache/cimpl, created
+// when missing. NULL when there is no usable cache directory. The caller frees the path.
+char *image_cache_path(uint64_t source_hash);
+
+// Writes the image next to path and renames it into place, so a concurrent run never maps half a file.
+// Returns 1 on failure.
+int image_write(const char *path, uint64_t source_hash, Instruction *program, size_t program_size, Constant *constants, int constants_size,
+                int max_frame_size);
+
+// Returns 1 when there is no image at path, it was written by another build or for another source, or it is damaged
+// (its checksum doesn't match, or a jump or call target, slot or constant index is out of range). Stack depth and operand
+// types aren't checked: the image is trusted to hold what the compiler wrote.
+int image_map(BytecodeImage *image, const char *path, uint64_t source_hash);
+
+void image_unmap(BytecodeImage *image);
+
+#endif
@@ -0,0 +1,440 @@
+#include "jit.h"
+#include "bytecode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the stencils use the System V calling convention, so Windows is left to the interpreter
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// The stencils are plain bytes, so any host can assemble them (object files are written everywhere),
+// only running the result needs an x86-64 System V machine.
+
+// Register use inside generated code:
+//   rbx - top of the operand stack (next free slot), like top in vm_run
+//   r12 - base of the current frame
+//   r13 - vm->stack, the top-level frame used by LOAD_GLOBAL/STORE_GLOBAL
+//   r14 - next free call record, r15 - end of the call record array
+// All of them are callee-saved, so println can call into C without spilling anything.
+
+// one record per active call, the native counterpart of CallFrame
+typedef struct {
+    void *return_address;
+    Constant *base;
+} JitFrame;
+
+typedef enum {
+    HoleArg,        // imm32: instruction.arg
+    HoleArgSlot,    // disp32: instruction.arg * sizeof(Constant)
+    HoleLocalSlot,  // disp32: instruction.local * sizeof(Constant)
+    HoleImm,        // imm32: instruction.imm
+    HoleNegImmSlot, // disp32: -instruction.imm * sizeof(Constant)
+    HolePc,         // imm32: index of the instruction, reported on stack overflow
+    HoleTarget,     // rel32: jump to the instruction at instruction.arg
+    HoleExit,       // rel32: jump to the exit stub
+    HoleConstant,   // imm64: constants[instruction.arg]
+    HoleStackLimit, // imm64: highest base a call may get
+    HoleHelper,     // imm64: address of the C function printing the value
+} JitHoleKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t offset;
+} JitHole;
+
+typedef struct {
+    const uint8_t *code;
+    int size;
+    JitHole holes[5];
+    int holes_size;
+} JitStencil;
+
+// The stencils below were assembled from the listings next to them; holes hold placeholder bytes.
+
+// push rbx; push r12; push r13; push r14; push r15
+// mov r13, rdi; mov r12, rdi; mov rbx, rdi
+// mov r14, rsi; mov r15, rdx
+static const uint8_t prologue_stencil[] = {0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x49, 0x89, 0xfd,
+                                           0x49, 0x89, 0xfc, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf6, 0x49, 0x89, 0xd7};
+// pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+static const uint8_t exit_stencil[] = {0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3};
+
+// lea rbx, [r12 + slot]
+static const uint8_t enter_stencil[] = {0x49, 0x8d, 0x9c, 0x24, 0, 0, 0, 0};
+// mov dword ptr [rbx], arg; add rbx, 8
+static const uint8_t push_stencil[] = {0xc7, 0x03, 0, 0, 0, 0, 0x48, 0x83, 0xc3, 0x08};
+// movabs rax, constant; mov [rbx], rax; add rbx, 8
+static const uint8_t push_const_stencil[] = {0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0x48, 0x89, 0x03, 0x48, 0x83, 0xc3, 0x08};
+// mov rax, [r12 + slot]; mov [rbx], rax; add rbx, 8
+static const uint8_t load_stencil[] = {0x49, 0x8b, 0x84, 0x24, 0, 0, 0, 0, 0x48, 0x89, 0x03, 0x48, 0x83, 0xc3, 0x08};
+// mov rax, [r13 + slot]; mov [rbx], rax; add rbx, 8
+static const uint8_t load_global_stencil[] = {0x49, 0x8b, 0x85, 0, 0, 0, 0, 0x48, 0x89, 0x03, 0x48, 0x83, 0xc3, 0x08};
+// sub rbx, 8; mov rax, [rbx]; mov [r12 + slot], rax
+static const uint8_t store_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x48, 0x8b, 0x03, 0x49, 0x89, 0x84, 0x24, 0, 0, 0, 0};
+// sub rbx, 8; mov rax, [rbx]; mov [r13 + slot], rax
+static const uint8_t store_global_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x48, 0x8b, 0x03, 0x49, 0x89, 0x85, 0, 0, 0, 0};
+
+// sub rbx, 8; mov eax, [rbx]; add [rbx - 8], eax
+static const uint8_t add_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x8b, 0x03, 0x01, 0x43, 0xf8};
+// sub rbx, 8; mov eax, [rbx]; sub [rbx - 8], eax
+static const uint8_t subtract_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x8b, 0x03, 0x29, 0x43, 0xf8};
+// sub rbx, 8; mov eax, [rbx - 8]; imul eax, [rbx]; mov [rbx - 8], eax
+static const uint8_t multiply_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x8b, 0x43, 0xf8, 0x0f, 0xaf, 0x03, 0x89, 0x43, 0xf8};
+// sub rbx, 8; mov eax, [rbx - 8]; cdq; idiv dword ptr [rbx]; mov [rbx - 8], eax
+static const uint8_t divide_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x8b, 0x43, 0xf8, 0x99, 0xf7, 0x3b, 0x89, 0x43, 0xf8};
+// sub rbx, 8; mov eax, [rbx - 8]; cdq; idiv dword ptr [rbx]; mov [rbx - 8], edx
+static const uint8_t mod_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x8b, 0x43, 0xf8, 0x99, 0xf7, 0x3b, 0x89, 0x53, 0xf8};
+
+// sub rbx, 8; mov eax, [rbx]; cmp [rbx - 8], eax; setCC al; movzx eax, al; mov [rbx - 8], eax
+#define JIT_COMPARE_STENCIL(setcc) {0x48, 0x83, 0xeb, 0x08, 0x8b, 0x03, 0x39, 0x43, 0xf8, 0x0f, setcc, 0xc0, 0x0f, 0xb6, 0xc0, 0x89, 0x43, 0xf8}
+static const uint8_t eq_stencil[] = JIT_COMPARE_STENCIL(0x94);
+static const uint8_t not_eq_stencil[] = JIT_COMPARE_STENCIL(0x95);
+static const uint8_t gt_stencil[] = JIT_COMPARE_STENCIL(0x9f);
+static const uint8_t lt_stencil[] = JIT_COMPARE_STENCIL(0x9c);
+static const uint8_t gte_stencil[] = JIT_COMPARE_STENCIL(0x9d);
+static const uint8_t lte_stencil[] = JIT_COMPARE_STENCIL(0x9e);
+
+// sub rbx, 8; cmp dword ptr [rbx], 0; setne al; cmp dword ptr [rbx - 8], 0; setne cl
+// and al, cl; movzx eax, al; mov [rbx - 8], eax
+static const uint8_t and_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x83, 0x3b, 0x00, 0x0f, 0x95, 0xc0, 0x83, 0x7b, 0xf8,
+                                      0x00, 0x0f, 0x95, 0xc1, 0x20, 0xc8, 0x0f, 0xb6, 0xc0, 0x89, 0x43, 0xf8};
+// same as and_stencil with or al, cl
+static const uint8_t or_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x83, 0x3b, 0x00, 0x0f, 0x95, 0xc0, 0x83, 0x7b, 0xf8,
+                                     0x00, 0x0f, 0x95, 0xc1, 0x08, 0xc8, 0x0f, 0xb6, 0xc0, 0x89, 0x43, 0xf8};
+// cmp dword ptr [rbx - 8], 0; sete al; movzx eax, al; mov [rbx - 8], eax
+static const uint8_t not_stencil[] = {0x83, 0x7b, 0xf8, 0x00, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0, 0x89, 0x43, 0xf8};
+
+// jmp target
+static const uint8_t goto_stencil[] = {0xe9, 0, 0, 0, 0};
+// sub rbx, 8; cmp dword ptr [rbx], 0; jne target
+static const uint8_t goto_if_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x83, 0x3b, 0x00, 0x0f, 0x85, 0, 0, 0, 0};
+// sub rbx, 8; cmp dword ptr [rbx], 0; je target
+static const uint8_t goto_if_not_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x83, 0x3b, 0x00, 0x0f, 0x84, 0, 0, 0, 0};
+
+// cmp dword ptr [r12 + slot], imm; jCC target
+#define JIT_LOCAL_BRANCH_STENCIL(jcc) {0x41, 0x81, 0xbc, 0x24, 0, 0, 0, 0, 0, 0, 0, 0, 0x0f, jcc, 0, 0, 0, 0}
+static const uint8_t local_eq_stencil[] = JIT_LOCAL_BRANCH_STENCIL(0x84);
+static const uint8_t local_not_eq_stencil[] = JIT_LOCAL_BRANCH_STENCIL(0x85);
+static const uint8_t local_gt_stencil[] = JIT_LOCAL_BRANCH_STENCIL(0x8f);
+static const uint8_t local_lt_stencil[] = JIT_LOCAL_BRANCH_STENCIL(0x8c);
+static const uint8_t local_gte_stencil[] = JIT_LOCAL_BRANCH_STENCIL(0x8d);
+static const uint8_t local_lte_stencil[] = JIT_LOCAL_BRANCH_STENCIL(0x8e);
+// add dword ptr [r12 + slot], arg
+static const uint8_t add_local_stencil[] = {0x41, 0x81, 0x84, 0x24, 0, 0, 0, 0, 0, 0, 0, 0};
+
+//     lea rcx, [rbx - argc * 8]       ; callee base
+//     movabs rax, stack_limit
+//     cmp rcx, rax
+//     ja overflow
+//     cmp r14, r15
+//     jb push_record
+// overflow:
+//     mov eax, pc
+//     jmp exit
+// push_record:
+//     lea rax, [rip + after]
+//     mov [r14], rax
+//     mov [r14 + 8], r12
+//     add r14, 16
+//     mov r12, rcx
+//     jmp target
+// after:
+static const uint8_t call_stencil[] = {0x48, 0x8d, 0x8b, 0, 0, 0, 0, 0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0,
+                                       0,    0x48, 0x39, 0xc1, 0x77, 0x05, 0x4d, 0x39, 0xfe, 0x72, 0x0a, 0xb8, 0, 0, 0, 0,
+                                       0xe9, 0, 0, 0, 0, 0x48, 0x8d, 0x05, 0x13, 0x00, 0x00, 0x00, 0x49, 0x89, 0x06, 0x4d,
+                                       0x89, 0x66, 0x08, 0x49, 0x83, 0xc6, 0x10, 0x49, 0x89, 0xcc, 0xe9, 0, 0, 0, 0};
+//     lea rsi, [rbx - argc * 8]
+//     xor edx, edx
+//     jmp check
+// copy:
+//     mov rax, [rsi + rdx * 8]
+//     mov [r12 + rdx * 8], rax
+//     inc rdx
+// check:
+//     cmp rdx, argc
+//     jb copy
+//     jmp target
+static const uint8_t tail_call_stencil[] = {0x48, 0x8d, 0xb3, 0, 0, 0, 0, 0x31, 0xd2, 0xeb, 0x0b, 0x48, 0x8b, 0x04, 0xd6, 0x49, 0x89, 0x04,
+                                            0xd4, 0x48, 0xff, 0xc2, 0x48, 0x81, 0xfa, 0, 0, 0, 0, 0x72, 0xec, 0xe9, 0, 0, 0, 0};
+// mov rax, [rbx - 8]; mov [r12], rax; lea rbx, [r12 + 8]
+// sub r14, 16; mov r12, [r14 + 8]; jmp [r14]
+static const uint8_t return_stencil[] = {0x48, 0x8b, 0x43, 0xf8, 0x49, 0x89, 0x04, 0x24, 0x49, 0x8d, 0x5c, 0x24,
+                                         0x08, 0x49, 0x83, 0xee, 0x10, 0x4d, 0x8b, 0x66, 0x08, 0x41, 0xff, 0x26};
+// mov rbx, r12; sub r14, 16; mov r12, [r14 + 8]; jmp [r14]
+static const uint8_t resume_stencil[] = {0x4c, 0x89, 0xe3, 0x49, 0x83, 0xee, 0x10, 0x4d, 0x8b, 0x66, 0x08, 0x41, 0xff, 0x26};
+
+// sub rbx, 8; mov rdi, [rbx]; movabs rax, helper; call rax
+static const uint8_t println_stencil[] = {0x48, 0x83, 0xeb, 0x08, 0x48, 0x8b, 0x3b, 0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xd0};
+// mov eax, -1; jmp exit
+static const uint8_t end_stencil[] = {0xb8, 0xff, 0xff, 0xff, 0xff, 0xe9, 0, 0, 0, 0};
+
+#define JIT_STENCIL(bytes, ...)                                                                                                            \
+    {                                                                                                                                      \
+        .code = bytes, .size = sizeof(bytes), .holes = {__VA_ARGS__},                                                                      \
+        .holes_size = sizeof((JitHole[]){__VA_ARGS__}) / sizeof(JitHole)                                                                   \
+    }
+
+#define JIT_PLAIN_STENCIL(bytes)                                                                                                           \
+    { .code = bytes, .size = sizeof(bytes), .holes_size = 0 }
+
+static const JitStencil stencils[] = {
+    [EnterCode] = JIT_STENCIL(enter_stencil, {HoleArgSlot, 4}),
+    [PushCode] = JIT_STENCIL(push_stencil, {HoleArg, 2}),
+    [PushConstCode] = JIT_STENCIL(push_const_stencil, {HoleConstant, 2}),
+    [LoadCode] = JIT_STENCIL(load_stencil, {HoleArgSlot, 4}),
+    [LoadGlobalCode] = JIT_STENCIL(load_global_stencil, {HoleArgSlot, 3}),
+    [ReturnCode] = JIT_PLAIN_STENCIL(return_stencil),
+    [StoreCode] = JIT_STENCIL(store_stencil, {HoleArgSlot, 11}),
+    [StoreGlobalCode] = JIT_STENCIL(store_global_stencil, {HoleArgSlot, 10}),
+    [CallCode] = JIT_STENCIL(call_stencil, {HoleNegImmSlot, 3}, {HoleStackLimit, 9}, {HolePc, 28}, {HoleExit, 33}, {HoleTarget, 59}),
+    [TailCallCode] = JIT_STENCIL(tail_call_stencil, {HoleNegImmSlot, 3}, {HoleImm, 25}, {HoleTarget, 32}),
+    [IntAddCode] = JIT_PLAIN_STENCIL(add_stencil),
+    [IntSubtractCode] = JIT_PLAIN_STENCIL(subtract_stencil),
+    [IntMultiplyCode] = JIT_PLAIN_STENCIL(multiply_stencil),
+    [IntDivideCode] = JIT_PLAIN_STENCIL(divide_stencil),
+    [IntModCode] = JIT_PLAIN_STENCIL(mod_stencil),
+    [IntEqCode] = JIT_PLAIN_STENCIL(eq_stencil),
+    [IntNotEqCode] = JIT_PLAIN_STENCIL(not_eq_stencil),
+    [IntGtCode] = JIT_PLAIN_STENCIL(gt_stencil),
+    [IntLtCode] = JIT_PLAIN_STENCIL(lt_stencil),
+    [IntGtECode] = JIT_PLAIN_STENCIL(gte_stencil),
+    [IntLtECode] = JIT_PLAIN_STENCIL(lte_stencil),
+    [BoolNotCode] = JIT_PLAIN_STENCIL(not_stencil),
+    [BoolAndCode] = JIT_PLAIN_STENCIL(and_stencil),
+    [BoolOrCode] = JIT_PLAIN_STENCIL(or_stencil),
+    [GotoIfCode] = JIT_STENCIL(goto_if_stencil, {HoleTarget, 9}),
+    [GotoIfNotCode] = JIT_STENCIL(goto_if_not_stencil, {HoleTarget, 9}),
+    [GotoCode] = JIT_STENCIL(goto_stencil, {HoleTarget, 1}),
+    [ResumeCode] = JIT_PLAIN_STENCIL(resume_stencil),
+    [GotoIfLocalEqCode] = JIT_STENCIL(local_eq_stencil, {HoleLocalSlot, 4}, {HoleImm, 8}, {HoleTarget, 14}),
+    [GotoIfLocalNotEqCode] = JIT_STENCIL(local_not_eq_stencil, {HoleLocalSlot, 4}, {HoleImm, 8}, {HoleTarget, 14}),
+    [GotoIfLocalGtCode] = JIT_STENCIL(local_gt_stencil, {HoleLocalSlot, 4}, {HoleImm, 8}, {HoleTarget, 14}),
+    [GotoIfLocalLtCode] = JIT_STENCIL(local_lt_stencil, {HoleLocalSlot, 4}, {HoleImm, 8}, {HoleTarget, 14}),
+    [GotoIfLocalGtECode] = JIT_STENCIL(local_gte_stencil, {HoleLocalSlot, 4}, {HoleImm, 8}, {HoleTarget, 14}),
+    [GotoIfLocalLtECode] = JIT_STENCIL(local_lte_stencil, {HoleLocalSlot, 4}, {HoleImm, 8}, {HoleTarget, 14}),
+    [AddLocalCode] = JIT_STENCIL(add_local_stencil, {HoleLocalSlot, 4}, {HoleArg, 8}),
+    [PrintlnIntCode] = JIT_STENCIL(println_stencil, {HoleHelper, 9}),
+    [PrintlnBoolCode] = JIT_STENCIL(println_stencil, {HoleHelper, 9}),
+    [PrintlnStrCode] = JIT_STENCIL(println_stencil, {HoleHelper, 9}),
+    [EndCode] = JIT_STENCIL(end_stencil, {HoleExit, 6}),
+};
+
+#define JIT_STENCILS_SIZE ((int)(sizeof(stencils) / sizeof(JitStencil)))
+
+static void jit_patch32(uint8_t *at, int32_t value) { memcpy(at, &value, sizeof(value)); }
+
+static void jit_patch64(uint8_t *at, uint64_t value) { memcpy(at, &value, sizeof(value)); }
+
+static void jit_address_add(JitAssembly *assembly, int offset, JitAddressKind kind, Instruction instruction) {
+    if (assembly->addresses_size == assembly->addresses_capacity) {
+        assembly->addresses_capacity = assembly->addresses_capacity ? assembly->addresses_capacity * 2 : 32;
+        assembly->addresses = realloc(assembly->addresses, assembly->addresses_capacity * sizeof(JitAddress));
+    }
+    JitAddress address = {.offset = offset, .kind = kind, .code = instruction.code, .arg = instruction.arg};
+    assembly->addresses[assembly->addresses_size++] = address;
+}
+
+int jit_assemble(JitAssembly *assembly, Instruction *program, int program_size) {
+    assembly->code = NULL;
+    assembly->size = 0;
+    assembly->addresses = NULL;
+    assembly->addresses_size = 0;
+    assembly->addresses_capacity = 0;
+    if (program == NULL || program_size == 0) {
+        return 1;
+    }
+
+    // first pass: where every instruction starts, the exit stub goes after the last one
+    int *offsets = malloc((program_size + 1) * sizeof(int));
+    size_t size = sizeof(prologue_stencil);
+    for (int i = 0; i < program_size; i++) {
+        if (program[i].code >= JIT_STENCILS_SIZE || stencils[program[i].code].code == NULL) {
+            fprintf(stderr, "JIT: no stencil for instruction %d at %d\n", program[i].code, i);
+            free(offsets);
+            return 1;
+        }
+        offsets[i] = (int)size;
+        size += stencils[program[i].code].size;
+    }
+    offsets[program_size] = (int)size;
+    int exit_offset = (int)size;
+    size += sizeof(exit_stencil);
+
+    // second pass: copy every stencil and fill in the holes that don't depend on where the code is put
+    uint8_t *code = malloc(size);
+    memcpy(code, prologue_stencil, sizeof(prologue_stencil));
+    for (int i = 0; i < program_size; i++) {
+        Instruction instruction = program[i];
+        const JitStencil *stencil = &stencils[instruction.code];
+        uint8_t *at = code + offsets[i];
+        memcpy(at, stencil->code, stencil->size);
+        for (int h = 0; h < stencil->holes_size; h++) {
+            JitHole hole = stencil->holes[h];
+            uint8_t *patch = at + hole.offset;
+            // rel32 displacements count from the end of the 4 byte field
+            int next = offsets[i] + hole.offset + 4;
+            switch (hole.kind) {
+            case HoleArg:
+                jit_patch32(patch, instruction.arg);
+                break;
+            case HoleArgSlot:
+                jit_patch32(patch, instruction.arg * (int32_t)sizeof(Constant));
+                break;
+            case HoleLocalSlot:
+                jit_patch32(patch, instruction.local * (int32_t)sizeof(Constant));
+                break;
+            case HoleImm:
+                jit_patch32(patch, instruction.imm);
+                break;
+            case HoleNegImmSlot:
+                jit_patch32(patch, -instruction.imm * (int32_t)sizeof(Constant));
+                break;
+            case HolePc:
+                jit_patch32(patch, i);
+                break;
+            case HoleTarget:
+                jit_patch32(patch, offsets[instruction.arg] - next);
+                break;
+            case HoleExit:
+                jit_patch32(patch, exit_offset - next);
+                break;
+            case HoleConstant:
+                jit_address_add(assembly, offsets[i] + hole.offset, JitAddressConstant, instruction);
+                break;
+            case HoleStackLimit:
+                jit_address_add(assembly, offsets[i] + hole.offset, JitAddressStackLimit, instruction);
+                break;
+            case HoleHelper:
+                jit_address_add(assembly, offsets[i] + hole.offset, JitAddressHelper, instruction);
+                break;
+            }
+        }
+    }
+    memcpy(code + exit_offset, exit_stencil, sizeof(exit_stencil));
+    free(offsets);
+    assembly->code = code;
+    assembly->size = size;
+    return 0;
+}
+
+void jit_assembly_free(JitAssembly *assembly) {
+    free(assembly->code);
+    free(assembly->addresses);
+    assembly->code = NULL;
+    assembly->addresses = NULL;
+}
+
+static void jit_println_int(Constant data) { printf("%d\n", data.int_data); }
+
+static void jit_println_bool(Constant data) { printf(data.int_data ? "true\n" : "false\n"); }
+
+static void jit_println_str(Constant data) { printf("%s\n", data.string_data); }
+
+JitPrintln jit_println_helper(uint8_t code) {
+    switch (code) {
+    case PrintlnIntCode:
+        return jit_println_int;
+    case PrintlnBoolCode:
+        return jit_println_bool;
+    default:
+        return jit_println_str;
+    }
+}
+
+#ifdef JIT_X86_64
+
+static uint64_t jit_helper(uint8_t code) { return (uint64_t)(uintptr_t)jit_println_helper(code); }
+
+int jit_compile(JitCode *jit, VM *vm) {
+    jit->code = NULL;
+    jit->code_size = 0;
+    jit->mapped_size = 0;
+    JitAssembly assembly;
+    if (jit_assemble(&assembly, vm->program, (int)vm->program_size)) {
+        return 1;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t mapped_size = (assembly.size + page_size - 1) / page_size * page_size;
+    uint8_t *code = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        jit_assembly_free(&assembly);
+        return 1;
+    }
+
+    // the absolute addresses are known now that everything lives in this process
+    Constant *stack_limit = vm->stack + vm->stack_capacity - vm->max_frame_size;
+    memcpy(code, assembly.code, assembly.size);
+    for (int i = 0; i < assembly.addresses_size; i++) {
+        JitAddress address = assembly.addresses[i];
+        uint8_t *patch = code + address.offset;
+        switch (address.kind) {
+        case JitAddressConstant:
+            memcpy(patch, &vm->constants[address.arg], sizeof(Constant));
+            break;
+        case JitAddressStackLimit:
+            jit_patch64(patch, (uint64_t)(uintptr_t)stack_limit);
+            break;
+        case JitAddressHelper:
+            jit_patch64(patch, jit_helper(address.code));
+            break;
+        }
+    }
+    size_t size = assembly.size;
+    jit_assembly_free(&assembly);
+
+    // never writable and executable at the same time
+    if (mprotect(code, mapped_size, PROT_READ | PROT_EXEC)) {
+        munmap(code, mapped_size);
+        return 1;
+    }
+    jit->code = code;
+    jit->code_size = size;
+    jit->mapped_size = mapped_size;
+    return 0;
+}
+
+typedef int (*JitEntry)(Constant *stack, JitFrame *frames, JitFrame *frames_limit);
+
+int jit_run(JitCode *jit, VM *vm) {
+    // every call moves the base up by at least its argument count, but a call without arguments
+    // does not, so call records get their own fixed budget of one per stack slot
+    int frames_capacity = vm->stack_capacity;
+    JitFrame *frames = malloc(sizeof(JitFrame) * frames_capacity);
+    JitEntry entry = (JitEntry)(void *)jit->code;
+    int overflow_at = entry(vm->stack, frames, frames + frames_capacity);
+    if (overflow_at >= 0) {
+        fflush(stdout);
+        fprintf(stderr, "Stack overflow at %d\n", overflow_at);
+    }
+    free(frames);
+    vm->stack_size = 0;
+    vm->frames_size = 0;
+    return overflow_at >= 0;
+}
+
+void jit_free(JitCode *jit) {
+    if (jit->code != NULL) {
+        munmap(jit->code, jit->mapped_size);
+    }
+    jit->code = NULL;
+}
+
+#else
+
+int jit_compile(JitCode *jit, VM *vm) {
+    jit->code = NULL;
+    jit->code_size = 0;
+    jit->mapped_size = 0;
+    return 1;
+}
+
+int jit_run(JitCode *jit, VM *vm) { return vm_run(vm); }
+
+void jit_free(JitCode *jit) { jit->code = NULL; }
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef jit_h
+#define jit_h
+#include "bytecode.h"
+#include "vm.h"
+
+// Baseline copy-and-patch compiler for the stack instruction set: every opcode has a fixed piece of x86-64
+// machine code with holes for its operands, the pieces are copied one after another into executable memory
+// and the holes are patched with slots, immediates and jump displacements. The generated code keeps the
+// interpreter's memory layout (same operand stack, same frame slots), so it produces the same output.
+
+typedef struct {
+    uint8_t *code;      // executable mapping, NULL when nothing was compiled
+    size_t code_size;   // bytes of generated code
+    size_t mapped_size; // bytes mapped, rounded up to whole pages
+} JitCode;
+
+// Holes that need a 64-bit absolute address. They are left empty by jit_assemble, the JIT fills them
+// with addresses in this process and the object writer turns them into relocations.
+typedef enum {
+    JitAddressConstant,   // constants[arg], a string
+    JitAddressStackLimit, // highest base a call may get
+    JitAddressHelper,     // the C function printing the value, chosen by code
+} JitAddressKind;
+
+typedef struct {
+    int offset; // of the imm64 operand of a "movabs rax, imm64"
+    uint8_t kind;
+    uint8_t code; // instruction the hole belongs to
+    int arg;
+} JitAddress;
+
+// A whole program as one function: int entry(Constant *stack, JitFrame *frames, JitFrame *frames_limit),
+// with 16 bytes per call record. It returns the index of the call that overflowed the stack, or -1.
+typedef struct {
+    uint8_t *code;
+    size_t size;
+    JitAddress *addresses;
+    int addresses_size;
+    int addresses_capacity;
+} JitAssembly;
+
+// Copies and patches the stencils for every instruction. Works on any host, returns 1 when some instruction has no stencil.
+int jit_assemble(JitAssembly *assembly, Instruction *program, int program_size);
+
+void jit_assembly_free(JitAssembly *assembly);
+
+// Constant is pointer sized, so native code passes it in rdi like any other 8 byte argument
+typedef void (*JitPrintln)(Constant data);
+
+// the function native code calls for a println instruction, shared by the JIT and the tracing tier
+// so both print exactly like the interpreter
+JitPrintln jit_println_helper(uint8_t code);
+
+// Translates vm->program (set up by vm_init) into native code. Returns 1 when the JIT is not
+// available on this platform or the program cannot be translated, then vm_run should be used instead.
+int jit_compile(JitCode *jit, VM *vm);
+
+// returns 1 when the program stopped on a stack overflow, like vm_run
+int jit_run(JitCode *jit, VM *vm);
+
+void jit_free(JitCode *jit);
+
+#endif
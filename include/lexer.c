@@ -1,13 +1,163 @@
 #include "lexer.h"
 #include "token.h"
-#include "utils.h"
-#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-ParseSource tokenize(char *source, size_t source_size) {
+// Scanning runs of spaces, comments, strings, identifiers and numbers goes 32 (AVX2) or 16 (SSE2) bytes at a
+// time where the compiler targets those, one byte at a time through char_classes everywhere else.
+#if defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LEXER_SIMD
+typedef __m256i LexVector;
+#define LEX_VECTOR_SIZE 32
+#define LEX_FULL_MASK 0xffffffffu
+#define lex_load(at) _mm256_loadu_si256((const __m256i *)(at))
+#define lex_splat(ch) _mm256_set1_epi8((char)(ch))
+#define lex_eq(vector, ch) _mm256_cmpeq_epi8(vector, lex_splat(ch))
+#define lex_gt(vector, ch) _mm256_cmpgt_epi8(vector, lex_splat(ch))
+#define lex_lt(vector, ch) _mm256_cmpgt_epi8(lex_splat(ch), vector)
+#define lex_or(a, b) _mm256_or_si256(a, b)
+#define lex_and(a, b) _mm256_and_si256(a, b)
+#define lex_mask(vector) ((uint32_t)_mm256_movemask_epi8(vector))
+#elif defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#include <emmintrin.h>
+#define LEXER_SIMD
+typedef __m128i LexVector;
+#define LEX_VECTOR_SIZE 16
+#define LEX_FULL_MASK 0xffffu
+#define lex_load(at) _mm_loadu_si128((const __m128i *)(at))
+#define lex_splat(ch) _mm_set1_epi8((char)(ch))
+#define lex_eq(vector, ch) _mm_cmpeq_epi8(vector, lex_splat(ch))
+#define lex_gt(vector, ch) _mm_cmpgt_epi8(vector, lex_splat(ch))
+#define lex_lt(vector, ch) _mm_cmplt_epi8(vector, lex_splat(ch))
+#define lex_or(a, b) _mm_or_si128(a, b)
+#define lex_and(a, b) _mm_and_si128(a, b)
+#define lex_mask(vector) ((uint32_t)_mm_movemask_epi8(vector))
+#endif
+
+typedef enum {
+    CharSpace = 1, // ' ' and '\n', lines are only counted when an error is reported
+    CharDigit = 2,
+    CharAlpha = 4, // letters and '_', what identifiers start with
+    CharIdent = CharDigit | CharAlpha,
+} CharClass;
+
+// ASCII only and independent of the locale, unlike isdigit/isalpha; '\0' (the end sentinel) has no class
+#define S CharSpace
+#define D CharDigit
+#define A CharAlpha
+static const uint8_t char_classes[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, S, 0, 0, 0, 0, 0, // 0x00 \n
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x10
+    S, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x20  !"#$%&'()*+,-./
+    D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0, // 0x30 0-9 :;<=>?
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, // 0x40 @A-O
+    A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, A, // 0x50 P-Z [\]^_
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, // 0x60 `a-o
+    A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, 0, // 0x70 p-z {|}~
+};
+#undef S
+#undef D
+#undef A
+
+static int char_is(char ch, CharClass char_class) { return char_classes[(uint8_t)ch] & char_class; }
+
+// The scanners below return the index of the first byte from at on that ends the run. Vector loads stay
+// inside source_size, the byte-wise tails stop at the sentinel or check the size themselves.
+
+static size_t scan_spaces(char *source, size_t at, size_t source_size) {
+#ifdef LEXER_SIMD
+    for (; at + LEX_VECTOR_SIZE <= source_size; at += LEX_VECTOR_SIZE) {
+        LexVector chars = lex_load(source + at);
+        uint32_t spaces = lex_mask(lex_or(lex_eq(chars, ' '), lex_eq(chars, '\n')));
+        if (spaces != LEX_FULL_MASK) {
+            return at + __builtin_ctz(~spaces);
+        }
+    }
+#endif
+    while (char_is(source[at], CharSpace)) {
+        at++;
+    }
+    return at;
+}
+
+static size_t scan_digits(char *source, size_t at, size_t source_size) {
+#ifdef LEXER_SIMD
+    for (; at + LEX_VECTOR_SIZE <= source_size; at += LEX_VECTOR_SIZE) {
+        LexVector chars = lex_load(source + at);
+        uint32_t digits = lex_mask(lex_and(lex_gt(chars, '0' - 1), lex_lt(chars, '9' + 1)));
+        if (digits != LEX_FULL_MASK) {
+            return at + __builtin_ctz(~digits);
+        }
+    }
+#endif
+    while (char_is(source[at], CharDigit)) {
+        at++;
+    }
+    return at;
+}
+
+static size_t scan_identifier(char *source, size_t at, size_t source_size) {
+#ifdef LEXER_SIMD
+    for (; at + LEX_VECTOR_SIZE <= source_size; at += LEX_VECTOR_SIZE) {
+        LexVector chars = lex_load(source + at);
+        // setting 0x20 turns upper case letters into lower case ones and keeps digits as they are;
+        // bytes above 0x7f are negative and fail both range checks
+        LexVector lower = lex_or(chars, lex_splat(0x20));
+        LexVector letters = lex_and(lex_gt(lower, 'a' - 1), lex_lt(lower, 'z' + 1));
+        LexVector digits = lex_and(lex_gt(chars, '0' - 1), lex_lt(chars, '9' + 1));
+        uint32_t ident = lex_mask(lex_or(lex_or(letters, digits), lex_eq(chars, '_')));
+        if (ident != LEX_FULL_MASK) {
+            return at + __builtin_ctz(~ident);
+        }
+    }
+#endif
+    while (char_is(source[at], CharIdent)) {
+        at++;
+    }
+    return at;
+}
+
+// first '\n', or first '\n' or '"' when quote is set; source_size when there is none
+static size_t scan_line(char *source, size_t at, size_t source_size, int quote) {
+#ifdef LEXER_SIMD
+    for (; at + LEX_VECTOR_SIZE <= source_size; at += LEX_VECTOR_SIZE) {
+        LexVector chars = lex_load(source + at);
+        LexVector stops = lex_eq(chars, '\n');
+        if (quote) {
+            stops = lex_or(stops, lex_eq(chars, '"'));
+        }
+        uint32_t found = lex_mask(stops);
+        if (found) {
+            return at + __builtin_ctz(found);
+        }
+    }
+#endif
+    while (at < source_size && source[at] != '\n' && (!quote || source[at] != '"')) {
+        at++;
+    }
+    return at;
+}
+
+// the value atoi gives for a run of digits: saturated at LONG_MAX, then truncated to an int
+static int32_t decode_number(const char *digits, size_t length) {
+    unsigned long value = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned long digit = digits[i] - '0';
+        if (value > (LONG_MAX - digit) / 10) {
+            value = LONG_MAX;
+            break;
+        }
+        value = value * 10 + digit;
+    }
+    return (int32_t)value;
+}
+
+ParseSource tokenize(char *source, size_t source_size, Interner *symbols, Arena *arena) {
     ParseSource result = {.size = 0, .capacity = 256};
-    Token *tokens = malloc(sizeof(Token) * result.capacity);
+    Token *tokens = arena_alloc(arena, sizeof(Token) * result.capacity);
     result.tokens = tokens;
 
     ChHashTable singlechars = ch_hashtable_create();
@@ -46,43 +196,19 @@ ParseSource tokenize(char *source, size_t source_size) {
     ch_ht_set(&self_modifiers, '+', Inc);
     ch_ht_set(&self_modifiers, '-', Dec);
 
-    LexMap keywords = {.key = NULL, .left = NULL, .right = NULL};
-    lm_insert(&keywords, "if", If);
-    lm_insert(&keywords, "else", Else);
-    lm_insert(&keywords, "for", For);
-    lm_insert(&keywords, "while", While);
-    lm_insert(&keywords, "break", Break);
-    lm_insert(&keywords, "continue", Continue);
-    lm_insert(&keywords, "fn", Fn);
-    lm_insert(&keywords, "return", Return);
-    lm_insert(&keywords, "int", IntType);
-    lm_insert(&keywords, "bool", BoolType);
-    lm_insert(&keywords, "str", StringType);
-    lm_insert(&keywords, "true", True);
-    lm_insert(&keywords, "false", False);
-    lm_insert(&keywords, "println", Println);
-
     size_t start = 0;
     size_t end;
-    size_t line = 1;
-    size_t line_start = 0;
     while (start < source_size) {
         end = start + 1;
-        Token token = {.ln = line, .start = start, .ln_start = line_start};
+        Token token = {.start = (uint32_t)start};
         char ch = source[start];
         switch (ch) {
         case ' ':
-            start++;
-            continue;
         case '\n':
-            line++;
-            start++;
-            line_start = start;
+            start = scan_spaces(source, start + 1, source_size);
             continue;
         case '#':
-            while (start < source_size && source[start] != '\n') {
-                start++;
-            }
+            start = scan_line(source, start + 1, source_size, 0);
             continue;
         case '|':
             if (source[start + 1] == '|') {
@@ -105,29 +231,29 @@ ParseSource tokenize(char *source, size_t source_size) {
             end = start;
             break;
         case '"':
+            // an unterminated string is illegal up to the end of its line, the line break goes with it
             token.start++;
-            while (1) {
-                char next = source[start + 1];
-                if (next == '\n' || next == -1) {
-                    token.ttype = Illegal;
-                    end = start + 1;
-                    start += 2;
-                    break;
-                }
-                if (next == '"') {
-                    token.ttype = Text;
-                    end = start + 1;
-                    start += 2;
-                    break;
-                }
-                start++;
-            }
-            break;
-        case -1:
-            token.ttype = Eof;
-            start++;
+            end = scan_line(source, start + 1, source_size, 1);
+            token.ttype = end < source_size && source[end] == '"' ? Text : Illegal;
+            start = end + 1;
             break;
         default: {
+            if (char_is(ch, CharDigit)) {
+                end = scan_digits(source, end, source_size);
+                token.ttype = Number;
+                token.number = decode_number(source + start, end - start);
+                start = end;
+                break;
+            }
+            if (char_is(ch, CharAlpha)) {
+                end = scan_identifier(source, end, source_size);
+                token.ttype = keyword_lookup(source + start, end - start);
+                if (token.ttype == Identifier) {
+                    token.symbol = interner_intern(symbols, (uint32_t)start, (uint32_t)end);
+                }
+                start = end;
+                break;
+            }
             TokenType op_ttype = ch_ht_get(&operators, ch);
             if (op_ttype != Illegal) {
                 if (source[start + 1] == '=') {
@@ -155,39 +281,25 @@ ParseSource tokenize(char *source, size_t source_size) {
                 start++;
                 break;
             }
-            if (isdigit(ch)) {
-                while (isdigit(source[end])) {
-                    end++;
-                }
-                token.ttype = Number;
-                start = end;
-                break;
-            }
-            if (isalpha(ch) || ch == '_') {
-                while (isdigit(source[end]) || isalpha(source[end]) || source[end] == '_') {
-                    end++;
-                }
-                TokenType kwtype = lm_get(&keywords, substring(source, start, end));
-                if (kwtype != Illegal) {
-                    token.ttype = kwtype;
-                } else {
-                    token.ttype = Identifier;
-                }
-                start = end;
-                break;
-            }
             token.ttype = Illegal;
             start++;
         }
         }
-        token.end = end;
+        token.end = (uint32_t)end;
         if (result.capacity <= result.size) {
             result.capacity *= 2;
-            Token *new_tokens = realloc(result.tokens, sizeof(Token) * result.capacity);
+            Token *new_tokens = arena_grow(arena, result.tokens, sizeof(Token) * result.size, sizeof(Token) * result.capacity);
             result.tokens = new_tokens;
         }
         result.tokens[result.size] = token;
         result.size++;
     }
+    Token eof = {.ttype = Eof, .start = (uint32_t)source_size, .end = (uint32_t)source_size};
+    if (result.capacity <= result.size) {
+        result.capacity *= 2;
+        result.tokens = arena_grow(arena, result.tokens, sizeof(Token) * result.size, sizeof(Token) * result.capacity);
+    }
+    result.tokens[result.size] = eof;
+    result.size++;
     return result;
 }
@@ -2,5 +2,9 @@
 #define LEXER_H
 #include "token.h"
 
-ParseSource tokenize(char *source, size_t source_size);
+// source[source_size] must be readable and hold a character no token starts with (SourceFile puts a '\0'
+// there), the lexer looks one character ahead without checking the size. The last token is always Eof.
+// Identifiers are interned into symbols (initialized for this source), numbers come out decoded. The
+// tokens are allocated from arena.
+ParseSource tokenize(char *source, size_t source_size, Interner *symbols, Arena *arena);
 #endif
@@ -0,0 +1,289 @@
+#include "object.h"
+#include "jit.h"
+#include <string.h>
+
+// ELF constants used below, spelled out so the writer doesn't depend on the host having <elf.h>
+#define ELF_SECTION_HEADER_SIZE 64
+#define ELF_SYMBOL_SIZE 24
+#define ELF_RELA_SIZE 24
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHT_NOBITS 8
+
+#define SHF_WRITE 0x1
+#define SHF_ALLOC 0x2
+#define SHF_EXECINSTR 0x4
+#define SHF_INFO_LINK 0x40
+
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+
+#define R_X86_64_PC32 2
+#define R_X86_64_PLT32 4
+
+typedef enum {
+    TextSection = 1,
+    RodataSection,
+    BssSection,
+    SymtabSection,
+    StrtabSection,
+    RelaTextSection,
+    NoteStackSection, // empty .note.GNU-stack, so the linker doesn't make the stack executable
+    ShstrtabSection,
+    SectionsSize,
+} ObjectSection;
+
+// symbol table indices, the locals have to come first
+typedef enum {
+    TextSymbol = 1,
+    RodataSymbol,
+    BssSymbol,
+    ProgramSymbol, // first global
+    StackSymbol,
+    StackCapacitySymbol,
+    PrintlnIntSymbol,
+    PrintlnBoolSymbol,
+    PrintlnStrSymbol,
+    SymbolsSize,
+} ObjectSymbol;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} ObjectBuffer;
+
+static void buffer_put(ObjectBuffer *buffer, const void *data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        buffer->capacity = (buffer->size + size) * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+// ELF files are written little-endian whatever the host is
+static void buffer_put_le(ObjectBuffer *buffer, uint64_t value, int size) {
+    uint8_t bytes[8];
+    for (int i = 0; i < size; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    buffer_put(buffer, bytes, size);
+}
+
+static void buffer_put_zeros(ObjectBuffer *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        buffer_put_le(buffer, 0, 1);
+    }
+}
+
+static void buffer_align(ObjectBuffer *buffer, size_t alignment) {
+    if (buffer->size % alignment) {
+        buffer_put_zeros(buffer, alignment - buffer->size % alignment);
+    }
+}
+
+// appends a NUL terminated name and returns its offset in the string table
+static uint32_t string_add(ObjectBuffer *strings, const char *name) {
+    uint32_t offset = (uint32_t)strings->size;
+    buffer_put(strings, name, strlen(name) + 1);
+    return offset;
+}
+
+static void symbol_add(ObjectBuffer *symbols, uint32_t name, int binding, int type, int section, uint64_t value, uint64_t size) {
+    buffer_put_le(symbols, name, 4);
+    buffer_put_le(symbols, (binding << 4) | type, 1);
+    buffer_put_le(symbols, 0, 1);
+    buffer_put_le(symbols, section, 2);
+    buffer_put_le(symbols, value, 8);
+    buffer_put_le(symbols, size, 8);
+}
+
+static void relocation_add(ObjectBuffer *relocations, uint64_t offset, int symbol, int type, int64_t addend) {
+    buffer_put_le(relocations, offset, 8);
+    buffer_put_le(relocations, ((uint64_t)symbol << 32) | type, 8);
+    buffer_put_le(relocations, (uint64_t)addend, 8);
+}
+
+static void section_header_add(ObjectBuffer *headers, uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size,
+                               uint32_t link, uint32_t info, uint64_t alignment, uint64_t entry_size) {
+    buffer_put_le(headers, name, 4);
+    buffer_put_le(headers, type, 4);
+    buffer_put_le(headers, flags, 8);
+    buffer_put_le(headers, 0, 8); // address, assigned by the linker
+    buffer_put_le(headers, offset, 8);
+    buffer_put_le(headers, size, 8);
+    buffer_put_le(headers, link, 4);
+    buffer_put_le(headers, info, 4);
+    buffer_put_le(headers, alignment, 8);
+    buffer_put_le(headers, entry_size, 8);
+}
+
+static int helper_symbol(uint8_t code) {
+    switch (code) {
+    case PrintlnIntCode:
+        return PrintlnIntSymbol;
+    case PrintlnBoolCode:
+        return PrintlnBoolSymbol;
+    default:
+        return PrintlnStrSymbol;
+    }
+}
+
+int object_write(Instruction *program, size_t program_size, Constant *constants, int constants_size, int stack_capacity,
+                 int max_frame_size, FILE *out) {
+    if (max_frame_size > stack_capacity) {
+        printf("Stack overflow: program needs %d stack slots, limit is %d\n", max_frame_size, stack_capacity);
+        return 1;
+    }
+    JitAssembly assembly;
+    if (jit_assemble(&assembly, program, (int)program_size)) {
+        return 1;
+    }
+
+    // .rodata: the stack capacity, then every string constant
+    ObjectBuffer rodata = {0};
+    buffer_put_le(&rodata, (uint32_t)stack_capacity, 4);
+    uint64_t *string_offsets = malloc((constants_size + 1) * sizeof(uint64_t));
+    for (int i = 0; i < constants_size; i++) {
+        // the compiler keeps the empty string as NULL
+        const char *string = constants[i].string_data == NULL ? "" : constants[i].string_data;
+        string_offsets[i] = rodata.size;
+        buffer_put(&rodata, string, strlen(string) + 1);
+    }
+
+    // a movabs loads every address in the stencils; position independent code wants "lea rax, [rip + disp32]"
+    // instead, which is padded back to the same 10 bytes with a 3 byte nop
+    ObjectBuffer relocations = {0};
+    int has_error = 0;
+    for (int i = 0; i < assembly.addresses_size; i++) {
+        JitAddress address = assembly.addresses[i];
+        uint8_t *movabs = assembly.code + address.offset - 2;
+        if (movabs[0] != 0x48 || movabs[1] != 0xb8) {
+            printf("Object: unexpected address hole at %d\n", address.offset);
+            has_error = 1;
+            break;
+        }
+        static const uint8_t lea[] = {0x48, 0x8d, 0x05, 0, 0, 0, 0, 0x0f, 0x1f, 0x00};
+        memcpy(movabs, lea, sizeof(lea));
+        // rip points right after the displacement, 4 bytes past where the relocation is applied
+        uint64_t displacement = address.offset + 1;
+        switch (address.kind) {
+        case JitAddressConstant:
+            relocation_add(&relocations, displacement, RodataSymbol, R_X86_64_PC32, (int64_t)string_offsets[address.arg] - 4);
+            break;
+        case JitAddressStackLimit:
+            relocation_add(&relocations, displacement, BssSymbol, R_X86_64_PC32,
+                           (int64_t)(stack_capacity - max_frame_size) * (int64_t)sizeof(Constant) - 4);
+            break;
+        case JitAddressHelper:
+            relocation_add(&relocations, displacement, helper_symbol(address.code), R_X86_64_PLT32, -4);
+            break;
+        }
+    }
+    free(string_offsets);
+    if (has_error) {
+        jit_assembly_free(&assembly);
+        free(rodata.data);
+        free(relocations.data);
+        return 1;
+    }
+
+    ObjectBuffer strings = {0};
+    ObjectBuffer symbols = {0};
+    string_add(&strings, "");
+    symbol_add(&symbols, 0, STB_LOCAL, STT_NOTYPE, 0, 0, 0);
+    symbol_add(&symbols, 0, STB_LOCAL, STT_SECTION, TextSection, 0, 0);
+    symbol_add(&symbols, 0, STB_LOCAL, STT_SECTION, RodataSection, 0, 0);
+    symbol_add(&symbols, 0, STB_LOCAL, STT_SECTION, BssSection, 0, 0);
+    uint64_t stack_bytes = (uint64_t)stack_capacity * sizeof(Constant);
+    symbol_add(&symbols, string_add(&strings, "cimpl_program"), STB_GLOBAL, STT_FUNC, TextSection, 0, assembly.size);
+    symbol_add(&symbols, string_add(&strings, "cimpl_stack"), STB_GLOBAL, STT_OBJECT, BssSection, 0, stack_bytes);
+    symbol_add(&symbols, string_add(&strings, "cimpl_stack_capacity"), STB_GLOBAL, STT_OBJECT, RodataSection, 0, 4);
+    symbol_add(&symbols, string_add(&strings, "cimpl_println_int"), STB_GLOBAL, STT_NOTYPE, 0, 0, 0);
+    symbol_add(&symbols, string_add(&strings, "cimpl_println_bool"), STB_GLOBAL, STT_NOTYPE, 0, 0, 0);
+    symbol_add(&symbols, string_add(&strings, "cimpl_println_str"), STB_GLOBAL, STT_NOTYPE, 0, 0, 0);
+
+    ObjectBuffer section_names = {0};
+    uint32_t names[SectionsSize] = {0};
+    string_add(&section_names, "");
+    names[TextSection] = string_add(&section_names, ".text");
+    names[RodataSection] = string_add(&section_names, ".rodata");
+    names[BssSection] = string_add(&section_names, ".bss");
+    names[SymtabSection] = string_add(&section_names, ".symtab");
+    names[StrtabSection] = string_add(&section_names, ".strtab");
+    names[RelaTextSection] = string_add(&section_names, ".rela.text");
+    names[NoteStackSection] = string_add(&section_names, ".note.GNU-stack");
+    names[ShstrtabSection] = string_add(&section_names, ".shstrtab");
+
+    // file layout: ELF header, the section contents in order, then the section header table
+    ObjectBuffer file = {0};
+    ObjectBuffer headers = {0};
+    buffer_put_zeros(&file, 64);
+    buffer_put_zeros(&headers, ELF_SECTION_HEADER_SIZE);
+    buffer_align(&file, 16);
+    section_header_add(&headers, names[TextSection], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, file.size, assembly.size, 0, 0, 16, 0);
+    buffer_put(&file, assembly.code, assembly.size);
+    buffer_align(&file, 8);
+    section_header_add(&headers, names[RodataSection], SHT_PROGBITS, SHF_ALLOC, file.size, rodata.size, 0, 0, 8, 0);
+    buffer_put(&file, rodata.data, rodata.size);
+    section_header_add(&headers, names[BssSection], SHT_NOBITS, SHF_ALLOC | SHF_WRITE, file.size, stack_bytes, 0, 0, 16, 0);
+    buffer_align(&file, 8);
+    section_header_add(&headers, names[SymtabSection], SHT_SYMTAB, 0, file.size, symbols.size, StrtabSection, ProgramSymbol, 8,
+                       ELF_SYMBOL_SIZE);
+    buffer_put(&file, symbols.data, symbols.size);
+    section_header_add(&headers, names[StrtabSection], SHT_STRTAB, 0, file.size, strings.size, 0, 0, 1, 0);
+    buffer_put(&file, strings.data, strings.size);
+    buffer_align(&file, 8);
+    section_header_add(&headers, names[RelaTextSection], SHT_RELA, SHF_INFO_LINK, file.size, relocations.size, SymtabSection,
+                       TextSection, 8, ELF_RELA_SIZE);
+    buffer_put(&file, relocations.data, relocations.size);
+    section_header_add(&headers, names[NoteStackSection], SHT_PROGBITS, 0, file.size, 0, 0, 0, 1, 0);
+    section_header_add(&headers, names[ShstrtabSection], SHT_STRTAB, 0, file.size, section_names.size, 0, 0, 1, 0);
+    buffer_put(&file, section_names.data, section_names.size);
+    buffer_align(&file, 8);
+    uint64_t headers_offset = file.size;
+    buffer_put(&file, headers.data, headers.size);
+
+    // the ELF header goes into the space left at the start
+    ObjectBuffer header = {0};
+    static const uint8_t ident[] = {0x7f, 'E', 'L', 'F', 2 /* 64-bit */, 1 /* little-endian */, 1 /* version */, 0 /* System V */};
+    buffer_put(&header, ident, sizeof(ident));
+    buffer_put_le(&header, 0, 8);
+    buffer_put_le(&header, 1, 2);  // ET_REL
+    buffer_put_le(&header, 62, 2); // EM_X86_64
+    buffer_put_le(&header, 1, 4);  // version
+    buffer_put_le(&header, 0, 8);  // entry
+    buffer_put_le(&header, 0, 8);  // program headers
+    buffer_put_le(&header, headers_offset, 8);
+    buffer_put_le(&header, 0, 4);  // flags
+    buffer_put_le(&header, 64, 2); // header size
+    buffer_put_le(&header, 0, 2);  // program header entry size
+    buffer_put_le(&header, 0, 2);  // program header count
+    buffer_put_le(&header, ELF_SECTION_HEADER_SIZE, 2);
+    buffer_put_le(&header, SectionsSize, 2);
+    buffer_put_le(&header, ShstrtabSection, 2);
+    memcpy(file.data, header.data, header.size);
+
+    int write_error = fwrite(file.data, 1, file.size, out) != file.size;
+    if (write_error) {
+        printf("Object: failed to write the file\n");
+    }
+    jit_assembly_free(&assembly);
+    free(rodata.data);
+    free(relocations.data);
+    free(strings.data);
+    free(symbols.data);
+    free(section_names.data);
+    free(headers.data);
+    free(header.data);
+    free(file.data);
+    return write_error;
+}
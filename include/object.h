@@ -0,0 +1,18 @@
+#ifndef object_h
+#define object_h
+#include "bytecode.h"
+#include <stdio.h>
+
+// Native backend: writes the stack bytecode as a relocatable x86-64 ELF object, using the JIT's stencils
+// with every absolute address turned into a rip-relative relocation. The object defines
+//   int cimpl_program(Constant *stack, void *frames, void *frames_limit) - the whole program
+//   Constant cimpl_stack[]                                              - its operand stack
+//   const int cimpl_stack_capacity
+// and calls cimpl_println_int/bool/str, which come with main from bin/cimpl_runtime.o:
+//   cc program.o bin/cimpl_runtime.o -o program
+
+// Returns 1 (after printing the reason) when the program can't be translated.
+int object_write(Instruction *program, size_t program_size, Constant *constants, int constants_size, int stack_capacity,
+                 int max_frame_size, FILE *out);
+
+#endif
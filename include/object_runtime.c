@@ -0,0 +1,40 @@
+// Runtime support linked with objects written by object_write (cimpl -o): main, which gives the program
+// its call records and runs it, and the println functions the generated code calls. Built on its own into
+// bin/cimpl_runtime.o, it only depends on the C library.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// same layout as Constant, passed in rdi by the generated code
+typedef union {
+    int int_data;
+    char *string_data;
+} RuntimeValue;
+
+// same layout as the JIT's call record
+typedef struct {
+    void *return_address;
+    RuntimeValue *base;
+} RuntimeFrame;
+
+extern int cimpl_program(RuntimeValue *stack, RuntimeFrame *frames, RuntimeFrame *frames_limit);
+extern RuntimeValue cimpl_stack[];
+extern const int cimpl_stack_capacity;
+
+void cimpl_println_int(RuntimeValue data) { printf("%d\n", data.int_data); }
+
+void cimpl_println_bool(RuntimeValue data) { printf(data.int_data ? "true\n" : "false\n"); }
+
+void cimpl_println_str(RuntimeValue data) { printf("%s\n", data.string_data); }
+
+int main(void) {
+    // one call record per stack slot, like jit_run
+    RuntimeFrame *frames = malloc(sizeof(RuntimeFrame) * cimpl_stack_capacity);
+    int overflow_at = cimpl_program(cimpl_stack, frames, frames + cimpl_stack_capacity);
+    if (overflow_at >= 0) {
+        fflush(stdout);
+        fprintf(stderr, "Stack overflow at %d\n", overflow_at);
+    }
+    free(frames);
+    return overflow_at >= 0;
+}
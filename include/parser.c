@@ -11,10 +11,12 @@ static void advance(ParseCache *cache, size_t step) { cache->current += step; }
 
 static Token *peek(ParseCache *cache, size_t step) { return &cache->tokens[cache->current + step]; }
 
+static uint32_t token_index(ParseCache *cache, Token *token) { return (uint32_t)(token - cache->tokens); }
+
 static void add_error(ParseCache *cache, char *message, Token *token) {
-    Error *err = malloc(sizeof(Error));
+    Error *err = arena_alloc(cache->arena, sizeof(Error));
     err->type = ParseError;
-    err->message = malloc(strlen(message) + 1);
+    err->message = arena_alloc(cache->arena, strlen(message) + 1);
     strcpy(err->message, message);
     err->token = token;
     cache->err = err;
@@ -42,9 +44,9 @@ static void parse_fn_params(ParseCache *cache, FunctionType *fn_type) {
         FnParam param;
         fn_param_init(&param);
         param.datatype = param_type;
-        param.name = name;
+        param.name = token_index(cache, name);
         fn_type->params_size++;
-        fn_type->params = realloc(fn_type->params, sizeof(FnParam *) * fn_type->params_size);
+        fn_type->params = arena_grow(cache->arena, fn_type->params, sizeof(FnParam) * (fn_type->params_size - 1), sizeof(FnParam) * fn_type->params_size);
         fn_type->params[fn_type->params_size - 1] = param;
         advance(cache, 1);
         if (peek(cache, 0)->ttype == Comma) {
@@ -62,36 +64,22 @@ static void parse_fn_params(ParseCache *cache, FunctionType *fn_type) {
 static GenericDT *parse_type(ParseCache *cache) {
     Token *token = &cache->tokens[cache->current];
     switch (token->ttype) {
-    case IntType: {
-        GenericDT *datatype = generic_datatype_create();
-        datatype->type = Simple;
-        datatype->data.simple_datatype = Int;
-        return datatype;
-    }
-    case BoolType: {
-        GenericDT *datatype = generic_datatype_create();
-        datatype->type = Simple;
-        datatype->data.simple_datatype = Bool;
-        return datatype;
-    }
-    case StringType: {
-        GenericDT *datatype = generic_datatype_create();
-        datatype->type = Simple;
-        datatype->data.simple_datatype = String;
-        return datatype;
-    }
+    case IntType:
+        return simple_datatype_get(Int);
+    case BoolType:
+        return simple_datatype_get(Bool);
+    case StringType:
+        return simple_datatype_get(String);
     case Fn: {
-        GenericDT *datatype = generic_datatype_create();
-        FunctionType *fn_type = malloc(sizeof(FunctionType));
+        // collected in place and interned once complete
+        FunctionType fn_type_data;
+        FunctionType *fn_type = &fn_type_data;
         function_type_init(fn_type);
         GenericDT *return_type;
-        datatype->type = Complex;
         if (peek(cache, 1)->ttype != LParen) {
             add_error(cache, "expected list of arguments", token);
             return NULL;
         }
-        fn_type->params_size = 0;
-        fn_type->params = NULL;
         advance(cache, 2);
         if (peek(cache, 0)->ttype != RParen) {
             while (1) {
@@ -102,9 +90,9 @@ static GenericDT *parse_type(ParseCache *cache) {
                     return NULL;
                 }
                 param.datatype = param_type;
-                param.name = NULL;
                 fn_type->params_size++;
-                FnParam *new_params = realloc(fn_type->params, fn_type->params_size * sizeof(FnParam));
+                FnParam *new_params =
+                    arena_grow(cache->arena, fn_type->params, (fn_type->params_size - 1) * sizeof(FnParam), fn_type->params_size * sizeof(FnParam));
                 new_params[fn_type->params_size - 1] = param;
                 fn_type->params = new_params;
                 advance(cache, 1);
@@ -122,9 +110,7 @@ static GenericDT *parse_type(ParseCache *cache) {
         }
         Token *next = peek(cache, 1);
         if (next->ttype != Colon) {
-            return_type = generic_datatype_create();
-            return_type->type = Simple;
-            return_type->data.simple_datatype = Void;
+            return_type = simple_datatype_get(Void);
         } else {
             advance(cache, 2);
             return_type = parse_type(cache);
@@ -133,8 +119,7 @@ static GenericDT *parse_type(ParseCache *cache) {
             }
         }
         fn_type->return_type = return_type;
-        datatype->data.fn_datatype = fn_type;
-        return datatype;
+        return fn_datatype_intern(cache->ast, fn_type);
     }
     default: {
         add_error(cache, "expected type specification", token);
@@ -143,27 +128,25 @@ static GenericDT *parse_type(ParseCache *cache) {
     }
 };
 
-Call *parse_fn_call(ParseCache *cache) {
-    Call *call = malloc(sizeof(Call));
-    call_init(call);
-    Token *name = peek(cache, 0);
-    call->call_name = name;
+// arguments are parsed onto pending_args and moved into the Ast together once the call is complete,
+// so they end up next to each other even when they contain calls themselves
+static void parse_fn_call(ParseCache *cache, Expression *call) {
+    expression_init(call, FnCallExp, (uint32_t)cache->current);
     advance(cache, 2);
-    Token *current = peek(cache, 0);
+    uint32_t args_start = cache->pending_args_size;
     int has_args = peek(cache, 0)->ttype != RParen;
-    if (has_args) {
-    } else {
-    }
     while (has_args) {
-        Token *token = peek(cache, 0);
         Expression exp;
         parse_exp(cache, PAREN_PREC, Comma, &exp);
         if (cache->err != NULL) {
-            return NULL;
+            return;
+        }
+        if (cache->pending_args_capacity <= cache->pending_args_size) {
+            uint32_t capacity = cache->pending_args_capacity ? cache->pending_args_capacity * 2 : 64;
+            cache->pending_args = arena_grow(cache->arena, cache->pending_args, cache->pending_args_size * sizeof(Expression), capacity * sizeof(Expression));
+            cache->pending_args_capacity = capacity;
         }
-        call->args_size++;
-        call->args = realloc(call->args, sizeof(Expression) * call->args_size);
-        call->args[call->args_size - 1] = exp;
+        cache->pending_args[cache->pending_args_size++] = exp;
         Token *next = peek(cache, 1);
         if (next->ttype == Comma) {
             advance(cache, 2);
@@ -173,94 +156,48 @@ Call *parse_fn_call(ParseCache *cache) {
             break;
         } else {
             add_error(cache, "expected comma or right paren", next);
-            return NULL;
+            return;
         }
     }
-
-    return call;
+    call->args = ast_add_expressions(cache->ast, cache->pending_args + args_start, cache->pending_args_size - args_start);
+    cache->pending_args_size = args_start;
 }
 
 void parse_prefix(ParseCache *cache, Expression *exp) {
     Token *token = peek(cache, 0);
+    uint32_t index = token_index(cache, token);
     switch (token->ttype) {
-    case Number: {
-        OpExpression *number = malloc(sizeof(OpExpression));
-        op_expression_init(number);
-        GenericDT *datatype = generic_datatype_create();
-        exp->type = ExpExp;
-        datatype->type = Simple;
-        datatype->data.simple_datatype = Int;
-        number->datatype = datatype;
-        number->token = token;
-        number->right = NULL;
-        number->left = NULL;
-        exp->data.exp = number;
+    case Number:
+        expression_init(exp, ExpExp, index);
+        exp->datatype = simple_datatype_get(Int);
         return;
-    }
     case True:
-    case False: {
-        OpExpression *bool = malloc(sizeof(OpExpression));
-        op_expression_init(bool);
-        GenericDT *datatype = generic_datatype_create();
-        exp->type = ExpExp;
-        datatype->type = Simple;
-        datatype->data.simple_datatype = Bool;
-        bool->datatype = datatype;
-        bool->token = token;
-        bool->left = NULL;
-        bool->right = NULL;
-        exp->data.exp = bool;
+    case False:
+        expression_init(exp, ExpExp, index);
+        exp->datatype = simple_datatype_get(Bool);
         return;
-    }
     case Not: {
         advance(cache, 1);
-        Expression *sub_exp = malloc(sizeof(Expression));
-        parse_prefix(cache, sub_exp);
+        Expression sub_exp;
+        parse_prefix(cache, &sub_exp);
         if (cache->err != NULL) {
             return;
         }
-        OpExpression *bool = malloc(sizeof(OpExpression));
-        op_expression_init(bool);
-        GenericDT *datatype = generic_datatype_create();
-        exp->type = ExpExp;
-        datatype->type = Simple;
-        datatype->data.simple_datatype = Bool;
-        bool->datatype = datatype;
-        bool->token = token;
-        bool->left = sub_exp;
-        exp->data.exp = bool;
+        expression_init(exp, ExpExp, index);
+        exp->datatype = simple_datatype_get(Bool);
+        exp->left = ast_add_expression(cache->ast, &sub_exp);
         return;
     }
-    case Text: {
-        OpExpression *string = malloc(sizeof(OpExpression));
-        op_expression_init(string);
-        GenericDT *datatype = generic_datatype_create();
-        exp->type = ExpExp;
-        datatype->type = Simple;
-        datatype->data.simple_datatype = String;
-        string->datatype = datatype;
-        string->token = token;
-        string->right = NULL;
-        string->left = NULL;
-        exp->data.exp = string;
+    case Text:
+        expression_init(exp, ExpExp, index);
+        exp->datatype = simple_datatype_get(String);
         return;
-    }
     case Identifier: {
         if (peek(cache, 1)->ttype != LParen) {
-            OpExpression *id = malloc(sizeof(OpExpression));
-            op_expression_init(id);
-            id->token = token;
-            exp->type = ExpExp;
-            exp->data.exp = id;
-            return;
-        }
-        exp->type = FnCallExp;
-        Call *fn_call = parse_fn_call(cache);
-        Token *cur_t = peek(cache, 0);
-        if (cache->err != NULL) {
+            expression_init(exp, ExpExp, index);
             return;
         }
-        exp->data.fn_call = fn_call;
+        parse_fn_call(cache, exp);
         return;
     }
     case LParen:
@@ -298,82 +235,81 @@ static void parse_exp(ParseCache *cache, int prec, TokenType end, Expression *ex
             return;
         }
         Expression next_left;
-        GenericDT *datatype = generic_datatype_create();
-        OpExpression *op_exp = malloc(sizeof(OpExpression));
-        op_expression_init(op_exp);
-        next_left.type = ExpExp;
-        datatype->type = Simple;
+        expression_init(&next_left, ExpExp, token_index(cache, op));
         switch (op->ttype) {
         case Plus:
         case Minus:
         case Star:
         case Slash:
         case Mod: {
-            datatype->data.simple_datatype = Int;
+            next_left.datatype = simple_datatype_get(Int);
             break;
         }
         default: {
-            datatype->data.simple_datatype = Bool;
+            next_left.datatype = simple_datatype_get(Bool);
             break;
         }
         }
         advance(cache, 2);
-        Expression *right = malloc(sizeof(Expression));
-        parse_exp(cache, op_prec, end, right);
+        Expression right;
+        parse_exp(cache, op_prec, end, &right);
         if (cache->err != NULL) {
             return;
         }
-        Expression *allocated_left = malloc(sizeof(Expression));
-        *allocated_left = left;
-        op_exp->token = op;
-        op_exp->left = allocated_left;
-        op_exp->right = right;
-        op_exp->datatype = datatype;
-        next_left.data.exp = op_exp;
+        next_left.left = ast_add_expression(cache->ast, &left);
+        next_left.right = ast_add_expression(cache->ast, &right);
         left = next_left;
     }
     *exp = left;
 }
 
-Oneliner *parse_oneliner(ParseCache *cache, TokenType end) {
-    Oneliner *ol = malloc(sizeof(Oneliner));
+// parses an expression and adds it to the Ast, AST_NONE on errors
+static AstIndex parse_exp_node(ParseCache *cache, int prec, TokenType end) {
+    Expression exp;
+    parse_exp(cache, prec, end, &exp);
+    if (cache->err != NULL) {
+        return AST_NONE;
+    }
+    return ast_add_expression(cache->ast, &exp);
+}
+
+AstIndex parse_oneliner(ParseCache *cache, TokenType end) {
+    Oneliner ol;
     Token *token = peek(cache, 0);
 
     if (token->ttype == Println) {
-        ol->type = PrintlnOL;
-        ol->data.println = malloc(sizeof(PrintlnCmd));
+        ol.type = PrintlnOL;
         advance(cache, 1);
-        Expression *exp = malloc(sizeof(Expression));
-        parse_exp(cache, EOF_PREC, Semicolon, exp);
+        ol.index = parse_exp_node(cache, EOF_PREC, Semicolon);
         if (cache->err != NULL) {
-            return NULL;
+            return AST_NONE;
         }
-        ol->data.println->exp = exp;
-        return ol;
+        return ast_add_oneliner(cache->ast, &ol);
     }
 
     Token *next = peek(cache, 1);
     if (next->ttype == LParen) {
-        ol->type = CallOL;
-        ol->data.call = parse_fn_call(cache);
+        ol.type = CallOL;
+        Expression call;
+        parse_fn_call(cache, &call);
         if (cache->err != NULL) {
-            return NULL;
+            return AST_NONE;
         }
-        return ol;
+        ol.index = ast_add_expression(cache->ast, &call);
+        return ast_add_oneliner(cache->ast, &ol);
     }
-    ol->type = AssignmentOL;
-    Assignment *ass = malloc(sizeof(Assignment));
-    assignment_init(ass);
-    ass->var = token;
+    ol.type = AssignmentOL;
+    Assignment ass;
+    assignment_init(&ass);
+    ass.var = token_index(cache, token);
     switch (next->ttype) {
     case Inc:
     case Dec:
-        ass->op = next;
-        ass->new_var = 0;
-        ass->exp = NULL;
-        ol->data.assignment = ass;
+        ass.op = token_index(cache, next);
+        ass.new_var = 0;
+        ol.index = ast_add_assignment(cache->ast, &ass);
         advance(cache, 1);
-        return ol;
+        return ast_add_oneliner(cache->ast, &ol);
     case Eq:
     case ColEq:
     case PlusEq:
@@ -381,86 +317,73 @@ Oneliner *parse_oneliner(ParseCache *cache, TokenType end) {
     case StarEq:
     case SlashEq:
     case ModEq:
-        ass->op = next;
-        ass->new_var = next->ttype == ColEq;
+        ass.op = token_index(cache, next);
+        ass.new_var = next->ttype == ColEq;
         advance(cache, 1);
         break;
     case Colon:
-        ass->new_var = 1;
+        ass.new_var = 1;
         advance(cache, 2);
         GenericDT *datatype = parse_type(cache);
         if (cache->err != NULL) {
-            return NULL;
+            return AST_NONE;
         }
-        ass->datatype = datatype;
+        ass.datatype = datatype;
         next = peek(cache, 1);
         if (next->ttype != Eq) {
             add_error(cache, "expected =", next);
-            return NULL;
+            return AST_NONE;
         }
-        ass->op = next;
+        ass.op = token_index(cache, next);
         advance(cache, 1);
         break;
     default:
         add_error(cache, "unexpected operator", next);
-        return NULL;
+        return AST_NONE;
     }
     advance(cache, 1);
-    Expression *exp = malloc(sizeof(Expression));
-    parse_exp(cache, EOF_PREC, end, exp);
+    ass.exp = parse_exp_node(cache, EOF_PREC, end);
     if (cache->err != NULL) {
-        return NULL;
+        return AST_NONE;
     }
-    ass->exp = exp;
-    ol->data.assignment = ass;
-
-    return ol;
+    ol.index = ast_add_assignment(cache->ast, &ass);
+    return ast_add_oneliner(cache->ast, &ol);
 }
 
-void stmts_append(Stmt **stmts, size_t *stmts_size, size_t *stmts_capacity, Stmt *stmt) {
-    if (*stmts_capacity <= *stmts_size) {
-        if (*stmts_capacity == 0) {
-            *stmts_capacity = 128;
-        } else {
-            *stmts_capacity *= 2;
-        }
-        Stmt *new_stmts = realloc(*stmts, (*stmts_capacity) * sizeof(Stmt));
-        *stmts = new_stmts;
+static void stmts_append(ParseCache *cache, StmtType type, Token *token, AstIndex index) {
+    if (cache->pending_stmts_capacity <= cache->pending_stmts_size) {
+        uint32_t capacity = cache->pending_stmts_capacity ? cache->pending_stmts_capacity * 2 : 128;
+        cache->pending_stmts = arena_grow(cache->arena, cache->pending_stmts, cache->pending_stmts_size * sizeof(Stmt), capacity * sizeof(Stmt));
+        cache->pending_stmts_capacity = capacity;
     }
-    (*stmts)[*stmts_size] = *stmt;
-    (*stmts_size)++;
+    Stmt stmt = {.type = type, .token = token_index(cache, token), .index = index};
+    cache->pending_stmts[cache->pending_stmts_size++] = stmt;
 }
 
-void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_t *stmts_capacity) {
+void parse(ParseCache *cache, int block, AstList *stmts) {
+    // statements of nested blocks go on top of these and are moved out before the next one is added
+    uint32_t start = cache->pending_stmts_size;
+    parse_statements(cache, block);
+    *stmts = ast_add_stmts(cache->ast, cache->pending_stmts + start, cache->pending_stmts_size - start);
+    cache->pending_stmts_size = start;
+}
+
+static void parse_statements(ParseCache *cache, int block) {
     while (cache->current < cache->tokens_size) {
         Token *token = peek(cache, 0);
-        Stmt final_stmt;
+        StmtType type;
+        AstIndex index = AST_NONE;
         switch (token->ttype) {
         case LBrace: {
-            {
-                Stmt open_scope;
-                open_scope.type = OpenScopeStmt;
-                OpenScopeCmd *o_cmd = malloc(sizeof(OpenScopeCmd));
-                o_cmd->token = token;
-                open_scope.data.open_scope_cmd = o_cmd;
-                stmts_append(stmts, stmts_size, stmts_capacity, &open_scope);
-                advance(cache, 1);
-            }
-            parse(cache, 1, stmts, stmts_size, stmts_capacity);
+            // a bare block stays in the enclosing list, between the statements that open and close its scope
+            stmts_append(cache, OpenScopeStmt, token, AST_NONE);
+            advance(cache, 1);
+            parse_statements(cache, 1);
             if (cache->err != NULL) {
                 return;
             }
-
-            {
-                token = peek(cache, 0);
-                Stmt close_scope;
-                close_scope.type = CloseScopeStmt;
-                CloseScopeCmd *c_cmd = malloc(sizeof(CloseScopeCmd));
-                c_cmd->token = token;
-                close_scope.data.close_scope_cmd = c_cmd;
-                stmts_append(stmts, stmts_size, stmts_capacity, &close_scope);
-                advance(cache, 1);
-            }
+            stmts_append(cache, CloseScopeStmt, peek(cache, 0), AST_NONE);
+            advance(cache, 1);
             continue;
         }
         case RBrace: {
@@ -474,10 +397,7 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                 add_error(cache, "expected semicolon at the end of the statement", token);
                 return;
             }
-            final_stmt.type = BreakStmt;
-            BreakCmd *cmd = malloc(sizeof(BreakCmd));
-            cmd->token = token;
-            final_stmt.data.break_cmd = cmd;
+            type = BreakStmt;
             advance(cache, 1);
             break;
         }
@@ -486,44 +406,34 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                 add_error(cache, "expected semicolon at the end of the statement", token);
                 return;
             }
-            final_stmt.type = ContinueStmt;
-            ContinueCmd *cmd = malloc(sizeof(ContinueCmd));
-            cmd->token = token;
-            final_stmt.data.continue_cmd = cmd;
+            type = ContinueStmt;
             advance(cache, 1);
             break;
         }
         case Return: {
-            ReturnCmd *cmd = malloc(sizeof(ReturnCmd));
-            return_cmd_init(cmd);
             advance(cache, 1);
             if (peek(cache, 0)->ttype != Semicolon) {
-                cmd->exp = malloc(sizeof(Expression));
-                parse_exp(cache, EOF_PREC, Semicolon, cmd->exp);
+                index = parse_exp_node(cache, EOF_PREC, Semicolon);
                 if (cache->err != NULL) {
                     return;
                 }
                 advance(cache, 1);
             }
-            final_stmt.type = ReturnStmt;
-            cmd->token = token;
-            final_stmt.data.return_cmd = cmd;
+            type = ReturnStmt;
             Token *last = peek(cache, 0);
             if (last->ttype != Semicolon) {
                 add_error(cache, "expected semicolon at the end of the statement", last);
                 return;
             }
-            final_stmt = final_stmt;
             break;
         }
         case Println:
         case Identifier: {
-            final_stmt.type = OnelinerStmt;
-            Oneliner *ol = parse_oneliner(cache, Semicolon);
+            type = OnelinerStmt;
+            index = parse_oneliner(cache, Semicolon);
             if (cache->err != NULL) {
                 return;
             }
-            final_stmt.data.oneliner = ol;
             advance(cache, 1);
             if (peek(cache, 0)->ttype != Semicolon) {
                 add_error(cache, "expected semicolon at the end of the statement", token);
@@ -533,29 +443,25 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
         }
         case If:
         case While: {
-            Conditional *conditional = malloc(sizeof(Conditional));
-            conditional_init(conditional);
-            final_stmt.type = ConditionalStmt;
-            conditional->token = token;
+            Conditional conditional;
+            conditional_init(&conditional);
+            type = ConditionalStmt;
             advance(cache, 1);
-            Expression *cond = malloc(sizeof(Expression));
-            parse_exp(cache, EOF_PREC, LBrace, cond);
+            conditional.condition = parse_exp_node(cache, EOF_PREC, LBrace);
             if (cache->err != NULL) {
                 return;
             }
-            conditional->condition = cond;
             if (peek(cache, 1)->ttype != LBrace) {
                 add_error(cache, "no block provided for conditional", token);
                 return;
             }
             advance(cache, 2);
-            size_t then_capacity = 0;
-            parse(cache, 1, &conditional->then_block, &(conditional->then_size), &then_capacity);
+            parse(cache, 1, &conditional.then_block);
             if (cache->err != NULL) {
                 return;
             }
             if (peek(cache, 1)->ttype != Else) {
-                final_stmt.data.conditional = conditional;
+                index = ast_add_conditional(cache->ast, &conditional);
                 break;
             }
             if (peek(cache, 2)->ttype != LBrace) {
@@ -563,21 +469,19 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                 return;
             }
             advance(cache, 3);
-            size_t else_capacity = 0;
-            parse(cache, 1, &conditional->else_block, &(conditional->else_size), &else_capacity);
+            parse(cache, 1, &conditional.else_block);
             if (cache->err != NULL) {
                 return;
             }
-            final_stmt.data.conditional = conditional;
+            index = ast_add_conditional(cache->ast, &conditional);
             break;
         }
         case For: {
-            final_stmt.type = ForStmt;
-            ForLoop *for_loop = malloc(sizeof(ForLoop));
-            for_loop_init(for_loop);
-            for_loop->token = token;
+            type = ForStmt;
+            ForLoop for_loop;
+            for_loop_init(&for_loop);
             advance(cache, 1);
-            Oneliner *init = parse_oneliner(cache, Semicolon);
+            AstIndex init = parse_oneliner(cache, Semicolon);
             if (cache->err != NULL) {
                 return;
             }
@@ -585,10 +489,9 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                 add_error(cache, "expected semicolon after init", peek(cache, 0));
                 return;
             }
-            for_loop->init = init;
+            for_loop.init = init;
             advance(cache, 2);
-            Expression *cond = malloc(sizeof(Expression));
-            parse_exp(cache, EOF_PREC, Semicolon, cond);
+            AstIndex cond = parse_exp_node(cache, EOF_PREC, Semicolon);
             if (cache->err != NULL) {
                 return;
             }
@@ -596,9 +499,9 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                 add_error(cache, "expected semicolon after condition", peek(cache, 0));
                 return;
             }
-            for_loop->condition = cond;
+            for_loop.condition = cond;
             advance(cache, 2);
-            Oneliner *after = parse_oneliner(cache, Semicolon);
+            AstIndex after = parse_oneliner(cache, Semicolon);
             if (cache->err != NULL) {
                 return;
             }
@@ -606,16 +509,13 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                 add_error(cache, "expected semicolon after after", peek(cache, 0));
                 return;
             }
-            for_loop->after = after;
-            for_loop->body = NULL;
-            for_loop->body_size = 0;
+            for_loop.after = after;
             advance(cache, 2);
-            size_t body_capacity = 0;
-            parse(cache, 1, &for_loop->body, &(for_loop->body_size), &body_capacity);
+            parse(cache, 1, &for_loop.body);
             if (cache->err != NULL) {
                 return;
             }
-            final_stmt.data.for_loop = for_loop;
+            index = ast_add_for_loop(cache->ast, &for_loop);
             break;
         }
         case Fn: {
@@ -628,13 +528,13 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                 add_error(cache, "expected function parameters", peek(cache, 2));
                 return;
             }
-            FnDefinition *fn_def = malloc(sizeof(FnDefinition));
-            fn_definition_init(fn_def);
-            FunctionType *fn_type = malloc(sizeof(FunctionType));
+            FnDefinition fn_def;
+            fn_definition_init(&fn_def);
+            FunctionType *fn_type = arena_alloc(cache->arena, sizeof(FunctionType));
             function_type_init(fn_type);
             GenericDT *return_type;
-            final_stmt.type = FnStmt;
-            fn_def->name = name_token;
+            type = FnStmt;
+            fn_def.name = token_index(cache, name_token);
             advance(cache, 3);
             int has_params = peek(cache, 0)->ttype != RParen;
             if (has_params) {
@@ -650,9 +550,7 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
                     return;
                 }
             } else {
-                return_type = generic_datatype_create();
-                return_type->type = Simple;
-                return_type->data.simple_datatype = Void;
+                return_type = simple_datatype_get(Void);
             }
             if (peek(cache, 1)->ttype != LBrace) {
                 add_error(cache, "expected function body", peek(cache, 0));
@@ -660,17 +558,13 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
             }
 
             fn_type->return_type = return_type;
-            fn_def->datatype = fn_type;
-            fn_def->body = NULL;
-            fn_def->body_size = 0;
+            fn_def.datatype = fn_type;
             advance(cache, 2);
-            size_t body_capacity = 0;
-            parse(cache, 1, &fn_def->body, &(fn_def->body_size), &body_capacity);
+            parse(cache, 1, &fn_def.body);
             if (cache->err != NULL) {
                 return;
             }
-            final_stmt.data.fn_def = fn_def;
-            Token *last = peek(cache, 0);
+            index = ast_add_fn_definition(cache->ast, &fn_def);
             break;
         }
         case Eof:
@@ -684,6 +578,6 @@ void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_
         }
         }
         advance(cache, 1);
-        stmts_append(stmts, stmts_size, stmts_capacity, &final_stmt);
+        stmts_append(cache, type, token, index);
     }
 }
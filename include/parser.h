@@ -10,9 +10,20 @@ typedef struct {
     Error *err;
     TTIntHashTable *precs;
     TTIntHashTable *legal_infixes;
+    Arena *arena; // types, the error and the pending lists are allocated from it
+    Ast *ast;     // where the nodes go
+    Stmt *pending_stmts; // statements of the blocks being parsed, innermost last
+    uint32_t pending_stmts_size;
+    uint32_t pending_stmts_capacity;
+    Expression *pending_args; // arguments of the calls being parsed
+    uint32_t pending_args_size;
+    uint32_t pending_args_capacity;
 } ParseCache;
 
-void parse(ParseCache *cache, int block, Stmt **stmts, size_t *stmts_size, size_t *stmts_capacity);
+// parses a block (or the whole program when block is 0) into consecutive statements of the Ast
+void parse(ParseCache *cache, int block, AstList *stmts);
+
+static void parse_statements(ParseCache *cache, int block);
 
 static void advance(ParseCache *cache, size_t step);
 
@@ -22,6 +33,8 @@ static void add_error(ParseCache *cache, char *message, Token *token);
 
 static void parse_exp(ParseCache *cache, int prec, TokenType end, Expression *exp);
 
+static void parse_fn_call(ParseCache *cache, Expression *call);
+
 static void parse_fn_params(ParseCache *cache, FunctionType *fn_type);
 
 static GenericDT *parse_type(ParseCache *cache);
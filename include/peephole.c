@@ -0,0 +1,104 @@
+#include "peephole.h"
+#include "bytecode.h"
+#include <stdlib.h>
+
+static int is_jump(uint8_t code) { return bytecode_is_jump(code) || code == CallCode || code == TailCallCode; }
+
+static int ends_flow(uint8_t code) {
+    return code == GotoCode || code == TailCallCode || code == ReturnCode || code == ResumeCode || code == EndCode;
+}
+
+// follows a chain of GOTOs to its final target, giving up on cycles
+static int jump_destination(Instruction *program, int program_size, int target) {
+    for (int hops = 0; hops < program_size && target < program_size && program[target].code == GotoCode; hops++) {
+        if (program[target].arg == target) {
+            break;
+        }
+        target = program[target].arg;
+    }
+    return target;
+}
+
+int peephole_optimize(CompileCache *cache) {
+    Instruction *program = cache->program;
+    int program_size = cache->program_size;
+    if (program_size == 0) {
+        return 0;
+    }
+    char *removed = calloc(program_size, sizeof(char));
+    char *is_target = calloc(program_size + 1, sizeof(char));
+    int *new_index = malloc((program_size + 1) * sizeof(int));
+
+    for (int i = 0; i < program_size; i++) {
+        if (bytecode_is_jump(program[i].code)) {
+            program[i].arg = jump_destination(program, program_size, program[i].arg);
+        }
+    }
+    for (int i = 0; i < program_size; i++) {
+        if (is_jump(program[i].code)) {
+            is_target[program[i].arg] = 1;
+        }
+    }
+
+    int reachable = 1;
+    for (int i = 0; i < program_size; i++) {
+        Instruction instruction = program[i];
+        if (is_target[i]) {
+            reachable = 1;
+        }
+        if (!reachable) {
+            removed[i] = 1;
+            continue;
+        }
+        if (ends_flow(instruction.code)) {
+            reachable = 0;
+        }
+    }
+
+    // a GOTO is useless if everything between it and its target is gone, which may cascade
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = program_size - 1; i >= 0; i--) {
+            if (removed[i] || program[i].code != GotoCode || program[i].arg <= i) {
+                continue;
+            }
+            int next = i + 1;
+            while (next < program[i].arg && removed[next]) {
+                next++;
+            }
+            if (next == program[i].arg) {
+                removed[i] = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < program_size; i++) {
+        new_index[i] = kept;
+        if (!removed[i]) {
+            kept++;
+        }
+    }
+    new_index[program_size] = kept;
+
+    kept = 0;
+    for (int i = 0; i < program_size; i++) {
+        if (removed[i]) {
+            continue;
+        }
+        Instruction instruction = program[i];
+        if (is_jump(instruction.code)) {
+            instruction.arg = new_index[instruction.arg];
+        }
+        program[kept] = instruction;
+        kept++;
+    }
+    cache->program_size = kept;
+
+    free(removed);
+    free(is_target);
+    free(new_index);
+    return program_size - kept;
+}
@@ -0,0 +1,12 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+#include "bytecode_compiler.h"
+
+// Rewrites the emitted program in place:
+// - jumps to a GOTO are retargeted to where that GOTO leads
+// - GOTO to the very next instruction is dropped
+// - code after GOTO/TAIL_CALL/RETURN/RESUME/END that no jump or call can reach is dropped
+// and then fixes up every jump and call target. Returns the number of removed instructions.
+int peephole_optimize(CompileCache *cache);
+
+#endif
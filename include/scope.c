@@ -0,0 +1,57 @@
+#include "scope.h"
+#include <string.h>
+
+void scope_table_init(ScopeTable *table, Arena *arena) {
+    memset(table, 0, sizeof(ScopeTable));
+    table->arena = arena;
+}
+
+void scope_table_push(ScopeTable *table) {
+    if (table->scopes_capacity <= table->depth) {
+        int capacity = table->scopes_capacity ? table->scopes_capacity * 2 : 32;
+        table->scope_starts = arena_grow(table->arena, table->scope_starts, table->scopes_capacity * sizeof(int), capacity * sizeof(int));
+        table->scopes_capacity = capacity;
+    }
+    table->scope_starts[table->depth++] = table->entries_size;
+}
+
+void scope_table_pop(ScopeTable *table) {
+    int start = table->scope_starts[--table->depth];
+    for (int i = table->entries_size - 1; i >= start; i--) {
+        table->innermost[table->entries[i].symbol] = table->entries[i].shadowed;
+    }
+    table->entries_size = start;
+}
+
+ScopeEntry *scope_table_declare(ScopeTable *table, uint32_t symbol) {
+    if (table->symbols_capacity <= symbol) {
+        uint32_t capacity = table->symbols_capacity ? table->symbols_capacity : 256;
+        while (capacity <= symbol) {
+            capacity *= 2;
+        }
+        table->innermost = arena_grow(table->arena, table->innermost, table->symbols_capacity * sizeof(int), capacity * sizeof(int));
+        memset(table->innermost + table->symbols_capacity, 0xff, (capacity - table->symbols_capacity) * sizeof(int));
+        table->symbols_capacity = capacity;
+    }
+    if (table->entries_capacity <= table->entries_size) {
+        int capacity = table->entries_capacity ? table->entries_capacity * 2 : 64;
+        table->entries = arena_grow(table->arena, table->entries, table->entries_capacity * sizeof(ScopeEntry), capacity * sizeof(ScopeEntry));
+        table->entries_capacity = capacity;
+    }
+    int index = table->entries_size++;
+    ScopeEntry *entry = &table->entries[index];
+    entry->symbol = symbol;
+    entry->depth = table->depth - 1;
+    entry->shadowed = table->innermost[symbol];
+    entry->datatype = NULL;
+    entry->decl = AST_NONE;
+    table->innermost[symbol] = index;
+    return entry;
+}
+
+ScopeEntry *scope_table_lookup(ScopeTable *table, uint32_t symbol) {
+    if (symbol >= table->symbols_capacity || table->innermost[symbol] < 0) {
+        return NULL;
+    }
+    return &table->entries[table->innermost[symbol]];
+}
@@ -0,0 +1,45 @@
+#ifndef scope_h
+#define scope_h
+#include "arena.h"
+#include "ast.h"
+#include <stdint.h>
+
+// Names in scope while the analyzer resolves them, one table for all open scopes. Declarations go on a
+// stack, every symbol points at its innermost declaration and each declaration at the one it shadows, so
+// declaring, looking up and closing a scope don't depend on how deep the scopes are nested. Symbols are
+// dense interner ids, the table indexes them directly instead of hashing.
+typedef struct {
+    uint32_t symbol;
+    int depth;    // of the scope it was declared in, 0 for the outermost
+    int shadowed; // the declaration of the same symbol it hides, -1 for none
+    GenericDT *datatype;
+    AstIndex decl; // in the Ast's declarations
+} ScopeEntry;
+
+typedef struct {
+    Arena *arena;
+    int *innermost; // symbol -> index in entries, -1 when not declared
+    uint32_t symbols_capacity;
+    ScopeEntry *entries;
+    int entries_size;
+    int entries_capacity;
+    int *scope_starts; // entries_size when each open scope began
+    int depth;         // open scopes
+    int scopes_capacity;
+} ScopeTable;
+
+void scope_table_init(ScopeTable *table, Arena *arena);
+
+void scope_table_push(ScopeTable *table);
+
+// drops the declarations of the innermost scope and brings back what they shadowed
+void scope_table_pop(ScopeTable *table);
+
+// declares symbol in the innermost scope, the caller fills in the value. The entry is only valid
+// until the next declaration.
+ScopeEntry *scope_table_declare(ScopeTable *table, uint32_t symbol);
+
+// the innermost declaration of symbol, NULL when it isn't in scope
+ScopeEntry *scope_table_lookup(ScopeTable *table, uint32_t symbol);
+
+#endif
@@ -0,0 +1,110 @@
+#include "source.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#define SOURCE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef SOURCE_MMAP
+
+int source_load(SourceFile *source, const char *path) {
+    source->data = NULL;
+    source->size = 0;
+    source->mapping = NULL;
+    source->mapped_size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return 1;
+    }
+    size_t size = (size_t)info.st_size;
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (size % page_size) {
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            close(fd);
+            source->data = mapping;
+            source->size = size;
+            source->mapping = mapping;
+            source->mapped_size = size;
+            return 0;
+        }
+    }
+    // a file filling whole pages has nothing mapped after it to serve as the sentinel
+    char *data = malloc(size + 1);
+    size_t read_size = 0;
+    while (read_size < size) {
+        ssize_t chunk = read(fd, data + read_size, size - read_size);
+        if (chunk <= 0) {
+            break;
+        }
+        read_size += chunk;
+    }
+    close(fd);
+    if (read_size != size) {
+        free(data);
+        return 1;
+    }
+    data[size] = '\0';
+    source->data = data;
+    source->size = size;
+    return 0;
+}
+
+void source_release(SourceFile *source) {
+    if (source->mapping != NULL) {
+        munmap(source->mapping, source->mapped_size);
+    } else {
+        free(source->data);
+    }
+    source->data = NULL;
+    source->mapping = NULL;
+}
+
+#else
+
+int source_load(SourceFile *source, const char *path) {
+    source->data = NULL;
+    source->size = 0;
+    source->mapping = NULL;
+    source->mapped_size = 0;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 1;
+    }
+    long size = -1;
+    if (!fseek(file, 0, SEEK_END)) {
+        size = ftell(file);
+    }
+    if (size < 0 || fseek(file, 0, SEEK_SET)) {
+        fclose(file);
+        return 1;
+    }
+    char *data = malloc(size + 1);
+    size_t read_size = fread(data, 1, size, file);
+    fclose(file);
+    if (read_size != (size_t)size) {
+        free(data);
+        return 1;
+    }
+    data[size] = '\0';
+    source->data = data;
+    source->size = size;
+    return 0;
+}
+
+void source_release(SourceFile *source) {
+    free(source->data);
+    source->data = NULL;
+}
+
+#endif
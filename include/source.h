@@ -0,0 +1,20 @@
+#ifndef source_h
+#define source_h
+#include <stddef.h>
+
+// A script loaded for the lexer: size bytes at data, always followed by a '\0' sentinel so lookahead
+// never has to check the length. The file is mapped read-only when the byte after it can be given by the
+// mapping (the rest of its last page reads as zeros), otherwise it is read in one go into a buffer.
+typedef struct {
+    char *data;
+    size_t size;
+    void *mapping; // NULL when data was allocated
+    size_t mapped_size;
+} SourceFile;
+
+// Returns 1 when the file can't be opened or read.
+int source_load(SourceFile *source, const char *path);
+
+void source_release(SourceFile *source);
+
+#endif
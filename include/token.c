@@ -4,78 +4,54 @@
 #include <stdlib.h>
 #include <string.h>
 
-int lm_cmp(char *key1, char *key2) {
-    int len1 = strlen(key1);
-    int len2 = strlen(key2);
-    int min_len = min(len1, len2);
-    for (int i = 0; i < min_len; i++) {
-        if (key1[i] < key2[i]) {
-            return -1;
+TokenType keyword_lookup(const char *text, size_t length) {
+    switch (length) {
+    case 2:
+        switch (text[0]) {
+        case 'i':
+            return text[1] == 'f' ? If : Identifier;
+        case 'f':
+            return text[1] == 'n' ? Fn : Identifier;
         }
-        if (key1[i] > key2[i]) {
-            return 1;
+        break;
+    case 3:
+        switch (text[0]) {
+        case 'f':
+            return !memcmp(text, "for", 3) ? For : Identifier;
+        case 'i':
+            return !memcmp(text, "int", 3) ? IntType : Identifier;
+        case 's':
+            return !memcmp(text, "str", 3) ? StringType : Identifier;
         }
-    }
-    if (len1 < len2) {
-        return -1;
-    }
-    if (len1 > len2) {
-        return 1;
-    }
-    return 0;
-}
-
-void lm_insert(LexMap *map, char *lex, TokenType ttype) {
-    if (map->key == NULL) {
-        map->key = lex;
-        map->ttype = ttype;
-        return;
-    }
-    int cmp = lm_cmp(map->key, lex);
-    switch (cmp) {
-    case -1:
-        if (map->right == NULL) {
-            LexMap *right = malloc(sizeof(LexMap));
-            right->key = lex;
-            right->ttype = ttype;
-            right->left = NULL;
-            right->right = NULL;
-            map->right = right;
-            return;
+        break;
+    case 4:
+        switch (text[0]) {
+        case 'e':
+            return !memcmp(text, "else", 4) ? Else : Identifier;
+        case 'b':
+            return !memcmp(text, "bool", 4) ? BoolType : Identifier;
+        case 't':
+            return !memcmp(text, "true", 4) ? True : Identifier;
         }
-        lm_insert(map->right, lex, ttype);
-        return;
-    case 1:
-        if (map->left == NULL) {
-            LexMap *left = malloc(sizeof(LexMap));
-            left->key = lex;
-            left->ttype = ttype;
-            left->left = NULL;
-            left->right = NULL;
-            map->left = left;
-            return;
+        break;
+    case 5:
+        switch (text[0]) {
+        case 'w':
+            return !memcmp(text, "while", 5) ? While : Identifier;
+        case 'b':
+            return !memcmp(text, "break", 5) ? Break : Identifier;
+        case 'f':
+            return !memcmp(text, "false", 5) ? False : Identifier;
         }
-        lm_insert(map->left, lex, ttype);
-        return;
-    default:
-        map->ttype = ttype;
-        return;
-    }
-}
-
-TokenType lm_get(LexMap *map, char *lex) {
-    if (map == NULL) {
-        return Illegal;
-    }
-    int cmp = lm_cmp(map->key, lex);
-    switch (cmp) {
-    case -1:
-        return lm_get(map->right, lex);
-    case 1:
-        return lm_get(map->left, lex);
-    default:
-        return map->ttype;
+        break;
+    case 6:
+        return !memcmp(text, "return", 6) ? Return : Identifier;
+    case 7:
+        return !memcmp(text, "println", 7) ? Println : Identifier;
+    case 8:
+        return !memcmp(text, "continue", 8) ? Continue : Identifier;
     }
+    return Identifier;
 }
 
 LexHashTable lex_hashtable_create() {
@@ -123,11 +99,120 @@ TokenType l_ht_get(LexHashTable *table, char *lexem) {
     return table->values[hash];
 }
 
+// indexed by the unsigned byte, so characters above 0x7f don't index before the table
 void ch_ht_set(ChHashTable *table, char ch, TokenType ttype) {
-    table->values[ch] = ttype;
+    table->values[(unsigned char)ch] = ttype;
+}
+
+TokenType ch_ht_get(ChHashTable *table, char ch) { return table->values[(unsigned char)ch]; }
+
+void line_index_init(LineIndex *index, char *source, size_t source_size, Arena *arena) {
+    index->source = source;
+    index->source_size = source_size;
+    index->arena = arena;
+    index->starts = NULL;
+    index->size = 0;
+}
+
+static void line_index_build(LineIndex *index) {
+    size_t capacity = 64;
+    index->starts = arena_alloc(index->arena, capacity * sizeof(uint32_t));
+    index->starts[index->size++] = 0;
+    for (size_t i = 0; i < index->source_size; i++) {
+        if (index->source[i] != '\n') {
+            continue;
+        }
+        if (index->size == capacity) {
+            size_t size = capacity * sizeof(uint32_t);
+            capacity *= 2;
+            index->starts = arena_grow(index->arena, index->starts, size, size * 2);
+        }
+        index->starts[index->size++] = (uint32_t)(i + 1);
+    }
 }
 
-TokenType ch_ht_get(ChHashTable *table, char ch) { return table->values[ch]; }
+void line_index_locate(LineIndex *index, size_t offset, size_t *line, size_t *column) {
+    if (index->starts == NULL) {
+        line_index_build(index);
+    }
+    // last line starting at or before offset
+    size_t low = 0;
+    size_t high = index->size;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (index->starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    *line = low + 1;
+    *column = offset - index->starts[low] + 1;
+}
+
+static uint32_t interner_hash(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void interner_init(Interner *interner, char *source, Arena *arena) {
+    interner->source = source;
+    interner->arena = arena;
+    interner->size = 0;
+    interner->capacity = 64;
+    interner->starts = arena_alloc(arena, interner->capacity * sizeof(uint32_t));
+    interner->lengths = arena_alloc(arena, interner->capacity * sizeof(uint32_t));
+    interner->slots_capacity = 128;
+    interner->slots = arena_alloc(arena, interner->slots_capacity * sizeof(uint32_t));
+    memset(interner->slots, 0, interner->slots_capacity * sizeof(uint32_t));
+}
+
+static void interner_grow(Interner *interner) {
+    size_t slots_capacity = interner->slots_capacity * 2;
+    uint32_t *slots = arena_alloc(interner->arena, slots_capacity * sizeof(uint32_t));
+    memset(slots, 0, slots_capacity * sizeof(uint32_t));
+    for (uint32_t symbol = 0; symbol < interner->size; symbol++) {
+        size_t index = interner_hash(interner->source + interner->starts[symbol], interner->lengths[symbol]) & (slots_capacity - 1);
+        while (slots[index]) {
+            index = (index + 1) & (slots_capacity - 1);
+        }
+        slots[index] = symbol + 1;
+    }
+    interner->slots = slots;
+    interner->slots_capacity = slots_capacity;
+}
+
+uint32_t interner_intern(Interner *interner, uint32_t start, uint32_t end) {
+    const char *name = interner->source + start;
+    uint32_t length = end - start;
+    size_t index = interner_hash(name, length) & (interner->slots_capacity - 1);
+    while (interner->slots[index]) {
+        uint32_t symbol = interner->slots[index] - 1;
+        if (interner->lengths[symbol] == length && !memcmp(interner->source + interner->starts[symbol], name, length)) {
+            return symbol;
+        }
+        index = (index + 1) & (interner->slots_capacity - 1);
+    }
+    if (interner->size == interner->capacity) {
+        size_t size = interner->capacity * sizeof(uint32_t);
+        interner->capacity *= 2;
+        interner->starts = arena_grow(interner->arena, interner->starts, size, size * 2);
+        interner->lengths = arena_grow(interner->arena, interner->lengths, size, size * 2);
+    }
+    uint32_t symbol = interner->size++;
+    interner->starts[symbol] = start;
+    interner->lengths[symbol] = length;
+    interner->slots[index] = symbol + 1;
+    // kept at most half full
+    if (interner->size * 2 > interner->slots_capacity) {
+        interner_grow(interner);
+    }
+    return symbol;
+}
 
 char *token_view(TTHashTable *preview, Token *token, char *source) {
     switch (token->ttype) {
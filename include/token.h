@@ -1,6 +1,8 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include "arena.h"
+#include <stdint.h>
 #include <stdlib.h>
 
 // When adding new token types, DON'T FORGET TO CHECK TOKEN TYPE HASH TABLE BUCKET SIZES
@@ -73,14 +75,49 @@ typedef enum {
     Println,
 } TokenType;
 
+// 16 bytes: offsets of the first character and the one after the last, so sources are limited to 4 GiB;
+// the line and column are only worked out when something is reported, through a LineIndex
 typedef struct {
     TokenType ttype;
-    size_t ln;
-    size_t ln_start;
-    size_t start;
-    size_t end;
+    uint32_t start;
+    uint32_t end;
+    union {
+        uint32_t symbol; // Identifier: the interned name, equal for equal names
+        int32_t number;  // Number: the literal's value, decoded the way atoi would
+    };
 } Token;
 
+// Gives every distinct identifier a dense id, in order of first appearance, so later phases compare and
+// hash names as integers. Names stay slices of the source, the tables live in the arena.
+typedef struct {
+    char *source;
+    Arena *arena;
+    uint32_t *starts; // first spelling of each symbol
+    uint32_t *lengths;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t *slots; // open addressing, symbol + 1, 0 when free
+    size_t slots_capacity;
+} Interner;
+
+void interner_init(Interner *interner, char *source, Arena *arena);
+
+uint32_t interner_intern(Interner *interner, uint32_t start, uint32_t end);
+
+// where every line of a source starts, built in the arena the first time a position is looked up
+typedef struct {
+    char *source;
+    size_t source_size;
+    Arena *arena;
+    uint32_t *starts; // NULL until built
+    size_t size;
+} LineIndex;
+
+void line_index_init(LineIndex *index, char *source, size_t source_size, Arena *arena);
+
+// 1-based line and column of the character at offset
+void line_index_locate(LineIndex *index, size_t offset, size_t *line, size_t *column);
+
 typedef struct {
     Token *tokens;
     size_t size;
@@ -103,16 +140,8 @@ typedef struct {
     int values[49];
 } TTIntHashTable;
 
-typedef struct LexMap {
-    char *key;
-    TokenType ttype;
-    struct LexMap *left;
-    struct LexMap *right;
-} LexMap;
-
-void lm_insert(LexMap *map, char *lex, TokenType ttype);
-
-TokenType lm_get(LexMap *map, char *lex);
+// Identifier for anything that isn't a keyword. Looks at the source slice in place, by length and first character.
+TokenType keyword_lookup(const char *text, size_t length);
 
 LexHashTable lex_hashtable_create();
 
@@ -0,0 +1,770 @@
+#include "trace.h"
+#include "bytecode.h"
+#include "jit.h"
+#include <stdlib.h>
+#include <string.h>
+
+void trace_recorder_start(TraceRecorder *recorder, int header) {
+    recorder->active = 1;
+    recorder->completed = 0;
+    recorder->header = header;
+    recorder->size = 0;
+}
+
+int trace_record(TraceRecorder *recorder, Instruction *program, int pc) {
+    if (pc == recorder->header && recorder->size > 0) {
+        recorder->completed = 1;
+        recorder->active = 0;
+        return 0;
+    }
+    // a trace stays inside one frame and one loop, so calls, returns and jumps back to an inner loop end it
+    uint8_t code = program[pc].code;
+    int inner_loop = recorder->size > 0 && pc <= recorder->pcs[recorder->size - 1];
+    if (code == CallCode || code == TailCallCode || code == ReturnCode || code == ResumeCode || code == EnterCode || code == EndCode ||
+        inner_loop || recorder->size == TRACE_MAX_LENGTH) {
+        recorder->active = 0;
+        return 0;
+    }
+    recorder->pcs[recorder->size++] = pc;
+    return 1;
+}
+
+// the generated code uses the System V calling convention
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// x86 condition codes, flipping the low bit negates one
+enum { CondEq = 0x4, CondNotEq = 0x5, CondLt = 0xc, CondGtE = 0xd, CondLtE = 0xe, CondGt = 0xf };
+
+// deepest operand stack a trace can keep in registers
+#define TRACE_MAX_DEPTH 16
+#define TRACE_HOMES 5
+#define TRACE_TEMPS 6
+
+// The most used locals live in callee-saved registers for the whole trace, so calls to the println
+// helpers keep them. Intermediate values go to the caller-saved temps. rax and rdx are scratch for
+// moves and division, rbp holds the frame base and r11 the top-level frame for LOAD_GLOBAL/STORE_GLOBAL.
+static const uint8_t home_registers[TRACE_HOMES] = {RBX, R12, R13, R14, R15};
+static const uint8_t temp_registers[TRACE_TEMPS] = {RCX, RSI, RDI, R8, R9, R10};
+
+// what an operand stack entry holds while the trace is being compiled, nothing is pushed at run time
+typedef enum {
+    ValueImm,    // n is the value
+    ValueImm64,  // bits is the whole constant (string literals)
+    ValueLocal,  // the current value of local slot n
+    ValueGlobal, // the current value of top-level slot n
+    ValueTemp,   // in register reg
+    ValueFlags,  // 1 if condition cond holds for the flags the last instruction set
+} ValueKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t reg;
+    uint8_t cond;
+    int32_t n;
+    uint64_t bits;
+} Value;
+
+typedef enum { OperandReg, OperandMem, OperandImm } OperandKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t reg;   // the register, or the base register of a memory operand
+    int32_t value; // displacement of a memory operand or the immediate
+} Operand;
+
+// a side exit: the operand stack at the guard and the jump to patch once the exit code is placed
+typedef struct {
+    int pc;
+    int depth;
+    Value stack[TRACE_MAX_DEPTH];
+    int jump_at;
+} TraceGuard;
+
+typedef struct {
+    uint8_t *bytes;
+    int size;
+    int capacity;
+    Value stack[TRACE_MAX_DEPTH];
+    int depth;
+    int temps_used; // bit i is set while temp_registers[i] holds a value
+    int home_slots[TRACE_HOMES];
+    int home_written[TRACE_HOMES];
+    int homes_size;
+    TraceGuard *guards;
+    int guards_size;
+    int guards_capacity;
+    int failed;
+} TraceCompiler;
+
+static void emit_byte(TraceCompiler *c, uint8_t byte) {
+    if (c->size == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 256;
+        c->bytes = realloc(c->bytes, c->capacity);
+    }
+    c->bytes[c->size++] = byte;
+}
+
+static void emit32(TraceCompiler *c, int32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit_byte(c, (uint32_t)value >> (i * 8));
+    }
+}
+
+static void emit64(TraceCompiler *c, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        emit_byte(c, value >> (i * 8));
+    }
+}
+
+static void patch32(TraceCompiler *c, int at, int32_t value) { memcpy(c->bytes + at, &value, sizeof(value)); }
+
+static Operand reg_operand(int reg) { return (Operand){.kind = OperandReg, .reg = reg}; }
+
+static Operand mem_operand(int base, int32_t disp) { return (Operand){.kind = OperandMem, .reg = base, .value = disp}; }
+
+static Operand imm_operand(int32_t value) { return (Operand){.kind = OperandImm, .value = value}; }
+
+// REX prefix, opcode (one byte or 0x0f plus one) and ModRM for "opcode reg, rm", memory operands always use disp32
+static void emit_op(TraceCompiler *c, int wide, int opcode, int reg, Operand rm) {
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm.reg >= 8 ? 1 : 0);
+    if (rex != 0x40) {
+        emit_byte(c, rex);
+    }
+    if (opcode > 0xff) {
+        emit_byte(c, opcode >> 8);
+    }
+    emit_byte(c, opcode & 0xff);
+    if (rm.kind == OperandReg) {
+        emit_byte(c, 0xc0 | (reg & 7) << 3 | (rm.reg & 7));
+        return;
+    }
+    emit_byte(c, 0x80 | (reg & 7) << 3 | (rm.reg & 7));
+    if ((rm.reg & 7) == RSP) {
+        emit_byte(c, 0x24);
+    }
+    emit32(c, rm.value);
+}
+
+// mov reg, src; a 32 bit move clears the upper half
+static void emit_mov_reg(TraceCompiler *c, int wide, int reg, Operand src) {
+    if (src.kind == OperandImm) {
+        if (reg >= 8) {
+            emit_byte(c, 0x41);
+        }
+        emit_byte(c, 0xb8 + (reg & 7));
+        emit32(c, src.value);
+    } else if (src.kind != OperandReg || src.reg != reg) {
+        emit_op(c, wide, 0x8b, reg, src);
+    }
+}
+
+static void emit_mov_imm64(TraceCompiler *c, int reg, uint64_t bits) {
+    emit_byte(c, 0x48 | (reg >= 8 ? 1 : 0));
+    emit_byte(c, 0xb8 + (reg & 7));
+    emit64(c, bits);
+}
+
+// add/sub/cmp on 32 bits, alu is the /digit of the immediate form: 0 add, 5 sub, 7 cmp
+static void emit_alu(TraceCompiler *c, int alu, Operand dst, Operand src) {
+    if (src.kind == OperandImm) {
+        emit_op(c, 0, 0x81, alu, dst);
+        emit32(c, src.value);
+    } else if (dst.kind == OperandReg) {
+        emit_op(c, 0, alu * 8 + 3, dst.reg, src);
+    } else {
+        emit_op(c, 0, alu * 8 + 1, src.reg, dst);
+    }
+}
+
+static int home_index(TraceCompiler *c, int slot) {
+    for (int i = 0; i < c->homes_size; i++) {
+        if (c->home_slots[i] == slot) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static Operand value_operand(TraceCompiler *c, Value value) {
+    switch (value.kind) {
+    case ValueImm:
+        return imm_operand(value.n);
+    case ValueLocal: {
+        int home = home_index(c, value.n);
+        if (home >= 0) {
+            return reg_operand(home_registers[home]);
+        }
+        return mem_operand(RBP, value.n * (int32_t)sizeof(Constant));
+    }
+    case ValueGlobal:
+        return mem_operand(R11, value.n * (int32_t)sizeof(Constant));
+    default:
+        return reg_operand(value.reg);
+    }
+}
+
+static int temp_alloc(TraceCompiler *c) {
+    for (int i = 0; i < TRACE_TEMPS; i++) {
+        if (!(c->temps_used & (1 << i))) {
+            c->temps_used |= 1 << i;
+            return temp_registers[i];
+        }
+    }
+    c->failed = 1;
+    return RAX;
+}
+
+static void temp_release(TraceCompiler *c, Value value) {
+    if (value.kind != ValueTemp) {
+        return;
+    }
+    for (int i = 0; i < TRACE_TEMPS; i++) {
+        if (temp_registers[i] == value.reg) {
+            c->temps_used &= ~(1 << i);
+        }
+    }
+}
+
+static Value temp_value(int reg) { return (Value){.kind = ValueTemp, .reg = reg}; }
+
+static void push(TraceCompiler *c, Value value) {
+    if (c->depth == TRACE_MAX_DEPTH) {
+        c->failed = 1;
+        return;
+    }
+    c->stack[c->depth++] = value;
+}
+
+static Value pop(TraceCompiler *c) {
+    if (c->depth == 0) {
+        c->failed = 1;
+        return (Value){.kind = ValueImm};
+    }
+    return c->stack[--c->depth];
+}
+
+// flags only live until the next instruction, a comparison that does not feed a branch becomes 0/1
+static void flags_materialize(TraceCompiler *c) {
+    if (c->depth == 0 || c->stack[c->depth - 1].kind != ValueFlags) {
+        return;
+    }
+    int reg = temp_alloc(c);
+    // setcc al; movzx reg, al
+    emit_byte(c, 0x0f);
+    emit_byte(c, 0x90 | c->stack[c->depth - 1].cond);
+    emit_byte(c, 0xc0);
+    emit_op(c, 0, 0x0fb6, reg, reg_operand(RAX));
+    c->stack[c->depth - 1] = temp_value(reg);
+}
+
+// values still on the stack that read a variable about to change get a copy of its current value
+static void variable_detach(TraceCompiler *c, ValueKind kind, int slot) {
+    for (int i = 0; i < c->depth; i++) {
+        if (c->stack[i].kind == kind && c->stack[i].n == slot) {
+            int reg = temp_alloc(c);
+            emit_mov_reg(c, 1, reg, value_operand(c, c->stack[i]));
+            c->stack[i] = temp_value(reg);
+        }
+    }
+}
+
+// writes the whole constant, dst is a register or memory
+static void store_value(TraceCompiler *c, Operand dst, Value value) {
+    Operand src = value_operand(c, value);
+    if (value.kind == ValueImm64) {
+        emit_mov_imm64(c, RAX, value.bits);
+        src = reg_operand(RAX);
+    }
+    if (dst.kind == OperandReg) {
+        emit_mov_reg(c, 1, dst.reg, src);
+    } else if (src.kind == OperandImm) {
+        emit_op(c, 1, 0xc7, 0, dst);
+        emit32(c, src.value);
+    } else {
+        if (src.kind == OperandMem) {
+            emit_mov_reg(c, 1, RAX, src);
+            src = reg_operand(RAX);
+        }
+        emit_op(c, 1, 0x89, src.reg, dst);
+    }
+}
+
+static void home_written(TraceCompiler *c, int slot) {
+    int home = home_index(c, slot);
+    if (home >= 0) {
+        c->home_written[home] = 1;
+    }
+}
+
+static void compile_arithmetic(TraceCompiler *c, uint8_t code) {
+    Value right = pop(c);
+    Value left = pop(c);
+    if (code == IntDivideCode || code == IntModCode) {
+        emit_mov_reg(c, 0, RAX, value_operand(c, left));
+        Operand divisor = value_operand(c, right);
+        Value divisor_temp = {.kind = ValueImm};
+        if (divisor.kind == OperandImm) {
+            divisor_temp = temp_value(temp_alloc(c));
+            emit_mov_reg(c, 0, divisor_temp.reg, divisor);
+            divisor = reg_operand(divisor_temp.reg);
+        }
+        // cdq; idiv divisor
+        emit_byte(c, 0x99);
+        emit_op(c, 0, 0xf7, 7, divisor);
+        temp_release(c, left);
+        temp_release(c, right);
+        temp_release(c, divisor_temp);
+        int reg = temp_alloc(c);
+        emit_mov_reg(c, 0, reg, reg_operand(code == IntModCode ? RDX : RAX));
+        push(c, temp_value(reg));
+        return;
+    }
+    int reg;
+    if (left.kind == ValueTemp) {
+        reg = left.reg;
+    } else {
+        reg = temp_alloc(c);
+        emit_mov_reg(c, 0, reg, value_operand(c, left));
+    }
+    Operand src = value_operand(c, right);
+    switch (code) {
+    case IntAddCode:
+        emit_alu(c, 0, reg_operand(reg), src);
+        break;
+    case IntSubtractCode:
+        emit_alu(c, 5, reg_operand(reg), src);
+        break;
+    default:
+        if (src.kind == OperandImm) {
+            emit_op(c, 0, 0x69, reg, reg_operand(reg));
+            emit32(c, src.value);
+        } else {
+            emit_op(c, 0, 0x0faf, reg, src);
+        }
+        break;
+    }
+    temp_release(c, right);
+    push(c, temp_value(reg));
+}
+
+static int comparison_cond(uint8_t code) {
+    switch (code) {
+    case IntEqCode:
+    case GotoIfLocalEqCode:
+        return CondEq;
+    case IntNotEqCode:
+    case GotoIfLocalNotEqCode:
+        return CondNotEq;
+    case IntGtCode:
+    case GotoIfLocalGtCode:
+        return CondGt;
+    case IntLtCode:
+    case GotoIfLocalLtCode:
+        return CondLt;
+    case IntGtECode:
+    case GotoIfLocalGtECode:
+        return CondGtE;
+    default:
+        return CondLtE;
+    }
+}
+
+// the condition that holds for b ? a when it holds for a ? b
+static int mirror_cond(int cond) {
+    switch (cond) {
+    case CondGt:
+        return CondLt;
+    case CondLt:
+        return CondGt;
+    case CondGtE:
+        return CondLtE;
+    case CondLtE:
+        return CondGtE;
+    default:
+        return cond;
+    }
+}
+
+static void compile_compare(TraceCompiler *c, int cond) {
+    Value right = pop(c);
+    Value left = pop(c);
+    if (left.kind == ValueImm && right.kind != ValueImm) {
+        Value swap = left;
+        left = right;
+        right = swap;
+        cond = mirror_cond(cond);
+    }
+    Operand left_operand = value_operand(c, left);
+    Operand right_operand = value_operand(c, right);
+    if (left_operand.kind == OperandImm || (left_operand.kind == OperandMem && right_operand.kind == OperandMem)) {
+        emit_mov_reg(c, 0, RAX, left_operand);
+        left_operand = reg_operand(RAX);
+    }
+    emit_alu(c, 7, left_operand, right_operand);
+    temp_release(c, left);
+    temp_release(c, right);
+    push(c, (Value){.kind = ValueFlags, .cond = cond});
+}
+
+// sets the byte register (al or dl) to 1 if value is non-zero
+static void compile_truth(TraceCompiler *c, Value value, int byte_reg) {
+    if (value.kind == ValueImm) {
+        emit_byte(c, 0xb0 + byte_reg);
+        emit_byte(c, value.n != 0);
+        return;
+    }
+    emit_alu(c, 7, value_operand(c, value), imm_operand(0));
+    emit_byte(c, 0x0f);
+    emit_byte(c, 0x90 | CondNotEq);
+    emit_byte(c, 0xc0 | byte_reg);
+}
+
+static void compile_logic(TraceCompiler *c, uint8_t code) {
+    Value right = pop(c);
+    Value left = pop(c);
+    compile_truth(c, left, RAX);
+    compile_truth(c, right, RDX);
+    // and al, dl / or al, dl
+    emit_byte(c, code == BoolAndCode ? 0x20 : 0x08);
+    emit_byte(c, 0xd0);
+    temp_release(c, left);
+    temp_release(c, right);
+    int reg = temp_alloc(c);
+    emit_op(c, 0, 0x0fb6, reg, reg_operand(RAX));
+    push(c, temp_value(reg));
+}
+
+// jumps to a side exit when cond holds, the exit resumes the interpreter at pc
+static void guard(TraceCompiler *c, int cond, int pc) {
+    for (int i = 0; i < c->depth; i++) {
+        if (c->stack[i].kind == ValueFlags) {
+            c->failed = 1;
+        }
+    }
+    if (c->guards_size == c->guards_capacity) {
+        c->guards_capacity = c->guards_capacity ? c->guards_capacity * 2 : 16;
+        c->guards = realloc(c->guards, c->guards_capacity * sizeof(TraceGuard));
+    }
+    emit_byte(c, 0x0f);
+    emit_byte(c, 0x80 | cond);
+    emit32(c, 0);
+    TraceGuard *side_exit = &c->guards[c->guards_size++];
+    side_exit->pc = pc;
+    side_exit->depth = c->depth;
+    memcpy(side_exit->stack, c->stack, c->depth * sizeof(Value));
+    side_exit->jump_at = c->size - 4;
+}
+
+// the recorded path went on to next_pc; cond describes when the instruction jumps
+static void compile_branch(TraceCompiler *c, int cond, Instruction instruction, int pc, int next_pc) {
+    if (instruction.arg == pc + 1) {
+        return;
+    }
+    if (next_pc == instruction.arg) {
+        guard(c, cond ^ 1, pc + 1);
+    } else {
+        guard(c, cond, instruction.arg);
+    }
+}
+
+// pops a condition and returns the flags condition that holds when it is true, -1 when it is a constant
+static int condition_cond(TraceCompiler *c, int *constant) {
+    Value value = pop(c);
+    if (value.kind == ValueFlags) {
+        return value.cond;
+    }
+    if (value.kind == ValueImm) {
+        *constant = value.n != 0;
+        return -1;
+    }
+    emit_alu(c, 7, value_operand(c, value), imm_operand(0));
+    temp_release(c, value);
+    return CondNotEq;
+}
+
+static void compile_println(TraceCompiler *c, uint8_t code, uint64_t globals) {
+    Value value = pop(c);
+    // the call clobbers every temp
+    for (int i = 0; i < c->depth; i++) {
+        if (c->stack[i].kind == ValueTemp) {
+            c->failed = 1;
+        }
+    }
+    if (value.kind == ValueImm64) {
+        emit_mov_imm64(c, RDI, value.bits);
+    } else {
+        emit_mov_reg(c, 1, RDI, value_operand(c, value));
+    }
+    temp_release(c, value);
+    emit_mov_imm64(c, RAX, (uint64_t)(uintptr_t)jit_println_helper(code));
+    // call rax
+    emit_byte(c, 0xff);
+    emit_byte(c, 0xd0);
+    emit_mov_imm64(c, R11, globals);
+}
+
+static void compile_instruction(TraceCompiler *c, Instruction *program, Constant *constants, uint64_t globals, int pc, int next_pc) {
+    Instruction instruction = program[pc];
+    uint8_t code = instruction.code;
+    if (code != GotoIfCode && code != GotoIfNotCode && code != BoolNotCode) {
+        flags_materialize(c);
+    }
+    int jumps = bytecode_is_jump(code);
+    if (!jumps && next_pc != pc + 1) {
+        c->failed = 1;
+        return;
+    }
+    switch (code) {
+    case PushCode:
+        push(c, (Value){.kind = ValueImm, .n = instruction.arg});
+        break;
+    case PushConstCode: {
+        Value value = {.kind = ValueImm64};
+        memcpy(&value.bits, &constants[instruction.arg], sizeof(Constant));
+        push(c, value);
+        break;
+    }
+    case LoadCode:
+        push(c, (Value){.kind = ValueLocal, .n = instruction.arg});
+        break;
+    case LoadGlobalCode:
+        push(c, (Value){.kind = ValueGlobal, .n = instruction.arg});
+        break;
+    case StoreCode: {
+        Value value = pop(c);
+        variable_detach(c, ValueLocal, instruction.arg);
+        store_value(c, value_operand(c, (Value){.kind = ValueLocal, .n = instruction.arg}), value);
+        home_written(c, instruction.arg);
+        temp_release(c, value);
+        break;
+    }
+    case StoreGlobalCode: {
+        Value value = pop(c);
+        variable_detach(c, ValueGlobal, instruction.arg);
+        store_value(c, value_operand(c, (Value){.kind = ValueGlobal, .n = instruction.arg}), value);
+        temp_release(c, value);
+        break;
+    }
+    case IntAddCode:
+    case IntSubtractCode:
+    case IntMultiplyCode:
+    case IntDivideCode:
+    case IntModCode:
+        compile_arithmetic(c, code);
+        break;
+    case IntEqCode:
+    case IntNotEqCode:
+    case IntGtCode:
+    case IntLtCode:
+    case IntGtECode:
+    case IntLtECode:
+        compile_compare(c, comparison_cond(code));
+        break;
+    case BoolAndCode:
+    case BoolOrCode:
+        compile_logic(c, code);
+        break;
+    case BoolNotCode:
+        if (c->depth > 0 && c->stack[c->depth - 1].kind == ValueFlags) {
+            c->stack[c->depth - 1].cond ^= 1;
+        } else if (c->depth > 0 && c->stack[c->depth - 1].kind == ValueImm) {
+            c->stack[c->depth - 1].n = !c->stack[c->depth - 1].n;
+        } else {
+            Value value = pop(c);
+            emit_alu(c, 7, value_operand(c, value), imm_operand(0));
+            temp_release(c, value);
+            push(c, (Value){.kind = ValueFlags, .cond = CondEq});
+        }
+        break;
+    case GotoCode:
+        break;
+    case GotoIfCode:
+    case GotoIfNotCode: {
+        int constant = 0;
+        int cond = condition_cond(c, &constant);
+        if (cond < 0) {
+            // a constant condition always goes the way it was recorded
+            break;
+        }
+        compile_branch(c, code == GotoIfCode ? cond : cond ^ 1, instruction, pc, next_pc);
+        break;
+    }
+    case GotoIfLocalEqCode:
+    case GotoIfLocalNotEqCode:
+    case GotoIfLocalGtCode:
+    case GotoIfLocalLtCode:
+    case GotoIfLocalGtECode:
+    case GotoIfLocalLtECode:
+        emit_alu(c, 7, value_operand(c, (Value){.kind = ValueLocal, .n = instruction.local}), imm_operand(instruction.imm));
+        compile_branch(c, comparison_cond(code), instruction, pc, next_pc);
+        break;
+    case AddLocalCode:
+        variable_detach(c, ValueLocal, instruction.local);
+        emit_alu(c, 0, value_operand(c, (Value){.kind = ValueLocal, .n = instruction.local}), imm_operand(instruction.arg));
+        home_written(c, instruction.local);
+        break;
+    case PrintlnIntCode:
+    case PrintlnBoolCode:
+    case PrintlnStrCode:
+        compile_println(c, code, globals);
+        break;
+    default:
+        c->failed = 1;
+        break;
+    }
+}
+
+// gives the registers to the locals the trace touches most often
+static void homes_choose(TraceCompiler *c, TraceRecorder *recorder, Instruction *program) {
+    int *slots = malloc(recorder->size * sizeof(int));
+    int *counts = malloc(recorder->size * sizeof(int));
+    int distinct = 0;
+    for (int i = 0; i < recorder->size; i++) {
+        Instruction instruction = program[recorder->pcs[i]];
+        int slot;
+        if (instruction.code == LoadCode || instruction.code == StoreCode) {
+            slot = instruction.arg;
+        } else if (instruction.code == AddLocalCode || (instruction.code >= GotoIfLocalEqCode && instruction.code <= GotoIfLocalLtECode)) {
+            slot = instruction.local;
+        } else {
+            continue;
+        }
+        int j = 0;
+        while (j < distinct && slots[j] != slot) {
+            j++;
+        }
+        if (j == distinct) {
+            slots[distinct] = slot;
+            counts[distinct] = 0;
+            distinct++;
+        }
+        counts[j]++;
+    }
+    while (c->homes_size < TRACE_HOMES) {
+        int best = -1;
+        for (int j = 0; j < distinct; j++) {
+            if (counts[j] > 0 && (best < 0 || counts[j] > counts[best])) {
+                best = j;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        c->home_written[c->homes_size] = 0;
+        c->home_slots[c->homes_size++] = slots[best];
+        counts[best] = 0;
+    }
+    free(slots);
+    free(counts);
+}
+
+static void emit_epilogue(TraceCompiler *c) {
+    // add rsp, 8; pop r15; pop r14; pop r13; pop r12; pop rbp; pop rbx; ret
+    static const uint8_t epilogue[] = {0x48, 0x83, 0xc4, 0x08, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3};
+    for (size_t i = 0; i < sizeof(epilogue); i++) {
+        emit_byte(c, epilogue[i]);
+    }
+}
+
+Trace *trace_compile(TraceRecorder *recorder, Instruction *program, Constant *constants, Constant *globals) {
+    TraceCompiler compiler = {0};
+    TraceCompiler *c = &compiler;
+    uint64_t globals_bits = (uint64_t)(uintptr_t)globals;
+    homes_choose(c, recorder, program);
+
+    // push rbx; push rbp; push r12; push r13; push r14; push r15; sub rsp, 8
+    // mov rbp, rdi; mov [rsp], rsi
+    static const uint8_t prologue[] = {0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x48, 0x83,
+                                       0xec, 0x08, 0x48, 0x89, 0xfd, 0x48, 0x89, 0x34, 0x24};
+    for (size_t i = 0; i < sizeof(prologue); i++) {
+        emit_byte(c, prologue[i]);
+    }
+    emit_mov_imm64(c, R11, globals_bits);
+    for (int i = 0; i < c->homes_size; i++) {
+        emit_mov_reg(c, 1, home_registers[i], mem_operand(RBP, c->home_slots[i] * (int32_t)sizeof(Constant)));
+    }
+
+    int loop_start = c->size;
+    for (int i = 0; i < recorder->size && !c->failed; i++) {
+        int next_pc = i + 1 < recorder->size ? recorder->pcs[i + 1] : recorder->header;
+        compile_instruction(c, program, constants, globals_bits, recorder->pcs[i], next_pc);
+    }
+    // the next iteration starts with the same (empty) operand stack
+    if (c->depth != 0) {
+        c->failed = 1;
+    }
+    emit_byte(c, 0xe9);
+    emit32(c, loop_start - (c->size + 4));
+
+    Trace *trace = NULL;
+    TraceExit *exits = malloc((c->guards_size + 1) * sizeof(TraceExit));
+    for (int g = 0; g < c->guards_size && !c->failed; g++) {
+        TraceGuard *side_exit = &c->guards[g];
+        patch32(c, side_exit->jump_at, c->size - (side_exit->jump_at + 4));
+        // mov rdx, [rsp] (the operand stack top the trace was entered with)
+        static const uint8_t load_top[] = {0x48, 0x8b, 0x14, 0x24};
+        for (size_t i = 0; i < sizeof(load_top); i++) {
+            emit_byte(c, load_top[i]);
+        }
+        for (int i = 0; i < side_exit->depth; i++) {
+            store_value(c, mem_operand(RDX, i * (int32_t)sizeof(Constant)), side_exit->stack[i]);
+        }
+        for (int i = 0; i < c->homes_size; i++) {
+            if (c->home_written[i]) {
+                emit_op(c, 1, 0x89, home_registers[i], mem_operand(RBP, c->home_slots[i] * (int32_t)sizeof(Constant)));
+            }
+        }
+        emit_mov_reg(c, 0, RAX, imm_operand(g));
+        emit_epilogue(c);
+        exits[g] = (TraceExit){.pc = side_exit->pc, .stack_depth = side_exit->depth};
+    }
+
+    if (!c->failed) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        size_t mapped_size = (c->size + page_size - 1) / page_size * page_size;
+        uint8_t *code = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code != MAP_FAILED) {
+            memcpy(code, c->bytes, c->size);
+            if (mprotect(code, mapped_size, PROT_READ | PROT_EXEC)) {
+                munmap(code, mapped_size);
+            } else {
+                trace = malloc(sizeof(Trace));
+                trace->code = code;
+                trace->mapped_size = mapped_size;
+                trace->exits = exits;
+                trace->exits_size = c->guards_size;
+            }
+        }
+    }
+    if (trace == NULL) {
+        free(exits);
+    }
+    free(c->bytes);
+    free(c->guards);
+    return trace;
+}
+
+TraceExit trace_run(Trace *trace, Constant *base, Constant *top) {
+    int (*entry)(Constant *, Constant *) = (int (*)(Constant *, Constant *))(void *)trace->code;
+    return trace->exits[entry(base, top)];
+}
+
+void trace_free(Trace *trace) {
+    munmap(trace->code, trace->mapped_size);
+    free(trace->exits);
+    free(trace);
+}
+
+#else
+
+Trace *trace_compile(TraceRecorder *recorder, Instruction *program, Constant *constants, Constant *globals) { return NULL; }
+
+TraceExit trace_run(Trace *trace, Constant *base, Constant *top) { return trace->exits[0]; }
+
+void trace_free(Trace *trace) { free(trace); }
+
+#endif
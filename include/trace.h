@@ -0,0 +1,49 @@
+#ifndef trace_h
+#define trace_h
+#include "bytecode.h"
+
+// Tracing tier for vm_run: targets of backward jumps (loop headers) are counted, and once one gets hot
+// the interpreter records the instructions of one full iteration. The recorded path is compiled to
+// x86-64 with locals kept in registers; every branch that may leave the path becomes a guard that
+// writes the registers back and hands control to the interpreter at the instruction it would have run.
+
+// backward jumps to a header before its iteration gets recorded
+#define TRACE_HOT_THRESHOLD 64
+// longest iteration that is still recorded, in instructions
+#define TRACE_MAX_LENGTH 512
+
+typedef struct {
+    int pc;          // instruction the interpreter continues from
+    int stack_depth; // values the trace left on the operand stack
+} TraceExit;
+
+typedef struct {
+    uint8_t *code;
+    size_t mapped_size;
+    TraceExit *exits;
+    int exits_size;
+} Trace;
+
+typedef struct {
+    int active;
+    int completed; // set when the recording got back to the header
+    int header;
+    int pcs[TRACE_MAX_LENGTH];
+    int size;
+} TraceRecorder;
+
+void trace_recorder_start(TraceRecorder *recorder, int header);
+
+// Called with every instruction the interpreter is about to run while recording.
+// Returns 0 once the recording is over, either completed or given up.
+int trace_record(TraceRecorder *recorder, Instruction *program, int pc);
+
+// NULL when the trace uses something the compiler does not handle or native code is not available here
+Trace *trace_compile(TraceRecorder *recorder, Instruction *program, Constant *constants, Constant *globals);
+
+// runs the trace from the loop header and returns where the interpreter should pick up
+TraceExit trace_run(Trace *trace, Constant *base, Constant *top);
+
+void trace_free(Trace *trace);
+
+#endif
@@ -1,266 +1,592 @@
 #include "vm.h"
 #include "bytecode.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static void stack_resize(Constant **stack, int stack_size, int *stack_capacity) {
-    if (*stack_capacity <= stack_size) {
-        *stack_capacity *= 2;
-        Constant *new_stack = realloc(*stack, *stack_capacity * sizeof(Constant));
-        *stack = new_stack;
-    } else if (*stack_capacity > 1024 && stack_size <= *stack_capacity / 3) {
-        *stack_capacity /= 2;
-        Constant *new_stack = realloc(*stack, *stack_capacity * sizeof(Constant));
-        *stack = new_stack;
+static void vm_frames_push(VM *vm, int return_point, int base) {
+    if (vm->frames_capacity <= vm->frames_size) {
+        vm->frames_capacity *= 2;
+        CallFrame *new_frames = realloc(vm->frames, vm->frames_capacity * sizeof(CallFrame));
+        vm->frames = new_frames;
     }
+    CallFrame frame = {.return_point = return_point, .base = base};
+    vm->frames[vm->frames_size] = frame;
+    vm->frames_size++;
 }
 
-static void stack_push(Constant **stack, int *stack_size, int *stack_capacity, Constant constant) {
-    (*stack_size)++;
-    stack_resize(stack, *stack_size, stack_capacity);
-    (*stack)[*stack_size - 1] = constant;
+int vm_init(VM *vm, Instruction *program, size_t program_size, Constant *constants, int stack_capacity, int max_frame_size) {
+    if (max_frame_size > stack_capacity) {
+        fprintf(stderr, "Stack overflow: program needs %d stack slots, limit is %d\n", max_frame_size, stack_capacity);
+        return 1;
+    }
+    vm->program_size = program_size;
+    vm->program = program;
+    vm->reg_program = NULL;
+    vm->constants = constants;
+    vm->stack_size = 0;
+    vm->stack_capacity = stack_capacity;
+    vm->max_frame_size = max_frame_size;
+    vm->frames_size = 0;
+    vm->frames_capacity = 32;
+    vm->stack = malloc(sizeof(Constant) * vm->stack_capacity);
+    vm->frames = malloc(sizeof(CallFrame) * vm->frames_capacity);
+    vm->hot_counts = NULL;
+    vm->traces = NULL;
+    vm->traces_size = 0;
+    return 0;
 }
 
-static void stack_pop(Constant **stack, int *stack_size, int *stack_capacity, Constant *constant) {
-    (*stack_size)--;
-    *constant = (*stack)[*stack_size];
-    stack_resize(stack, *stack_size, stack_capacity);
+void vm_enable_tracing(VM *vm) {
+    vm->hot_counts = calloc(vm->program_size, sizeof(int));
+    vm->traces = calloc(vm->program_size, sizeof(Trace *));
+    vm->traces_size = vm->program_size;
 }
 
-static void vm_calls_resize(VM *vm) {
-    if (vm->fn_calls_capacity <= vm->fn_calls_size) {
-        vm->fn_calls_capacity *= 2;
-        int *new_command_stack = realloc(vm->command_return_points, vm->fn_calls_capacity * sizeof(int));
-        int *new_constant_stack = realloc(vm->stack_return_points, vm->fn_calls_capacity * sizeof(int));
-        vm->command_return_points = new_command_stack;
-        vm->stack_return_points = new_constant_stack;
-    } else if (vm->fn_calls_capacity > 256 && vm->fn_calls_size <= vm->fn_calls_capacity / 3) {
-        vm->fn_calls_capacity /= 2;
-        int *new_command_stack = realloc(vm->command_return_points, vm->fn_calls_capacity * sizeof(int));
-        int *new_constant_stack = realloc(vm->stack_return_points, vm->fn_calls_capacity * sizeof(int));
-        vm->command_return_points = new_command_stack;
-        vm->stack_return_points = new_constant_stack;
+void vm_free(VM *vm) {
+    for (size_t i = 0; i < vm->traces_size; i++) {
+        if (vm->traces[i] != NULL) {
+            trace_free(vm->traces[i]);
+        }
     }
+    free(vm->traces);
+    free(vm->hot_counts);
+    free(vm->frames);
+    free(vm->stack);
 }
 
-static void vm_calls_push(VM *vm, int stack_index, int command_index) {
-    vm->fn_calls_size++;
-    vm_calls_resize(vm);
-    vm->stack_return_points[vm->fn_calls_size - 1] = stack_index;
-    vm->command_return_points[vm->fn_calls_size - 1] = command_index;
+// compiles a finished recording; a loop that can't be traced is never counted again
+static void vm_trace_finish(VM *vm, TraceRecorder *recorder) {
+    Trace *trace = NULL;
+    if (recorder->completed) {
+        trace = trace_compile(recorder, vm->program, vm->constants, vm->stack);
+    }
+    if (trace == NULL) {
+        vm->hot_counts[recorder->header] = INT_MIN;
+    } else {
+        vm->traces[recorder->header] = trace;
+    }
 }
 
-static void vm_calls_pop(VM *vm, int *stack_index, int *command_index) {
-    vm->fn_calls_size--;
-    *stack_index = vm->stack_return_points[vm->fn_calls_size];
-    *command_index = vm->command_return_points[vm->fn_calls_size];
-    vm_calls_resize(vm);
+int vm_init_reg(VM *vm, RegInstruction *program, size_t program_size, Constant *constants, int stack_capacity, int max_frame_size) {
+    if (vm_init(vm, NULL, program_size, constants, stack_capacity, max_frame_size)) {
+        return 1;
+    }
+    vm->reg_program = program;
+    return 0;
 }
 
-void vm_init(VM *vm, OpCode *commands, Constant *args, size_t program_size) {
-    vm->program_size = program_size;
-    vm->commands = commands;
-    vm->args = args;
-    vm->stack_size = 0;
-    vm->stack_capacity = 128;
-    vm->fn_calls_size = 0;
-    vm->fn_calls_capacity = 32;
-    Constant *stack = malloc(sizeof(Constant) * vm->stack_capacity);
-    int *command_return_points = malloc(sizeof(int) * vm->fn_calls_capacity);
-    int *stack_return_points = malloc(sizeof(int) * vm->fn_calls_capacity);
-    vm->stack = stack;
-    vm->command_return_points = command_return_points;
-    vm->stack_return_points = stack_return_points;
-}
+// GCC and Clang support labels as values, which lets every handler jump straight to the next one
+// instead of going back through a single shared (and badly predicted) switch branch
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_OP(code) op_##code:
+#define VM_DISPATCH() goto *dispatch[program[command_counter].code]
+#else
+#define VM_OP(code) case code:
+#define VM_DISPATCH() continue
+#endif
 
-void vm_run(VM *vm) {
+#define VM_NEXT()                                                                                                                          \
+    command_counter++;                                                                                                                     \
+    VM_DISPATCH()
+
+#define VM_JUMP(target)                                                                                                                    \
+    command_counter = (target);                                                                                                            \
+    VM_DISPATCH()
+
+// jumps that may close a loop go through loop_header when tracing is on, to count the loop and enter its trace
+#define VM_LOOP_JUMP(target)                                                                                                               \
+    if (hot_counts != NULL && (target) <= command_counter) {                                                                               \
+        command_counter = (target);                                                                                                        \
+        goto loop_header;                                                                                                                  \
+    }                                                                                                                                      \
+    VM_JUMP(target)
+
+#define VM_BINARY_OP(code, operator)                                                                                                       \
+    VM_OP(code) {                                                                                                                          \
+        top--;                                                                                                                             \
+        top[-1].int_data = top[-1].int_data operator top[0].int_data;                                                                      \
+        VM_NEXT();                                                                                                                         \
+    }
+
+// compares a local with the immediate without touching the stack
+#define VM_LOCAL_BRANCH_OP(code, operator)                                                                                                 \
+    VM_OP(code) {                                                                                                                          \
+        Instruction instruction = vm->program[command_counter];                                                                            \
+        if (base[instruction.local].int_data operator instruction.imm) {                                                                   \
+            VM_LOOP_JUMP(instruction.arg);                                                                                                 \
+        }                                                                                                                                  \
+        VM_NEXT();                                                                                                                         \
+    }
+
+// the stack is preallocated by vm_init, so pushing and popping is just moving the top pointer
+#define VM_PUSH(constant) (*top++ = (constant))
+#define VM_POP() (*--top)
+#define VM_STACK_SIZE() ((int)(top - vm->stack))
+
+int vm_run(VM *vm) {
     int command_counter = 0;
-    while (command_counter < vm->program_size) {
-        OpCode command = vm->commands[command_counter];
-        switch (command) {
-        case ShiftStackCode: {
-            int position = vm->args[command_counter].int_data;
-            vm->stack_size = position;
-            break;
-        }
-        case PushCode:
-            stack_push(&vm->stack, &vm->stack_size, &vm->stack_capacity, vm->args[command_counter]);
-            break;
-        case LoadCode: {
-            int offset = vm->args[command_counter].int_data;
-            stack_push(&vm->stack, &vm->stack_size, &vm->stack_capacity, vm->stack[vm->stack_size - offset - 1]);
-            break;
-        }
-        case StoreCode: {
-            int offset = vm->args[command_counter].int_data;
-            if (offset != 0) {
-                Constant constant;
-                stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &constant);
-                vm->stack[vm->stack_size - offset] = constant; // no "offset - 1" because stack_size is decreased by pop
-            }
-            break;
+    Instruction *program = vm->program;
+    Constant *base = vm->stack;
+    Constant *top = vm->stack + vm->stack_size;
+    Constant *stack_limit = vm->stack + vm->stack_capacity - vm->max_frame_size;
+    int *hot_counts = vm->hot_counts;
+    TraceRecorder recorder = {.active = 0};
+    if (vm->program_size == 0) {
+        return 0;
+    }
+#ifdef VM_COMPUTED_GOTO
+    static void *dispatch_table[] = {
+        [EnterCode] = &&op_EnterCode,
+        [PushCode] = &&op_PushCode,
+        [PushConstCode] = &&op_PushConstCode,
+        [LoadCode] = &&op_LoadCode,
+        [LoadGlobalCode] = &&op_LoadGlobalCode,
+        [ReturnCode] = &&op_ReturnCode,
+        [StoreCode] = &&op_StoreCode,
+        [StoreGlobalCode] = &&op_StoreGlobalCode,
+        [CallCode] = &&op_CallCode,
+        [TailCallCode] = &&op_TailCallCode,
+        [IntAddCode] = &&op_IntAddCode,
+        [IntSubtractCode] = &&op_IntSubtractCode,
+        [IntMultiplyCode] = &&op_IntMultiplyCode,
+        [IntDivideCode] = &&op_IntDivideCode,
+        [IntModCode] = &&op_IntModCode,
+        [IntEqCode] = &&op_IntEqCode,
+        [IntNotEqCode] = &&op_IntNotEqCode,
+        [IntGtCode] = &&op_IntGtCode,
+        [IntLtCode] = &&op_IntLtCode,
+        [IntGtECode] = &&op_IntGtECode,
+        [IntLtECode] = &&op_IntLtECode,
+        [BoolNotCode] = &&op_BoolNotCode,
+        [BoolAndCode] = &&op_BoolAndCode,
+        [BoolOrCode] = &&op_BoolOrCode,
+        [GotoIfCode] = &&op_GotoIfCode,
+        [GotoIfNotCode] = &&op_GotoIfNotCode,
+        [GotoCode] = &&op_GotoCode,
+        [ResumeCode] = &&op_ResumeCode,
+        [GotoIfLocalEqCode] = &&op_GotoIfLocalEqCode,
+        [GotoIfLocalNotEqCode] = &&op_GotoIfLocalNotEqCode,
+        [GotoIfLocalGtCode] = &&op_GotoIfLocalGtCode,
+        [GotoIfLocalLtCode] = &&op_GotoIfLocalLtCode,
+        [GotoIfLocalGtECode] = &&op_GotoIfLocalGtECode,
+        [GotoIfLocalLtECode] = &&op_GotoIfLocalLtECode,
+        [AddLocalCode] = &&op_AddLocalCode,
+        [PrintlnIntCode] = &&op_PrintlnIntCode,
+        [PrintlnBoolCode] = &&op_PrintlnBoolCode,
+        [PrintlnStrCode] = &&op_PrintlnStrCode,
+        [EndCode] = &&op_EndCode,
+    };
+    // while a loop iteration is recorded every instruction goes through op_record first
+    static void *record_table[EndCode + 1];
+    for (int i = 0; i <= EndCode; i++) {
+        record_table[i] = &&op_record;
+    }
+    void **dispatch = dispatch_table;
+    VM_DISPATCH();
+op_record:
+    if (!trace_record(&recorder, program, command_counter)) {
+        vm_trace_finish(vm, &recorder);
+        dispatch = dispatch_table;
+    }
+    goto *dispatch_table[program[command_counter].code];
+#else
+    while (1) {
+        if (recorder.active && !trace_record(&recorder, program, command_counter)) {
+            vm_trace_finish(vm, &recorder);
         }
-        case IntAddCode:
-        case IntSubtractCode:
-        case IntMultiplyCode:
-        case IntDivideCode:
-        case IntModCode:
-        case IntEqCode:
-        case IntNotEqCode:
-        case IntGtCode:
-        case IntLtCode:
-        case IntGtECode:
-        case IntLtECode:
-        case BoolAndCode:
-        case BoolOrCode: {
-            Constant result;
-            Constant left;
-            Constant right;
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &right);
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &left);
-            switch (command) {
-            case IntAddCode:
-                result.int_data = left.int_data + right.int_data;
-                break;
-            case IntSubtractCode:
-                result.int_data = left.int_data - right.int_data;
-                break;
-            case IntMultiplyCode:
-                result.int_data = left.int_data * right.int_data;
-                break;
-            case IntDivideCode:
-                result.int_data = left.int_data / right.int_data;
-                break;
-            case IntModCode:
-                result.int_data = left.int_data % right.int_data;
-                break;
-            case IntEqCode:
-            case IntNotEqCode:
-                result.int_data = left.int_data == right.int_data && command == IntEqCode;
-                break;
-            case IntGtCode:
-                result.int_data = left.int_data > right.int_data;
-                break;
-            case IntLtCode:
-                result.int_data = left.int_data < right.int_data;
-                break;
-            case IntGtECode:
-                result.int_data = left.int_data >= right.int_data;
-                break;
-            case IntLtECode:
-                result.int_data = left.int_data <= right.int_data;
-                break;
-            case BoolAndCode:
-                result.int_data = left.int_data && right.int_data;
-                break;
-            case BoolOrCode:
-                result.int_data = left.int_data || right.int_data;
-                break;
-            default:
-                printf("Illegal instruction\n");
-                return;
-            }
-            stack_push(&vm->stack, &vm->stack_size, &vm->stack_capacity, result);
-            break;
+        switch (program[command_counter].code) {
+#endif
+    VM_OP(EnterCode) {
+        top = base + vm->program[command_counter].arg;
+        VM_NEXT();
+    }
+    VM_OP(PushCode) {
+        Constant constant = {.int_data = vm->program[command_counter].arg};
+        VM_PUSH(constant);
+        VM_NEXT();
+    }
+    VM_OP(PushConstCode) {
+        VM_PUSH(vm->constants[vm->program[command_counter].arg]);
+        VM_NEXT();
+    }
+    VM_OP(LoadCode) {
+        VM_PUSH(base[vm->program[command_counter].arg]);
+        VM_NEXT();
+    }
+    VM_OP(LoadGlobalCode) {
+        VM_PUSH(vm->stack[vm->program[command_counter].arg]);
+        VM_NEXT();
+    }
+    VM_OP(StoreCode) {
+        base[vm->program[command_counter].arg] = VM_POP();
+        VM_NEXT();
+    }
+    VM_OP(StoreGlobalCode) {
+        vm->stack[vm->program[command_counter].arg] = VM_POP();
+        VM_NEXT();
+    }
+    VM_BINARY_OP(IntAddCode, +)
+    VM_BINARY_OP(IntSubtractCode, -)
+    VM_BINARY_OP(IntMultiplyCode, *)
+    VM_BINARY_OP(IntDivideCode, /)
+    VM_BINARY_OP(IntModCode, %)
+    VM_BINARY_OP(IntEqCode, ==)
+    VM_BINARY_OP(IntNotEqCode, !=)
+    VM_BINARY_OP(IntGtCode, >)
+    VM_BINARY_OP(IntLtCode, <)
+    VM_BINARY_OP(IntGtECode, >=)
+    VM_BINARY_OP(IntLtECode, <=)
+    VM_BINARY_OP(BoolAndCode, &&)
+    VM_BINARY_OP(BoolOrCode, ||)
+    VM_OP(BoolNotCode) {
+        top[-1].int_data = !top[-1].int_data;
+        VM_NEXT();
+    }
+    VM_OP(GotoCode) { VM_LOOP_JUMP(vm->program[command_counter].arg); }
+    VM_OP(CallCode) {
+        // the arguments already on the stack become the first slots of the callee's frame
+        Instruction instruction = vm->program[command_counter];
+        Constant *callee_base = top - instruction.imm;
+        if (callee_base > stack_limit) {
+            fflush(stdout);
+            fprintf(stderr, "Stack overflow at %d\n", command_counter);
+            vm->stack_size = VM_STACK_SIZE();
+            return 1;
         }
-        case BoolNotCode: {
-            Constant result;
-            Constant exp;
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &exp);
-            result.int_data = !exp.int_data;
-            stack_push(&vm->stack, &vm->stack_size, &vm->stack_capacity, result);
-            break;
+        vm_frames_push(vm, command_counter + 1, (int)(base - vm->stack));
+        base = callee_base;
+        VM_JUMP(instruction.arg);
+    }
+    VM_OP(TailCallCode) {
+        // the arguments replace the current frame's slots and no record is pushed,
+        // so a chain of tail calls runs in constant stack and call record space
+        Instruction instruction = vm->program[command_counter];
+        Constant *args = top - instruction.imm;
+        for (int i = 0; i < instruction.imm; i++) {
+            base[i] = args[i];
         }
-        case GotoCode: {
-            command_counter = vm->args[command_counter].int_data;
-            continue;
+        VM_JUMP(instruction.arg);
+    }
+    VM_OP(GotoIfCode) {
+        Constant condition = VM_POP();
+        if (condition.int_data) {
+            VM_LOOP_JUMP(vm->program[command_counter].arg);
         }
-        case CallCode: {
-            int resume_stack_index = vm->stack_size - 1;
-            int resume_command_index = command_counter + 1;
-            vm_calls_push(vm, resume_stack_index, resume_command_index);
-            int call_to = vm->args[command_counter].int_data;
-            command_counter = call_to;
-            continue;
+        VM_NEXT();
+    }
+    VM_OP(GotoIfNotCode) {
+        Constant condition = VM_POP();
+        if (!condition.int_data) {
+            VM_LOOP_JUMP(vm->program[command_counter].arg);
         }
-        case GotoIfCode: {
-            Constant condition;
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &condition);
-            if (condition.int_data) {
-                command_counter = vm->args[command_counter].int_data;
-                continue;
-            }
+        VM_NEXT();
+    }
+    VM_LOCAL_BRANCH_OP(GotoIfLocalEqCode, ==)
+    VM_LOCAL_BRANCH_OP(GotoIfLocalNotEqCode, !=)
+    VM_LOCAL_BRANCH_OP(GotoIfLocalGtCode, >)
+    VM_LOCAL_BRANCH_OP(GotoIfLocalLtCode, <)
+    VM_LOCAL_BRANCH_OP(GotoIfLocalGtECode, >=)
+    VM_LOCAL_BRANCH_OP(GotoIfLocalLtECode, <=)
+    VM_OP(AddLocalCode) {
+        Instruction instruction = vm->program[command_counter];
+        base[instruction.local].int_data += instruction.arg;
+        VM_NEXT();
+    }
+    VM_OP(PrintlnIntCode) {
+        Constant data = VM_POP();
+        printf("%d\n", data.int_data);
+        VM_NEXT();
+    }
+    VM_OP(PrintlnBoolCode) {
+        Constant data = VM_POP();
+        switch (data.int_data) {
+        case 0:
+            printf("false\n");
             break;
-        }
-        case PrintlnIntCode: {
-            Constant data;
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &data);
-            printf("%d\n", data.int_data);
+        default:
+            printf("true\n");
             break;
         }
-        case PrintlnBoolCode: {
-            Constant data;
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &data);
-            switch (data.int_data) {
-            case 0:
-                printf("false\n");
-                break;
-            default:
-                printf("true\n");
-                break;
-            }
-            break;
+        VM_NEXT();
+    }
+    VM_OP(PrintlnStrCode) {
+        Constant data = VM_POP();
+        printf("%s\n", data.string_data);
+        VM_NEXT();
+    }
+    VM_OP(ResumeCode) {
+        CallFrame frame = vm->frames[--vm->frames_size];
+        top = base;
+        base = vm->stack + frame.base;
+        VM_JUMP(frame.return_point);
+    }
+    VM_OP(ReturnCode) {
+        Constant value = VM_POP();
+        CallFrame frame = vm->frames[--vm->frames_size];
+        top = base;
+        base = vm->stack + frame.base;
+        VM_PUSH(value);
+        VM_JUMP(frame.return_point);
+    }
+    VM_OP(EndCode) {
+        vm->stack_size = 0;
+        vm->program_size = 0;
+        vm->frames_size = 0;
+        return 0;
+    }
+loop_header:
+    // command_counter is the target of a backward jump: run its trace, or count it and start recording once it is hot
+    if (!recorder.active && vm->traces[command_counter] != NULL) {
+        TraceExit exit = trace_run(vm->traces[command_counter], base, top);
+        top += exit.stack_depth;
+        command_counter = exit.pc;
+        VM_DISPATCH();
+    }
+    if (!recorder.active && ++hot_counts[command_counter] == TRACE_HOT_THRESHOLD) {
+        trace_recorder_start(&recorder, command_counter);
+#ifdef VM_COMPUTED_GOTO
+        dispatch = record_table;
+#endif
+    }
+    VM_DISPATCH();
+#ifndef VM_COMPUTED_GOTO
+        default:
+            fflush(stdout);
+            fprintf(stderr, "Illegal instruction at %d\n", command_counter);
+            vm->stack_size = VM_STACK_SIZE();
+            return 1;
         }
-        case PrintlnStrCode: {
-            Constant data;
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &data);
-            printf("%s\n", data.string_data);
-            break;
+    }
+#endif
+}
+
+#define VM_REG_BINARY_OP(code, operator)                                                                                                   \
+    VM_OP(code) {                                                                                                                          \
+        RegInstruction instruction = program[command_counter];                                                                             \
+        base[instruction.a].int_data = base[instruction.b].int_data operator base[instruction.c].int_data;                                 \
+        VM_NEXT();                                                                                                                         \
+    }
+
+#define VM_REG_BRANCH_OP(code, operator)                                                                                                   \
+    VM_OP(code) {                                                                                                                          \
+        RegInstruction instruction = program[command_counter];                                                                             \
+        if (base[instruction.a].int_data operator base[instruction.b].int_data) {                                                          \
+            VM_JUMP(instruction.c);                                                                                                        \
+        }                                                                                                                                  \
+        VM_NEXT();                                                                                                                         \
+    }
+
+#define VM_REG_BRANCH_IMM_OP(code, operator)                                                                                               \
+    VM_OP(code) {                                                                                                                          \
+        RegInstruction instruction = program[command_counter];                                                                             \
+        if (base[instruction.a].int_data operator instruction.b) {                                                                         \
+            VM_JUMP(instruction.c);                                                                                                        \
+        }                                                                                                                                  \
+        VM_NEXT();                                                                                                                         \
+    }
+
+// the register counterpart of vm_run: slots are addressed from the base of the current frame, so nothing is pushed or popped
+int vm_run_reg(VM *vm) {
+    int command_counter = 0;
+    RegInstruction *program = vm->reg_program;
+    Constant *base = vm->stack;
+    Constant *stack_limit = vm->stack + vm->stack_capacity - vm->max_frame_size;
+    if (vm->program_size == 0) {
+        return 0;
+    }
+#ifdef VM_COMPUTED_GOTO
+    static void *dispatch_table[] = {
+        [RegLoadIntCode] = &&op_RegLoadIntCode,
+        [RegLoadConstCode] = &&op_RegLoadConstCode,
+        [RegMoveCode] = &&op_RegMoveCode,
+        [RegGetGlobalCode] = &&op_RegGetGlobalCode,
+        [RegSetGlobalCode] = &&op_RegSetGlobalCode,
+        [RegIntAddCode] = &&op_RegIntAddCode,
+        [RegIntSubtractCode] = &&op_RegIntSubtractCode,
+        [RegIntMultiplyCode] = &&op_RegIntMultiplyCode,
+        [RegIntDivideCode] = &&op_RegIntDivideCode,
+        [RegIntModCode] = &&op_RegIntModCode,
+        [RegIntEqCode] = &&op_RegIntEqCode,
+        [RegIntNotEqCode] = &&op_RegIntNotEqCode,
+        [RegIntGtCode] = &&op_RegIntGtCode,
+        [RegIntLtCode] = &&op_RegIntLtCode,
+        [RegIntGtECode] = &&op_RegIntGtECode,
+        [RegIntLtECode] = &&op_RegIntLtECode,
+        [RegBoolAndCode] = &&op_RegBoolAndCode,
+        [RegBoolOrCode] = &&op_RegBoolOrCode,
+        [RegBoolNotCode] = &&op_RegBoolNotCode,
+        [RegIntAddImmCode] = &&op_RegIntAddImmCode,
+        [RegGotoCode] = &&op_RegGotoCode,
+        [RegGotoIfCode] = &&op_RegGotoIfCode,
+        [RegGotoIfNotCode] = &&op_RegGotoIfNotCode,
+        [RegGotoIfEqCode] = &&op_RegGotoIfEqCode,
+        [RegGotoIfNotEqCode] = &&op_RegGotoIfNotEqCode,
+        [RegGotoIfGtCode] = &&op_RegGotoIfGtCode,
+        [RegGotoIfLtCode] = &&op_RegGotoIfLtCode,
+        [RegGotoIfGtECode] = &&op_RegGotoIfGtECode,
+        [RegGotoIfLtECode] = &&op_RegGotoIfLtECode,
+        [RegGotoIfEqImmCode] = &&op_RegGotoIfEqImmCode,
+        [RegGotoIfNotEqImmCode] = &&op_RegGotoIfNotEqImmCode,
+        [RegGotoIfGtImmCode] = &&op_RegGotoIfGtImmCode,
+        [RegGotoIfLtImmCode] = &&op_RegGotoIfLtImmCode,
+        [RegGotoIfGtEImmCode] = &&op_RegGotoIfGtEImmCode,
+        [RegGotoIfLtEImmCode] = &&op_RegGotoIfLtEImmCode,
+        [RegCallCode] = &&op_RegCallCode,
+        [RegTailCallCode] = &&op_RegTailCallCode,
+        [RegReturnCode] = &&op_RegReturnCode,
+        [RegResumeCode] = &&op_RegResumeCode,
+        [RegPrintlnIntCode] = &&op_RegPrintlnIntCode,
+        [RegPrintlnBoolCode] = &&op_RegPrintlnBoolCode,
+        [RegPrintlnStrCode] = &&op_RegPrintlnStrCode,
+        [RegEndCode] = &&op_RegEndCode,
+    };
+    void **dispatch = dispatch_table;
+    VM_DISPATCH();
+#else
+    while (1) {
+        switch (program[command_counter].code) {
+#endif
+    VM_OP(RegLoadIntCode) {
+        RegInstruction instruction = program[command_counter];
+        base[instruction.a].int_data = instruction.b;
+        VM_NEXT();
+    }
+    VM_OP(RegLoadConstCode) {
+        RegInstruction instruction = program[command_counter];
+        base[instruction.a] = vm->constants[instruction.b];
+        VM_NEXT();
+    }
+    VM_OP(RegMoveCode) {
+        RegInstruction instruction = program[command_counter];
+        base[instruction.a] = base[instruction.b];
+        VM_NEXT();
+    }
+    VM_OP(RegGetGlobalCode) {
+        RegInstruction instruction = program[command_counter];
+        base[instruction.a] = vm->stack[instruction.b];
+        VM_NEXT();
+    }
+    VM_OP(RegSetGlobalCode) {
+        RegInstruction instruction = program[command_counter];
+        vm->stack[instruction.a] = base[instruction.b];
+        VM_NEXT();
+    }
+    VM_REG_BINARY_OP(RegIntAddCode, +)
+    VM_REG_BINARY_OP(RegIntSubtractCode, -)
+    VM_REG_BINARY_OP(RegIntMultiplyCode, *)
+    VM_REG_BINARY_OP(RegIntDivideCode, /)
+    VM_REG_BINARY_OP(RegIntModCode, %)
+    VM_REG_BINARY_OP(RegIntEqCode, ==)
+    VM_REG_BINARY_OP(RegIntNotEqCode, !=)
+    VM_REG_BINARY_OP(RegIntGtCode, >)
+    VM_REG_BINARY_OP(RegIntLtCode, <)
+    VM_REG_BINARY_OP(RegIntGtECode, >=)
+    VM_REG_BINARY_OP(RegIntLtECode, <=)
+    VM_REG_BINARY_OP(RegBoolAndCode, &&)
+    VM_REG_BINARY_OP(RegBoolOrCode, ||)
+    VM_OP(RegBoolNotCode) {
+        RegInstruction instruction = program[command_counter];
+        base[instruction.a].int_data = !base[instruction.b].int_data;
+        VM_NEXT();
+    }
+    VM_OP(RegIntAddImmCode) {
+        RegInstruction instruction = program[command_counter];
+        base[instruction.a].int_data = base[instruction.b].int_data + instruction.c;
+        VM_NEXT();
+    }
+    VM_OP(RegGotoCode) { VM_JUMP(program[command_counter].c); }
+    VM_OP(RegGotoIfCode) {
+        RegInstruction instruction = program[command_counter];
+        if (base[instruction.a].int_data) {
+            VM_JUMP(instruction.c);
         }
-        case ResumeCode: {
-            int stack_position;
-            int command_position;
-            int shift = vm->args[command_counter].int_data;
-            vm_calls_pop(vm, &stack_position, &command_position);
-            command_counter = command_position;
-            vm->stack_size = stack_position + 1 - shift;
-            continue;
+        VM_NEXT();
+    }
+    VM_OP(RegGotoIfNotCode) {
+        RegInstruction instruction = program[command_counter];
+        if (!base[instruction.a].int_data) {
+            VM_JUMP(instruction.c);
         }
-        case ReturnCode: {
-            Constant value;
-            int shift = vm->args[command_counter].int_data;
-            stack_pop(&vm->stack, &vm->stack_size, &vm->stack_capacity, &value);
-            int stack_position;
-            int command_position;
-            vm_calls_pop(vm, &stack_position, &command_position);
-            command_counter = command_position;
-            vm->stack_size = stack_position + 1 - shift;
-            stack_push(&vm->stack, &vm->stack_size, &vm->stack_capacity, value);
-            continue;
+        VM_NEXT();
+    }
+    VM_REG_BRANCH_OP(RegGotoIfEqCode, ==)
+    VM_REG_BRANCH_OP(RegGotoIfNotEqCode, !=)
+    VM_REG_BRANCH_OP(RegGotoIfGtCode, >)
+    VM_REG_BRANCH_OP(RegGotoIfLtCode, <)
+    VM_REG_BRANCH_OP(RegGotoIfGtECode, >=)
+    VM_REG_BRANCH_OP(RegGotoIfLtECode, <=)
+    VM_REG_BRANCH_IMM_OP(RegGotoIfEqImmCode, ==)
+    VM_REG_BRANCH_IMM_OP(RegGotoIfNotEqImmCode, !=)
+    VM_REG_BRANCH_IMM_OP(RegGotoIfGtImmCode, >)
+    VM_REG_BRANCH_IMM_OP(RegGotoIfLtImmCode, <)
+    VM_REG_BRANCH_IMM_OP(RegGotoIfGtEImmCode, >=)
+    VM_REG_BRANCH_IMM_OP(RegGotoIfLtEImmCode, <=)
+    VM_OP(RegCallCode) {
+        RegInstruction instruction = program[command_counter];
+        Constant *callee_base = base + instruction.b;
+        if (callee_base > stack_limit) {
+            fflush(stdout);
+            fprintf(stderr, "Stack overflow at %d\n", command_counter);
+            return 1;
         }
-        case EndCode: {
-            vm->stack_size = 0;
-            vm->stack_capacity = 0;
-            vm->program_size = 0;
-            vm->fn_calls_size = 0;
-            vm->fn_calls_capacity = 0;
-            // printf("Freeing %p\n", vm->stack);
-            // free(vm->stack);
-            // printf("Works 2\n");
-            // free(vm->commands);
-            // printf("Works 3\n");
-            // free(vm->args);
-            // printf("Works 4\n");
-            // free(vm->stack_return_points);
-            // printf("Works 5\n");
-            // free(vm->command_return_points);
-            // printf("Works 6\n");
-            break;
+        vm_frames_push(vm, command_counter + 1, (int)(base - vm->stack));
+        base = callee_base;
+        VM_JUMP(instruction.a);
+    }
+    VM_OP(RegTailCallCode) {
+        RegInstruction instruction = program[command_counter];
+        for (int i = 0; i < instruction.c; i++) {
+            base[i] = base[instruction.b + i];
         }
+        VM_JUMP(instruction.a);
+    }
+    VM_OP(RegReturnCode) {
+        base[0] = base[program[command_counter].a]; // the caller expects the result where the callee's frame starts
+        CallFrame frame = vm->frames[--vm->frames_size];
+        base = vm->stack + frame.base;
+        VM_JUMP(frame.return_point);
+    }
+    VM_OP(RegResumeCode) {
+        CallFrame frame = vm->frames[--vm->frames_size];
+        base = vm->stack + frame.base;
+        VM_JUMP(frame.return_point);
+    }
+    VM_OP(RegPrintlnIntCode) {
+        printf("%d\n", base[program[command_counter].a].int_data);
+        VM_NEXT();
+    }
+    VM_OP(RegPrintlnBoolCode) {
+        switch (base[program[command_counter].a].int_data) {
+        case 0:
+            printf("false\n");
+            break;
         default:
-            printf("Illegal instruction at %d\n", command_counter);
+            printf("true\n");
             break;
         }
-        command_counter++;
+        VM_NEXT();
+    }
+    VM_OP(RegPrintlnStrCode) {
+        printf("%s\n", base[program[command_counter].a].string_data);
+        VM_NEXT();
+    }
+    VM_OP(RegEndCode) {
+        vm->stack_size = 0;
+        vm->program_size = 0;
+        vm->frames_size = 0;
+        return 0;
+    }
+#ifndef VM_COMPUTED_GOTO
+        default:
+            fflush(stdout);
+            fprintf(stderr, "Illegal instruction at %d\n", command_counter);
+            return 1;
+        }
     }
+#endif
 }
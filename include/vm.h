@@ -1,28 +1,47 @@
 #ifndef vm_h
 #define vm_h
 #include "bytecode.h"
+#include "trace.h"
+
+// default operand stack size in slots, the whole region is allocated up front and never resized
+#define VM_STACK_CAPACITY (1 << 20)
+
+// one record per active call, pushed by CALL and popped by RETURN/RESUME
+typedef struct {
+    int return_point; // instruction to continue from in the caller
+    int base;         // stack index of the caller's frame base
+} CallFrame;
 
 typedef struct {
     Constant *stack;
     int stack_size;
     int stack_capacity;
-    OpCode *commands;
-    Constant *args;
+    int max_frame_size;
+    Instruction *program;
+    RegInstruction *reg_program; // set instead of program when running the register instruction set
+    Constant *constants;
     size_t program_size;
-    int *command_return_points;
-    int *stack_return_points;
-    int fn_calls_size;
-    int fn_calls_capacity;
+    CallFrame *frames;
+    int frames_size;
+    int frames_capacity;
+    int *hot_counts;    // per instruction, how often a backward jump went there; NULL unless tracing is enabled
+    Trace **traces;     // per loop header, its compiled trace if there is one
+    size_t traces_size; // program_size when tracing was enabled, END clears program_size
 } VM;
 
-void vm_init(VM *vm, OpCode *commands, Constant *args, size_t program_size);
+int vm_init(VM *vm, Instruction *program, size_t program_size, Constant *constants, int stack_capacity, int max_frame_size);
+
+int vm_init_reg(VM *vm, RegInstruction *program, size_t program_size, Constant *constants, int stack_capacity, int max_frame_size);
 
-void vm_run(VM *vm);
+// makes vm_run record and compile the loops that run often
+void vm_enable_tracing(VM *vm);
 
-static void stack_resize(Constant **stack, int stack_size, int *stack_capacity);
+// releases the stack, the call records and the compiled traces, not the program or its constants
+void vm_free(VM *vm);
 
-static void stack_push(Constant **stack, int *stack_size, int *stack_capacity, Constant constant);
+// both return 0, or 1 when the program stopped on a runtime error (reported on stderr)
+int vm_run(VM *vm);
 
-static void stack_pop(Constant **stack, int *stack_size, int *stack_capacity, Constant *constant);
+int vm_run_reg(VM *vm);
 
 #endif
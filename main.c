@@ -1,22 +1,68 @@
 #include "include/analyzer.h"
+#include "include/aot.h"
 #include "include/ast.h"
 #include "include/bytecode.h"
 #include "include/bytecode_compiler.h"
 #include "include/error.h"
+#include "include/image.h"
+#include "include/jit.h"
 #include "include/lexer.h"
+#include "include/object.h"
 #include "include/parser.h"
+#include "include/peephole.h"
+#include "include/source.h"
 #include "include/vm.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+// runs a program loaded into vm with the requested execution tier and reports how long it took, then frees vm;
+// returns nonzero when the program stopped on a runtime error
+static int run(VM *vm, int register_vm, int jit, int tracing, int visual_debug) {
+    if (tracing) {
+        vm_enable_tracing(vm);
+    }
+    JitCode jit_code = {.code = NULL};
+    if (jit) {
+        if (jit_compile(&jit_code, vm)) {
+            fprintf(stderr, "JIT is not available, falling back to the interpreter\n");
+        } else if (visual_debug) {
+            printf("\nJIT generated %lu bytes of machine code\n", jit_code.code_size);
+        }
+    }
+    printf("\n---- program output ----\n\n");
+    clock_t run_start_time = clock();
+    int run_error;
+    if (register_vm) {
+        run_error = vm_run_reg(vm);
+    } else if (jit_code.code != NULL) {
+        run_error = jit_run(&jit_code, vm);
+        jit_free(&jit_code);
+    } else {
+        run_error = vm_run(vm);
+    }
+    clock_t run_finish_time = clock();
+    vm_free(vm);
+    double run_time_spent = (double)(run_finish_time - run_start_time) / CLOCKS_PER_SEC;
+    printf("\nTime spent executing: %fs\n", run_time_spent);
+    return run_error;
+}
+
 int main(int argc, char **argv) {
     clock_t begin_time = clock();
     int debug = 0;
     int debug_lexer = 0;
     int visual_debug = 0;
+    int peephole = 1;
+    int register_vm = 0;
+    int jit = 0;
+    int tracing = 0;
+    int use_cache = 1;
     char *filename = NULL;
+    char *c_output = NULL;
+    char *object_output = NULL;
     for (int i = 1; i < argc; i++) {
         char *arg = argv[i];
         if (arg[0] == '-') {
@@ -26,12 +72,26 @@ int main(int argc, char **argv) {
                 visual_debug = 1;
             } else if (!strcmp(arg, "-d")) {
                 debug = 1;
+            } else if (!strcmp(arg, "-n")) {
+                peephole = 0;
+            } else if (!strcmp(arg, "-r")) {
+                register_vm = 1;
+            } else if (!strcmp(arg, "-j")) {
+                jit = 1;
+            } else if (!strcmp(arg, "-t")) {
+                tracing = 1;
+            } else if (!strcmp(arg, "-f")) {
+                use_cache = 0;
+            } else if (!strcmp(arg, "-c") && i + 1 < argc) {
+                c_output = argv[++i];
+            } else if (!strcmp(arg, "-o") && i + 1 < argc) {
+                object_output = argv[++i];
             } else {
-                printf("Usage: cimpl [filename] [-l] [-p] [-v]\n");
+                printf("Usage: cimpl [filename] [-l] [-v] [-d] [-n] [-r] [-j] [-t] [-c output.c] [-o output.o] [-f]\n");
                 return 64;
             }
         } else if (filename != NULL) {
-            printf("Usage: cimpl [filename] [-l] [-p] [-v]\n");
+            printf("Usage: cimpl [filename] [-l] [-v] [-d] [-n] [-r] [-j] [-t] [-c output.c] [-o output.o] [-f]\n");
             return 64;
         } else {
             filename = argv[i];
@@ -39,27 +99,51 @@ int main(int argc, char **argv) {
     }
 
     if (filename == NULL) {
-        printf("Usage: cimpl [filename] [-l] [-p] [-v]\n");
+        printf("Usage: cimpl [filename] [-l] [-v] [-d] [-n] [-r] [-j] [-t] [-c output.c] [-o output.o] [-f]\n");
+        return 64;
+    }
+    if (jit && register_vm) {
+        printf("The JIT only translates the stack instruction set, -j and -r can't be combined\n");
+        return 64;
+    }
+    if (object_output != NULL && register_vm) {
+        printf("Object files are written from the stack instruction set, -o and -r can't be combined\n");
+        return 64;
+    }
+    if (tracing && (jit || register_vm)) {
+        printf("Tracing runs inside the stack interpreter, -t can't be combined with -j or -r\n");
         return 64;
     }
 
-    FILE *file = fopen(filename, "r");
-    char *source = NULL;
-    size_t size = 0;
-
-    if (file == NULL) {
+    SourceFile source_file;
+    if (source_load(&source_file, filename)) {
         printf("No file %s found\n", filename);
         return 64;
     }
+    char *source = source_file.data;
+    size_t size = source_file.size;
+    if (size > UINT32_MAX) {
+        printf("%s is too large, sources are limited to 4 GiB\n", filename);
+        return 64;
+    }
 
-    char ch;
-    while (1) {
-        char ch = fgetc(file);
-        source = (char *)realloc(source, (size + 1) * sizeof(char));
-        source[size] = ch;
-        size++;
-        if (ch == EOF) {
-            break;
+    // the frontend and the compiler are skipped when the cache has bytecode for exactly this source;
+    // runs that show or write what the frontend produces, or change what it produces, always go through it
+    use_cache = use_cache && !register_vm && peephole && !debug && !debug_lexer && !visual_debug && c_output == NULL && object_output == NULL;
+    uint64_t source_hash = 0;
+    char *image_path = NULL;
+    if (use_cache) {
+        source_hash = image_source_hash(source, size);
+        image_path = image_cache_path(source_hash);
+        BytecodeImage image;
+        if (image_path != NULL && !image_map(&image, image_path, source_hash)) {
+            VM vm;
+            if (vm_init(&vm, image.program, image.program_size, image.constants, VM_STACK_CAPACITY, image.max_frame_size)) {
+                return 1;
+            }
+            int run_error = run(&vm, 0, jit, tracing, 0);
+            image_unmap(&image);
+            return run_error;
         }
     }
 
@@ -146,7 +230,14 @@ int main(int argc, char **argv) {
     tt_int_ht_set(&infixes, GtE, 1);
     tt_int_ht_set(&infixes, LtE, 1);
 
-    ParseSource p_source = tokenize(source, size);
+    // tokens, symbols, the AST and the compiler's bookkeeping, released in one go once there is bytecode
+    Arena arena;
+    arena_init(&arena);
+    Interner symbols;
+    interner_init(&symbols, source, &arena);
+    ParseSource p_source = tokenize(source, size, &symbols, &arena);
+    LineIndex lines;
+    line_index_init(&lines, source, size, &arena);
     printf("Size: %lu tokens\n", p_source.size);
 
     if (debug_lexer) {
@@ -155,52 +246,122 @@ int main(int argc, char **argv) {
         }
     }
 
-    ParseCache cache = {
-        .err = NULL, .current = 0, .legal_infixes = &infixes, .precs = &precs, .tokens = p_source.tokens, .tokens_size = p_source.size};
-    size_t pg_size = 0;
-    size_t pg_capacity = 0;
-    Stmt *program = NULL;
-    parse(&cache, 0, &program, &pg_size, &pg_capacity);
+    Ast ast;
+    ast_init(&ast, p_source.tokens, &arena);
+    ParseCache cache = {.err = NULL,
+                        .current = 0,
+                        .legal_infixes = &infixes,
+                        .precs = &precs,
+                        .tokens = p_source.tokens,
+                        .tokens_size = p_source.size,
+                        .arena = &arena,
+                        .ast = &ast};
+    parse(&cache, 0, &ast.program);
     if (cache.err != NULL) {
-        error_print(cache.err);
+        error_print(cache.err, &lines);
         return 1;
     }
 
-    AnalysisCache *an_cache = analysis_cache_create(source);
-    validate(an_cache, program, pg_size);
+    AnalysisCache *an_cache = analysis_cache_create(&ast, source, &arena);
+    validate(an_cache, ast.program);
     clock_t end_time = clock();
     double time_spent = (double)(end_time - begin_time) / CLOCKS_PER_SEC;
     if (an_cache->errors_size) {
         for (int i = 0; i < an_cache->errors_size; i++) {
-            error_print(an_cache->errors[i]);
+            error_print(an_cache->errors[i], &lines);
         }
         return 1;
     }
     if (visual_debug) {
-        visualize_program(program, pg_size, 0, source);
+        visualize_program(&ast, ast.program, 0, source);
         printf("\n");
         printf("Visualized successfully!\n");
     }
     printf("Time spend parsing: %fs\n", time_spent);
+    if (c_output != NULL) {
+        FILE *c_file = fopen(c_output, "w");
+        if (c_file == NULL) {
+            printf("Can't open %s for writing\n", c_output);
+            return 64;
+        }
+        int aot_error = aot_compile_to_c(&ast, source, size, c_file);
+        fclose(c_file);
+        if (aot_error) {
+            remove(c_output);
+            return 64;
+        }
+        printf("Wrote %s, build it with: cc -O2 %s\n", c_output, c_output);
+        return 0;
+    }
     CompileCache compile_cache;
     compile_cache_init(&compile_cache);
+    compile_cache.ast = &ast;
     compile_cache.source = source;
-    compile_program(program, pg_size, &compile_cache);
+    compile_cache.arena = &arena;
+    if (register_vm) {
+        compile_reg_program(ast.program, &compile_cache);
+    } else {
+        compile_program(ast.program, &compile_cache);
+    }
     if (compile_cache.has_error) {
         return 64;
     }
+    if (register_vm) {
+        if (visual_debug) {
+            reg_bytecode_visualize(compile_cache.reg_program, compile_cache.reg_program_size, compile_cache.constants);
+        }
+    } else {
+        if (visual_debug) {
+            bytecode_visualize(compile_cache.program, compile_cache.program_size, compile_cache.constants);
+        }
+        if (peephole) {
+            int removed = peephole_optimize(&compile_cache);
+            if (visual_debug) {
+                printf("\nPeephole optimizer removed %d instructions\n", removed);
+                bytecode_visualize(compile_cache.program, compile_cache.program_size, compile_cache.constants);
+            }
+        }
+    }
+    // the rest only needs the program and its constants (string constants are copies, not slices of the source)
     if (visual_debug) {
-        bytecode_visualize(compile_cache.commands, compile_cache.args, compile_cache.program_size);
+        printf("\nFrontend arena: %lu bytes\n", arena.used);
+    }
+    arena_release(&arena);
+    source_release(&source_file);
+    if (object_output != NULL) {
+        FILE *object_file = fopen(object_output, "wb");
+        if (object_file == NULL) {
+            printf("Can't open %s for writing\n", object_output);
+            return 64;
+        }
+        int object_error = object_write(compile_cache.program, compile_cache.program_size, compile_cache.constants,
+                                        compile_cache.constants_size, VM_STACK_CAPACITY, compile_cache.max_frame_size, object_file);
+        fclose(object_file);
+        if (object_error) {
+            remove(object_output);
+            return 64;
+        }
+        printf("Wrote %s, link it with: cc %s bin/cimpl_runtime.o\n", object_output, object_output);
+        return 0;
     }
     if (debug) {
         return 0;
     }
+    if (image_path != NULL && image_write(image_path, source_hash, compile_cache.program, compile_cache.program_size, compile_cache.constants,
+                                          compile_cache.constants_size, compile_cache.max_frame_size)) {
+        printf("Can't write the bytecode cache %s\n", image_path);
+    }
     VM vm;
-    vm_init(&vm, compile_cache.commands, compile_cache.args, compile_cache.program_size);
-    printf("\n---- program output ----\n\n");
-    clock_t run_start_time = clock();
-    vm_run(&vm);
-    clock_t run_finish_time = clock();
-    double run_time_spent = (double)(run_finish_time - run_start_time) / CLOCKS_PER_SEC;
-    printf("\nTime spent executing: %fs\n", run_time_spent);
+    int vm_error;
+    if (register_vm) {
+        vm_error = vm_init_reg(&vm, compile_cache.reg_program, compile_cache.reg_program_size, compile_cache.constants, VM_STACK_CAPACITY,
+                               compile_cache.max_frame_size);
+    } else {
+        vm_error = vm_init(&vm, compile_cache.program, compile_cache.program_size, compile_cache.constants, VM_STACK_CAPACITY,
+                           compile_cache.max_frame_size);
+    }
+    if (vm_error) {
+        return 1;
+    }
+    return run(&vm, register_vm, jit, tracing, visual_debug);
 }